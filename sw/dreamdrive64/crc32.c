@@ -0,0 +1,63 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+#include <stdbool.h>
+
+#include "crc32.h"
+
+#define CRC32_POLY 0xEDB88320u
+
+static uint32_t crc32_table[8][256];
+static bool crc32_table_ready = false;
+
+static void crc32_init_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (CRC32_POLY & -(crc & 1));
+        }
+        crc32_table[0][i] = crc;
+    }
+    // table[n] is table[0] moved on by n more zero bytes
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int n = 1; n < 8; n++) {
+            uint32_t crc = crc32_table[n - 1][i];
+            crc32_table[n][i] = (crc >> 8) ^ crc32_table[0][crc & 0xFF];
+        }
+    }
+    crc32_table_ready = true;
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len) {
+    if (!crc32_table_ready) {
+        crc32_init_table();
+    }
+    crc = ~crc;
+
+    // Byte at a time up to a word boundary, the M0+ can't load unaligned words
+    while (len && ((uintptr_t)data & 3)) {
+        crc = (crc >> 8) ^ crc32_table[0][(crc ^ *data++) & 0xFF];
+        len--;
+    }
+
+    // Little endian, the first byte is the low byte of the word
+    const uint32_t *words = (const uint32_t *)data;
+    while (len >= 8) {
+        uint32_t a = *words++ ^ crc;
+        uint32_t b = *words++;
+        crc = crc32_table[7][a & 0xFF] ^ crc32_table[6][(a >> 8) & 0xFF] ^
+            crc32_table[5][(a >> 16) & 0xFF] ^ crc32_table[4][a >> 24] ^
+            crc32_table[3][b & 0xFF] ^ crc32_table[2][(b >> 8) & 0xFF] ^
+            crc32_table[1][(b >> 16) & 0xFF] ^ crc32_table[0][b >> 24];
+        len -= 8;
+    }
+
+    data = (const uint8_t *)words;
+    while (len--) {
+        crc = (crc >> 8) ^ crc32_table[0][(crc ^ *data++) & 0xFF];
+    }
+    return ~crc;
+}
@@ -0,0 +1,16 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, the zlib one), eight bytes per step with slice-by-8
+// tables. Start from 0 and feed the data in pieces of any size:
+//   crc = crc32_update(0, a, lenA);
+//   crc = crc32_update(crc, b, lenB);
+// The 8KB of tables are built in RAM on first use.
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len);
@@ -43,15 +43,9 @@ void verify_rom_data_helper() {
 		// for(int k = 0; k < PSRAM_CHIP_CAPACITY_BYTES; k+=512) {
         for(int k = 0; k < numBytesToRead; k+=512) {
         // while(1) {
-			// Command instruction
-			uart_tx_program_putc(COMMAND_START);
-    		uart_tx_program_putc(COMMAND_START2);
-			uart_tx_program_putc(COMMAND_VERIFY_ROM_DATA);
-
-            // Sending 512 bytes of data
+			// Command instruction, sending 512 bytes of data
             uint16_t bytesToSend = 512;
-			uart_tx_program_putc(bytesToSend >> 8);
-            uart_tx_program_putc(bytesToSend);
+			mcu_packet_tx_begin(&ddr64_packet_tx, COMMAND_VERIFY_ROM_DATA, bytesToSend);
 
 			// Read one byte from psram and send it to mcu2
 			// Read 512 bytes at a time
@@ -62,16 +56,10 @@ void verify_rom_data_helper() {
                 // volatile uint32_t word = ptr_32[addr];
 
                 // printf("[%08x]: %04x\n", addr*2, word);
-                while (!uart_tx_program_is_writable()) {
-                    tight_loop_contents();
-                }
-				uart_tx_program_putc((char)(word));
-
-                while (!uart_tx_program_is_writable()) {
-                    tight_loop_contents();
-                }
-                uart_tx_program_putc((char)(word >> 8));
+				mcu_packet_tx_put(&ddr64_packet_tx, (char)(word));
+                mcu_packet_tx_put(&ddr64_packet_tx, (char)(word >> 8));
 			}
+			mcu_packet_tx_end(&ddr64_packet_tx);
 
             // Sleep to allow time to verify data 
             // so mcu2 doesn't get overwhelemed?
@@ -15,3 +15,4 @@
 #define MCU2_LOAD_ROM 0
 #define MCU1_USE_LOADED_ROM 0
 #define IS_DOING_READ_TEST 0
+#define MCU2_PSRAM_BENCHMARK 0 // Time psram writes and reads at boot, before mcu1 runs
@@ -0,0 +1,166 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "flash_array.h"
+
+// FNV-1a over the chunk, a word at a time
+uint32_t flash_array_chunk_hash(const uint8_t *chunk) {
+    const uint32_t *words = (const uint32_t *)chunk;
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < FLASH_ARRAY_CHUNK_BYTES / 4; i++) {
+        hash = (hash ^ words[i]) * 16777619u;
+    }
+    return hash;
+}
+
+void flash_array_dedup_reset(flash_array_dedup_t *dedup) {
+    memset(dedup->chunk, 0xFF, sizeof(dedup->chunk));
+}
+
+uint16_t flash_array_dedup_lookup(const flash_array_dedup_t *dedup, uint32_t hash) {
+    uint32_t bucket = hash & (FLASH_ARRAY_DEDUP_BUCKETS - 1);
+    if (dedup->chunk[bucket] == FLASH_ARRAY_NO_CHUNK || dedup->hash[bucket] != hash) {
+        return FLASH_ARRAY_NO_CHUNK;
+    }
+    return dedup->chunk[bucket];
+}
+
+void flash_array_dedup_insert(flash_array_dedup_t *dedup, uint32_t hash, uint16_t chunk) {
+    uint32_t bucket = hash & (FLASH_ARRAY_DEDUP_BUCKETS - 1);
+    dedup->hash[bucket] = hash;
+    dedup->chunk[bucket] = chunk;
+}
+
+static uint32_t flash_library_checksum(const flash_library_t *library) {
+    const uint8_t *bytes = (const uint8_t *)library + offsetof(flash_library_t, erase_count);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(flash_library_t) - offsetof(flash_library_t, erase_count); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+void flash_library_init(flash_library_t *library) {
+    memset(library, 0, sizeof(flash_library_t));
+    memcpy(library->magic, FLASH_LIBRARY_MAGIC, sizeof(FLASH_LIBRARY_MAGIC));
+    memset(library->owner, FLASH_LIBRARY_BLOCK_FREE, sizeof(library->owner));
+    library->owner[0] = FLASH_LIBRARY_BLOCK_TABLE;
+}
+
+bool flash_library_valid(const flash_library_t *library) {
+    return memcmp(library->magic, FLASH_LIBRARY_MAGIC, sizeof(FLASH_LIBRARY_MAGIC)) == 0 &&
+        library->checksum == flash_library_checksum(library);
+}
+
+// The current table of the two copies, NULL if neither is valid
+const flash_library_t *flash_library_newest(const flash_library_t *a, const flash_library_t *b) {
+    bool aValid = flash_library_valid(a);
+    bool bValid = flash_library_valid(b);
+    if (aValid && bValid) {
+        return a->sequence > b->sequence ? a : b;
+    }
+    return aValid ? a : bValid ? b : NULL;
+}
+
+// Readies the table to be written, returns the copy it goes to
+uint32_t flash_library_seal(flash_library_t *library) {
+    library->sequence++;
+    library->checksum = flash_library_checksum(library);
+    return library->sequence & 1;
+}
+
+int flash_library_find(const flash_library_t *library, const char *path, uint32_t size, uint16_t fdate, uint16_t ftime) {
+    for (int i = 0; i < FLASH_LIBRARY_ENTRIES; i++) {
+        const flash_library_entry_t *entry = &library->entries[i];
+        if (entry->size != 0 && entry->size == size && entry->fdate == fdate && entry->ftime == ftime &&
+            strncmp(entry->path, path, FLASH_LIBRARY_PATH_LENGTH) == 0) {
+            return i;
+        }
+    }
+    return FLASH_LIBRARY_NO_ENTRY;
+}
+
+uint32_t flash_library_free_blocks(const flash_library_t *library) {
+    uint32_t blocks = 0;
+    for (int i = 0; i < FLASH_ARRAY_BLOCKS; i++) {
+        blocks += library->owner[i] == FLASH_LIBRARY_BLOCK_FREE;
+    }
+    return blocks;
+}
+
+// The blocks keep their data until they are handed out again
+void flash_library_remove(flash_library_t *library, int entry) {
+    for (int i = 0; i < FLASH_ARRAY_BLOCKS; i++) {
+        if (library->owner[i] == entry) {
+            library->owner[i] = FLASH_LIBRARY_BLOCK_FREE;
+        }
+    }
+    memset(&library->entries[entry], 0, sizeof(flash_library_entry_t));
+}
+
+static int flash_library_oldest_unpinned(const flash_library_t *library) {
+    int oldest = FLASH_LIBRARY_NO_ENTRY;
+    for (int i = 0; i < FLASH_LIBRARY_ENTRIES; i++) {
+        const flash_library_entry_t *entry = &library->entries[i];
+        if (entry->size != 0 && !(entry->flags & FLASH_LIBRARY_PINNED) &&
+            (oldest == FLASH_LIBRARY_NO_ENTRY || entry->added < library->entries[oldest].added)) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+// Finds an unused entry with `blocks` free blocks, evicting the oldest
+// unpinned roms if it has to. Nothing is evicted when pinned roms leave too
+// little room, FLASH_LIBRARY_NO_ENTRY is returned instead.
+int flash_library_make_room(flash_library_t *library, uint32_t blocks) {
+    uint32_t available = flash_library_free_blocks(library);
+    bool entryAvailable = false;
+    for (int i = 0; i < FLASH_LIBRARY_ENTRIES; i++) {
+        const flash_library_entry_t *entry = &library->entries[i];
+        entryAvailable |= entry->size == 0 || !(entry->flags & FLASH_LIBRARY_PINNED);
+    }
+    for (int i = 0; i < FLASH_ARRAY_BLOCKS; i++) {
+        uint8_t owner = library->owner[i];
+        available += owner < FLASH_LIBRARY_ENTRIES && !(library->entries[owner].flags & FLASH_LIBRARY_PINNED);
+    }
+    if (!entryAvailable || available < blocks) {
+        return FLASH_LIBRARY_NO_ENTRY;
+    }
+
+    while (true) {
+        int unused = FLASH_LIBRARY_NO_ENTRY;
+        for (int i = 0; i < FLASH_LIBRARY_ENTRIES && unused == FLASH_LIBRARY_NO_ENTRY; i++) {
+            if (library->entries[i].size == 0) {
+                unused = i;
+            }
+        }
+        if (unused != FLASH_LIBRARY_NO_ENTRY && flash_library_free_blocks(library) >= blocks) {
+            return unused;
+        }
+        flash_library_remove(library, flash_library_oldest_unpinned(library));
+    }
+}
+
+// Hands out the free block erased the fewest times, counting the erase the
+// caller is about to do. -1 when the array is full.
+int flash_library_alloc_block(flash_library_t *library, int entry) {
+    int block = -1;
+    for (int i = 0; i < FLASH_ARRAY_BLOCKS; i++) {
+        if (library->owner[i] == FLASH_LIBRARY_BLOCK_FREE &&
+            (block < 0 || library->erase_count[i] < library->erase_count[block])) {
+            block = i;
+        }
+    }
+    if (block >= 0) {
+        library->owner[block] = entry;
+        library->erase_count[block]++;
+    }
+    return block;
+}
@@ -0,0 +1,112 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "psram.h"
+#include "rom_vars.h"
+
+// Roms in the NOR flash array (U7, U8) are deduplicated in 1KB chunks, the
+// same scheme load_rom --compress uses for a rom in mcu1's flash. The array
+// keeps 1KB whatever chunk size load_rom picked for mcu1's rom.
+// rom_mapping holds the chunk index of every 1KB of the rom and the PI handler
+// reads the chunk from the array.
+//
+// Array addresses run linearly over the chips, 16MB each from FLASH_CHIP_INDEX.
+// The array holds a library of roms, described by a table in block 0. Each rom
+// owns whole 64KB erase blocks, anywhere in the array: its mapping table starts
+// its first block and the chunks fill the rest. Chunk indexes count 1KB from
+// the start of the array, so a rom's blocks don't need to be next to each other.
+#define FLASH_ARRAY_CHIPS 2
+#define FLASH_ARRAY_BYTES (FLASH_ARRAY_CHIPS * FLASH_CHIP_CAPACITY_BYTES)
+#define FLASH_ARRAY_CHIP(address) (FLASH_CHIP_INDEX + ((address) >> 24))
+#define FLASH_ARRAY_OFFSET(address) ((address) & (FLASH_CHIP_CAPACITY_BYTES - 1))
+
+#define FLASH_ARRAY_SECTOR_BYTES 4096
+#define FLASH_ARRAY_PAGE_BYTES 256
+#define FLASH_ARRAY_CHUNK_SHIFT 10
+#define FLASH_ARRAY_CHUNK_BYTES (1 << FLASH_ARRAY_CHUNK_SHIFT)
+#define FLASH_ARRAY_BLOCK_BYTES (64 * 1024)
+#define FLASH_ARRAY_BLOCKS (FLASH_ARRAY_BYTES / FLASH_ARRAY_BLOCK_BYTES)
+#define FLASH_ARRAY_CHUNKS_PER_BLOCK (FLASH_ARRAY_BLOCK_BYTES / FLASH_ARRAY_CHUNK_BYTES)
+#define FLASH_ARRAY_BLOCK_ADDRESS(block) ((uint32_t)(block) * FLASH_ARRAY_BLOCK_BYTES)
+
+#define FLASH_ARRAY_MAPPING_BYTES (((MAPPING_TABLE_LEN * 2) + FLASH_ARRAY_CHUNK_BYTES - 1) & ~(FLASH_ARRAY_CHUNK_BYTES - 1))
+#define FLASH_ARRAY_MAPPING_CHUNKS (FLASH_ARRAY_MAPPING_BYTES / FLASH_ARRAY_CHUNK_BYTES)
+#define FLASH_ARRAY_CHUNK_ADDRESS(index) ((uint32_t)(index) << FLASH_ARRAY_CHUNK_SHIFT)
+
+// Largest rom the mapping table can describe
+#define FLASH_ARRAY_MAX_ROM_BYTES ((uint32_t)MAPPING_TABLE_LEN * FLASH_ARRAY_CHUNK_BYTES)
+
+// Blocks a rom needs at most, its mapping plus every chunk unique
+#define FLASH_ARRAY_ROM_BLOCKS(size) ((FLASH_ARRAY_MAPPING_BYTES + (uint32_t)(size) + FLASH_ARRAY_BLOCK_BYTES - 1) / FLASH_ARRAY_BLOCK_BYTES)
+
+// The library table is written to sectors 0 and 1 in turn, so a table that
+// was cut off part way leaves the one before it. The valid copy with the
+// highest sequence is the current one. The rest of block 0 is unused.
+#define FLASH_LIBRARY_MAGIC "ddr64romlibrary"
+#define FLASH_LIBRARY_TABLE_ADDRESS(copy) ((uint32_t)(copy) * FLASH_ARRAY_SECTOR_BYTES)
+#define FLASH_LIBRARY_ENTRIES 8
+#define FLASH_LIBRARY_PATH_LENGTH 240
+#define FLASH_LIBRARY_NO_ENTRY (-1)
+
+// Block owners, otherwise the index of the entry that owns the block
+#define FLASH_LIBRARY_BLOCK_FREE 0xFF
+#define FLASH_LIBRARY_BLOCK_TABLE 0xFE
+
+// Entry flags
+#define FLASH_LIBRARY_PINNED 0x0001
+
+// A rom in the library. The source fields let the loader tell the rom is
+// programmed without reading it from the sd card again. size 0 is unused.
+typedef struct {
+    char path[FLASH_LIBRARY_PATH_LENGTH];
+    uint32_t size;
+    uint16_t fdate;
+    uint16_t ftime;
+    uint32_t mapping_address;
+    uint32_t added;         // Table sequence it was programmed in, the oldest unpinned rom is evicted first
+    uint16_t unique_chunks;
+    uint16_t flags;
+} flash_library_entry_t;
+
+typedef struct {
+    char magic[16];
+    uint32_t sequence;
+    uint32_t checksum;      // Over everything after it
+    uint16_t erase_count[FLASH_ARRAY_BLOCKS];
+    uint8_t owner[FLASH_ARRAY_BLOCKS];
+    flash_library_entry_t entries[FLASH_LIBRARY_ENTRIES];
+} flash_library_t;
+
+// Finds chunks that were programmed before. Lossy, each bucket remembers the
+// last chunk that hashed to it, and a hit is only a candidate: the caller
+// compares the data before mapping to it.
+#define FLASH_ARRAY_DEDUP_BUCKETS 2048
+#define FLASH_ARRAY_NO_CHUNK 0xFFFF
+
+typedef struct {
+    uint32_t hash[FLASH_ARRAY_DEDUP_BUCKETS];
+    uint16_t chunk[FLASH_ARRAY_DEDUP_BUCKETS];
+} flash_array_dedup_t;
+
+uint32_t flash_array_chunk_hash(const uint8_t *chunk);
+void flash_array_dedup_reset(flash_array_dedup_t *dedup);
+uint16_t flash_array_dedup_lookup(const flash_array_dedup_t *dedup, uint32_t hash);
+void flash_array_dedup_insert(flash_array_dedup_t *dedup, uint32_t hash, uint16_t chunk);
+
+void flash_library_init(flash_library_t *library);
+bool flash_library_valid(const flash_library_t *library);
+const flash_library_t *flash_library_newest(const flash_library_t *a, const flash_library_t *b);
+uint32_t flash_library_seal(flash_library_t *library);
+int flash_library_find(const flash_library_t *library, const char *path, uint32_t size, uint16_t fdate, uint16_t ftime);
+uint32_t flash_library_free_blocks(const flash_library_t *library);
+void flash_library_remove(flash_library_t *library, int entry);
+int flash_library_make_room(flash_library_t *library, uint32_t blocks);
+int flash_library_alloc_block(flash_library_t *library, int entry);
@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "pico/time.h"
 #include "pico/platform.h"
 #include "hardware/gpio.h"
@@ -10,13 +11,14 @@
 #include "joybus.pio.h"
 
 #include "pio_uart/pio_uart.h"
+#include "internal_sd_card.h"
 
 volatile uint16_t eeprom_type = EEPROM_TYPE_16K; // default to 4K eeprom
 volatile uint8_t eeprom[2048]; // sized to fit the 16K eeprom
 
-#define COMMAND_START    0xDE
-#define COMMAND_START2   0xAD
 #define COMMAND_BACKUP_EEPROM  (0xBE)
+static uint8_t eeprom_frame[MCU_PACKET_FRAME_BYTES(2048)];
+
 // Send eeprom data to mcu2
 void sendEepromData() {
 
@@ -34,18 +36,11 @@ void sendEepromData() {
         numBytesToSend = 2048;
     }
 
-    uart_tx_program_putc(COMMAND_START);
-    uart_tx_program_putc(COMMAND_START2);
-    uart_tx_program_putc(COMMAND_BACKUP_EEPROM);
-    uart_tx_program_putc((uint8_t)(numBytesToSend >> 8));
-    uart_tx_program_putc((uint8_t)(numBytesToSend));
-
-    for (int i = 0; i < numBytesToSend; i++) {
-        while (!uart_tx_program_is_writable()) {
-            tight_loop_contents();
-        }
-        uart_tx_program_putc(eeprom[i]);
-    }
+    // Copied so the game can keep writing the eeprom while it goes out with DMA
+    uart_tx_program_write_wait();
+    memcpy(MCU_PACKET_FRAME_PAYLOAD(eeprom_frame), (const void *)eeprom, numBytesToSend);
+    uint32_t frameBytes = mcu_packet_frame(&ddr64_packet_tx, COMMAND_BACKUP_EEPROM, eeprom_frame, numBytesToSend);
+    uart_tx_program_write_async(eeprom_frame, frameBytes);
 }
 
 /* PIOs are separate state machines for handling IOs with high timing precision. You load a program into them and they do their stuff on their own with deterministic timing,
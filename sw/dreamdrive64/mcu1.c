@@ -32,6 +32,7 @@
 #include "psram.h"
 
 #include "rom_vars.h"
+#include "flash_array.h"
 
 #include "joybus/joybus.h"
 
@@ -73,6 +74,7 @@ static const gpio_config_t mcu1_gpio_config[] = {
 	// init the pin for the correct config.
 	{PIN_MCU2_CS, GPIO_IN, false, false, false, GPIO_DRIVE_STRENGTH_4MA, GPIO_FUNC_PIO1},
 	{PIN_MCU2_DIO, GPIO_IN, false, false, false, GPIO_DRIVE_STRENGTH_4MA, GPIO_FUNC_PIO1},
+	{PIN_MCU2_SCK, GPIO_IN, false, false, false, GPIO_DRIVE_STRENGTH_4MA, GPIO_FUNC_PIO1},
 };
 
 volatile bool g_restart_pi_handler = false;
@@ -154,14 +156,26 @@ uint16_t rom_read_test(int dma_chan) {
 	return next_word;
 }
 
+// MCU2 programmed the rom into the flash array. Copy its mapping into
+// rom_mapping and leave the ssi set up to stream from the first flash chip.
+static void flash_array_enable_rom() {
+	qspi_enable_spi(4, FLASH_ARRAY_CHIP(g_flashArrayMappingAddress));
+	qspi_spi_read_data(FLASH_ARRAY_OFFSET(g_flashArrayMappingAddress), (uint8_t *)rom_mapping, MAPPING_TABLE_LEN * sizeof(uint16_t));
+	psram_set_cs(FLASH_CHIP_INDEX);
+	qspi_init_flash_qspi();
+	g_currentMemoryArrayChip = FLASH_CHIP_INDEX;
+}
+
 uint32_t last_rom_cache_update_address = 0;
 void __no_inline_not_in_flash_func(mcu1_core1_entry)() {
-	pio_uart_init(PIN_MCU2_DIO, PIN_MCU2_CS); // turn on inter-mcu comms
+	// turn on inter-mcu comms, mcu2 clocks the sd data in on PIN_MCU2_SCK
+	pio_uart_init_clocked(PIN_MCU2_DIO, PIN_MCU2_SCK, PIN_MCU2_CS, -1);
 	// pio_uart_stop(false, true); // disable rx?
 
 	bool readingData = false;
 	bool startJoybus = false;
 	volatile bool isWaitingForRomLoad = false;
+	volatile bool isWaitingForLibraryUpdate = false;
 
 	// Some debug and test variables
 	volatile bool hasInit = false;
@@ -248,14 +262,24 @@ void __no_inline_not_in_flash_func(mcu1_core1_entry)() {
 			// Process anything that might be on the uart buffer
 			mcu1_process_rx_buffer();
 
-			if (sendDataReady && !isWaitingForRomLoad) {
+			if (sendDataReady && isWaitingForLibraryUpdate) {
+				// Take the bus back and serve the menu from flash again
+				qspi_enable_flash(4);
+				isWaitingForLibraryUpdate = false;
+				sd_is_busy = false;
+				readingData = false;
+			} else if (sendDataReady && !isWaitingForRomLoad) {
 				// Now that the data is written to the array, go ahead and release the lock
 				sd_is_busy = false;
 				readingData = false;
 			} else if (sendDataReady && isWaitingForRomLoad) {
 				set_demux_mcu_variables(PIN_DEMUX_A0, PIN_DEMUX_A1, PIN_DEMUX_A2, PIN_DEMUX_IE);
-				uint currentChipIndex = START_ROM_LOAD_CHIP_INDEX;
-				qspi_enable_qspi(currentChipIndex, MAX_MEMORY_ARRAY_CHIP_INDEX);
+				if (g_romFromFlashArray) {
+					flash_array_enable_rom();
+				} else {
+					uint currentChipIndex = START_ROM_LOAD_CHIP_INDEX;
+					qspi_enable_qspi(currentChipIndex, MAX_MEMORY_ARRAY_CHIP_INDEX);
+				}
 
 				// After the rom has been loaded we can choose to validate the data
 				// by reading from mcu1 and sending it to mcu2 to verify.
@@ -297,6 +321,9 @@ void __no_inline_not_in_flash_func(mcu1_core1_entry)() {
 				case CORE1_LOAD_NEW_ROM_CMD:
 					sd_is_busy = true;
 					romLoading = true;
+					// MCU2 says so if this one ends up in the flash array
+					g_romFromFlashArray = false;
+					n64_pi_rom_ready_clear();
 					isWaitingForRomLoad = true;
 
 					readingData = true;
@@ -314,6 +341,28 @@ void __no_inline_not_in_flash_func(mcu1_core1_entry)() {
 
 					break;
 
+				case CORE1_PIN_ROM_CMD:
+					isWaitingForLibraryUpdate = true;
+					n64_pi_rom_ready_clear();
+
+					readingData = true;
+					rx_uart_buffer_reset();
+
+					// MCU2 programs the flash array, same as for a rom load
+					qspi_disable();
+					g_restart_pi_handler = true;
+
+					ddr64_send_pin_rom_command();
+					break;
+
+				case CORE1_SAVE_PI_CALIBRATION_CMD:
+					ddr64_send_pi_calibration(pi_calibration_register);
+					break;
+
+				case CORE1_SEND_PI_STATS_CMD:
+					ddr64_send_pi_stats();
+					break;
+
 				default:
 					break;
 			}
@@ -99,6 +99,7 @@ static const gpio_config_t mcu2_gpio_config[] = {
 	{PIN_CIC_DCLK, GPIO_IN, false, false, false, GPIO_DRIVE_STRENGTH_4MA, GPIO_FUNC_SIO},
 
 	// Configure as PIO that implements UART becase of the way the pins from MCU1 are connected to MCU2
+	// SCK clocks the data to MCU1
 	{PIN_SPI1_SCK, GPIO_IN, true, false, false, GPIO_DRIVE_STRENGTH_4MA, GPIO_FUNC_PIO1}, 
 	//{PIN_SPI1_TX, GPIO_IN, false, false, false, GPIO_DRIVE_STRENGTH_4MA, GPIO_FUNC_PIO1}, // not using
 	{PIN_SPI1_RX, GPIO_IN, false, false, false, GPIO_DRIVE_STRENGTH_4MA, GPIO_FUNC_PIO1},
@@ -129,6 +130,11 @@ void main_task_entry(__unused void *params)
 	// load_new_rom("Legend of Zelda, The - Ocarina of Time (U) (V1.2) [!].z64");
 	
 	vTaskDelay(100);
+
+#if MCU2_PSRAM_BENCHMARK == 1
+	psram_write_benchmark();
+#endif
+
 	printf("Booting MCU1...\n");
 	gpio_put(PIN_MCU1_RUN, 1);
 
@@ -138,7 +144,8 @@ void main_task_entry(__unused void *params)
 
 	// Setup PIO UART
 	printf("Initing MCU1<->MCU2 serial bridge...");
-	pio_uart_init(PIN_SPI1_CS, PIN_SPI1_RX);
+	// Sd data goes to mcu1 clocked on PIN_SPI1_SCK, commands come back over the uart
+	pio_uart_init_clocked(PIN_SPI1_CS, -1, PIN_SPI1_RX, PIN_SPI1_SCK);
 	printf("Finshed!\n");
 
 	// mcu2_setup_verify_rom_data(); // opens the file into some global variables
@@ -174,6 +181,13 @@ void main_task_entry(__unused void *params)
 			startRomLoad = false;
 		}
 
+		if (start_pinRom && !romLoading) {
+			start_pinRom = false;
+			romLoading = true;
+			pin_selected_rom();
+			romLoading = false;
+		}
+
 		if (start_saveEeepromData) {
 			start_saveEeepromData = false;
 			start_eeprom_sd_save();
@@ -184,6 +198,16 @@ void main_task_entry(__unused void *params)
 			start_sram_sd_save();
 		}
 
+		if (start_savePiCalibration) {
+			start_savePiCalibration = false;
+			save_pi_calibration_to_sd();
+		}
+
+		if (start_printPiStats) {
+			start_printPiStats = false;
+			print_pi_stats();
+		}
+
 	#if IS_DOING_READ_TEST == 1
 		if (is_verifying_rom_data_from_mcu1) {
 			is_verifying_rom_data_from_mcu1 = false;
@@ -219,7 +243,7 @@ void main_task_entry(__unused void *params)
 
 			// if (t2 == 2) {
 			// 	printf("Starting inter_mcu_comms test...\n");
-			// 	inter_mcu_comms_test();
+			// 	inter_mcu_comms_test(PIN_SPI1_RX, PIN_SPI1_SCK);
 			// }
 
 			// if (t2 % 10 == 0 && t2 != 0) {
@@ -0,0 +1,181 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+#include <stddef.h>
+
+#include "mcu_packet.h"
+#include "crc32.h"
+
+#define RX_HUNT 0
+#define RX_START2 1
+#define RX_HEADER 2
+#define RX_PAYLOAD 3
+#define RX_CRC 4
+
+void mcu_packet_tx_init(mcu_packet_tx_t *tx, mcu_packet_putc_t putc) {
+    tx->putc = putc;
+    tx->seq = 0;
+    tx->crc = 0;
+}
+
+// Writes the header, returns the crc so far
+static uint32_t tx_header(mcu_packet_tx_t *tx, uint8_t cmd, uint16_t len, uint8_t *header) {
+    header[0] = MCU_PACKET_START;
+    header[1] = MCU_PACKET_START2;
+    header[2] = cmd;
+    header[3] = tx->seq++;
+    header[4] = len >> 8;
+    header[5] = len;
+    uint32_t crc = crc32_update(0, &header[2], 4);
+    header[6] = crc;
+    return crc;
+}
+
+static void put_crc(uint8_t *dst, uint32_t crc) {
+    dst[0] = crc >> 24;
+    dst[1] = crc >> 16;
+    dst[2] = crc >> 8;
+    dst[3] = crc;
+}
+
+void mcu_packet_tx_begin(mcu_packet_tx_t *tx, uint8_t cmd, uint16_t len) {
+    uint8_t header[MCU_PACKET_HEADER_BYTES];
+    tx->crc = tx_header(tx, cmd, len, header);
+    for (int i = 0; i < MCU_PACKET_HEADER_BYTES; i++) {
+        tx->putc(header[i]);
+    }
+}
+
+void mcu_packet_tx_put(mcu_packet_tx_t *tx, uint8_t byte) {
+    tx->crc = crc32_update(tx->crc, &byte, 1);
+    tx->putc(byte);
+}
+
+void mcu_packet_tx_write(mcu_packet_tx_t *tx, const uint8_t *data, uint32_t len) {
+    tx->crc = crc32_update(tx->crc, data, len);
+    for (uint32_t i = 0; i < len; i++) {
+        tx->putc(data[i]);
+    }
+}
+
+void mcu_packet_tx_end(mcu_packet_tx_t *tx) {
+    uint8_t crc[MCU_PACKET_CRC_BYTES];
+    put_crc(crc, tx->crc);
+    for (int i = 0; i < MCU_PACKET_CRC_BYTES; i++) {
+        tx->putc(crc[i]);
+    }
+}
+
+void mcu_packet_send(mcu_packet_tx_t *tx, uint8_t cmd, const uint8_t *data, uint16_t len) {
+    mcu_packet_tx_begin(tx, cmd, len);
+    mcu_packet_tx_write(tx, data, len);
+    mcu_packet_tx_end(tx);
+}
+
+uint32_t mcu_packet_frame(mcu_packet_tx_t *tx, uint8_t cmd, uint8_t *frame, uint16_t len) {
+    uint32_t crc = tx_header(tx, cmd, len, frame);
+    crc = crc32_update(crc, MCU_PACKET_FRAME_PAYLOAD(frame), len);
+    put_crc(MCU_PACKET_FRAME_PAYLOAD(frame) + len, crc);
+    return MCU_PACKET_FRAME_BYTES(len);
+}
+
+void mcu_packet_rx_init(mcu_packet_rx_t *rx, mcu_packet_buffer_t buffer_for) {
+    rx->buffer_for = buffer_for;
+    rx->synced = false;
+    rx->next_seq = 0;
+    rx->cmd = 0;
+    rx->seq = 0;
+    rx->len = 0;
+    rx->payload = NULL;
+    rx->bad = 0;
+    rx->missed = 0;
+    mcu_packet_rx_reset(rx);
+}
+
+void mcu_packet_rx_reset(mcu_packet_rx_t *rx) {
+    rx->state = RX_HUNT;
+    rx->index = 0;
+}
+
+static int rx_bad(mcu_packet_rx_t *rx) {
+    rx->bad++;
+    mcu_packet_rx_reset(rx);
+    return MCU_PACKET_BAD;
+}
+
+static int rx_ready(mcu_packet_rx_t *rx) {
+    if (rx->synced && rx->seq != rx->next_seq) {
+        rx->missed += (uint8_t)(rx->seq - rx->next_seq);
+    }
+    rx->synced = true;
+    rx->next_seq = rx->seq + 1;
+    mcu_packet_rx_reset(rx);
+    return MCU_PACKET_READY;
+}
+
+int mcu_packet_rx_feed(mcu_packet_rx_t *rx, uint8_t byte) {
+    switch (rx->state) {
+        case RX_HUNT:
+            if (byte == MCU_PACKET_START) {
+                rx->state = RX_START2;
+            }
+            break;
+
+        case RX_START2:
+            if (byte == MCU_PACKET_START2) {
+                rx->state = RX_HEADER;
+                rx->index = 0;
+            } else if (byte != MCU_PACKET_START) {
+                rx->state = RX_HUNT;
+            }
+            break;
+
+        case RX_HEADER:
+            rx->header[rx->index++] = byte;
+            if (rx->index < sizeof(rx->header)) {
+                break;
+            }
+
+            rx->crc = crc32_update(0, rx->header, 4);
+            if ((uint8_t)rx->crc != rx->header[4]) {
+                return rx_bad(rx);
+            }
+
+            rx->cmd = rx->header[0];
+            rx->seq = rx->header[1];
+            rx->len = (rx->header[2] << 8) | rx->header[3];
+            rx->payload = rx->buffer_for(rx->cmd, rx->len);
+            if (rx->payload == NULL && rx->len > 0) {
+                return rx_bad(rx);
+            }
+            rx->index = 0;
+            rx->state = rx->len > 0 ? RX_PAYLOAD : RX_CRC;
+            break;
+
+        case RX_PAYLOAD:
+            rx->payload[rx->index++] = byte;
+            if (rx->index >= rx->len) {
+                rx->crc = crc32_update(rx->crc, rx->payload, rx->len);
+                rx->index = 0;
+                rx->state = RX_CRC;
+            }
+            break;
+
+        case RX_CRC:
+            rx->crc_bytes[rx->index++] = byte;
+            if (rx->index < MCU_PACKET_CRC_BYTES) {
+                break;
+            }
+
+            uint32_t crc = (rx->crc_bytes[0] << 24) | (rx->crc_bytes[1] << 16) | (rx->crc_bytes[2] << 8) | rx->crc_bytes[3];
+            if (crc != rx->crc) {
+                return rx_bad(rx);
+            }
+            return rx_ready(rx);
+    }
+
+    return MCU_PACKET_NONE;
+}
@@ -0,0 +1,82 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Packets between mcu1 and mcu2 over the pio uart:
+//   0xDE 0xAD cmd seq lenHi lenLo check payload[len] crc32 (4 bytes, big endian)
+// check is the low byte of the CRC32 of cmd..lenLo, so a corrupted length is
+// caught before the receiver waits for a payload that isn't coming. The
+// CRC32 at the end covers cmd..lenLo and the payload. seq counts the packets
+// each side sent, a gap tells the receiver packets were lost.
+//
+// Bytes outside a packet are skipped, so debug bytes on the link are harmless.
+#define MCU_PACKET_START 0xDE
+#define MCU_PACKET_START2 0xAD
+#define MCU_PACKET_HEADER_BYTES 7
+#define MCU_PACKET_CRC_BYTES 4
+#define MCU_PACKET_MAX_PAYLOAD 0xFFFF
+
+// A whole packet in one buffer, for sending with DMA
+#define MCU_PACKET_FRAME_BYTES(len) (MCU_PACKET_HEADER_BYTES + (len) + MCU_PACKET_CRC_BYTES)
+#define MCU_PACKET_FRAME_PAYLOAD(frame) ((frame) + MCU_PACKET_HEADER_BYTES)
+
+// mcu_packet_rx_feed results
+#define MCU_PACKET_NONE 0
+#define MCU_PACKET_READY 1
+#define MCU_PACKET_BAD 2
+
+typedef void (*mcu_packet_putc_t)(uint8_t byte);
+
+// Where the payload of a packet goes, NULL to drop the packet
+typedef uint8_t *(*mcu_packet_buffer_t)(uint8_t cmd, uint16_t len);
+
+typedef struct {
+    mcu_packet_putc_t putc;
+    uint8_t seq;
+    uint32_t crc;
+} mcu_packet_tx_t;
+
+typedef struct {
+    mcu_packet_buffer_t buffer_for;
+    uint8_t state;
+    uint8_t header[MCU_PACKET_HEADER_BYTES - 2];
+    uint8_t crc_bytes[MCU_PACKET_CRC_BYTES];
+    uint32_t index;
+    uint32_t crc;
+    bool synced;            // Has seen a packet, so seq can be checked
+    uint8_t next_seq;
+
+    // The packet, valid after MCU_PACKET_READY until the next byte is fed
+    uint8_t cmd;
+    uint8_t seq;
+    uint16_t len;
+    uint8_t *payload;
+
+    uint32_t bad;           // Packets that failed a check or had nowhere to go
+    uint32_t missed;        // Packets lost going by seq
+} mcu_packet_rx_t;
+
+void mcu_packet_tx_init(mcu_packet_tx_t *tx, mcu_packet_putc_t putc);
+void mcu_packet_tx_begin(mcu_packet_tx_t *tx, uint8_t cmd, uint16_t len);
+void mcu_packet_tx_put(mcu_packet_tx_t *tx, uint8_t byte);
+void mcu_packet_tx_write(mcu_packet_tx_t *tx, const uint8_t *data, uint32_t len);
+void mcu_packet_tx_end(mcu_packet_tx_t *tx);
+void mcu_packet_send(mcu_packet_tx_t *tx, uint8_t cmd, const uint8_t *data, uint16_t len);
+
+// Fills in the header and crc around a payload already at
+// MCU_PACKET_FRAME_PAYLOAD(frame), returns the bytes to send. Nothing is
+// sent, but it takes a seq from tx, so frames must go out in the order they
+// were made.
+uint32_t mcu_packet_frame(mcu_packet_tx_t *tx, uint8_t cmd, uint8_t *frame, uint16_t len);
+
+void mcu_packet_rx_init(mcu_packet_rx_t *rx, mcu_packet_buffer_t buffer_for);
+// Drops a packet that is part way in, the counters are kept
+void mcu_packet_rx_reset(mcu_packet_rx_t *rx);
+int mcu_packet_rx_feed(mcu_packet_rx_t *rx, uint8_t byte);
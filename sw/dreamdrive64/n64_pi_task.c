@@ -11,12 +11,14 @@
 #include <string.h>
 #include <stdlib.h>
 #include <hardware/dma.h>
+#include <hardware/clocks.h>
 
 // #include "pico/stdlib.h"
 // #include "pico/stdio.h"
 #include "pico/multicore.h"
 #include "hardware/irq.h"
 #include "hardware/structs/systick.h"
+#include "hardware/structs/xip_ctrl.h"
 
 #include "n64_defs.h"
 #include "n64_pi_task.h"
@@ -30,6 +32,7 @@
 #include "qspi_helper.h"
 #include "sdcard/internal_sd_card.h"
 #include "psram.h"
+#include "flash_array.h"
 #include "rom.h"
 #include "rom_vars.h"
 
@@ -37,10 +40,63 @@ volatile int g_currentMemoryArrayChip = START_ROM_LOAD_CHIP_INDEX;
  // Used when addressing chips outside the starting one
 volatile uint32_t address_modifier = 0;
 volatile bool g_loadRomFromMemoryArray = false;
+volatile bool g_romFromFlashArray = false;
+volatile uint32_t g_flashArrayMappingAddress = 0;
 static uint n64_pi_pio_offset;
-volatile uint32_t tempChip = 0;
+volatile int tempChip = 0;
 
 volatile uint16_t *ptr16 = (volatile uint16_t *)0x13000000; // no cache
+volatile uint32_t *ptr32 = (volatile uint32_t *)0x13000000; // no cache
+
+// Serve psram roms through the cached XIP alias instead of streaming them from
+// the SSI. A miss costs a line fill per 8 bytes, but boot code and assets that
+// get loaded again come out of the 16KB cache. Set by the menu through
+// DDR64_REGISTER_PSRAM_XIP_CACHED.
+volatile bool g_psramRomXipCached = false;
+
+volatile uint32_t pi_rom_ready[PI_ROM_READY_WORDS];
+volatile bool g_romReadyCheck = false;
+
+void n64_pi_rom_ready_clear(void)
+{
+	g_romReadyCheck = false;
+	for (int i = 0; i < PI_ROM_READY_WORDS; i++) {
+		pi_rom_ready[i] = 0;
+	}
+}
+
+// Lines are tagged by address only. A chip is 8MB and the cached alias 16MB, so
+// odd and even chips are read through different halves of the alias and
+// neighbouring chips can share the cache. Only when a half changes owner does
+// the cache get flushed. 0 means the half holds no lines.
+static uint8_t xip_half_chip[2];
+
+// Rom prefetch ring. The DMA fills the two slots alternately, each with the
+// next two rom half-words, so while one slot is being served the next 32 bits
+// are already on the way. Aligned to its size for the DMA write ring.
+volatile uint32_t rom_prefetch_buf[2] __attribute__((aligned(8)));
+
+// PSRAM rom reads are streamed, one quad read per block of rom instead of one
+// per 32 bits. The SSI clocks a block out back to back and a DMA channel drains
+// its RX fifo into this ring, so a word is ready as soon as the DMA write
+// address has moved past it. Once a block is in, the next one is queued while
+// the buffered words are served, so a long burst never waits on a new read.
+// Blocks are kept to 256 bytes so CS isn't held low longer than the PSRAM's
+// 8us tCEM at QSPI_QUAD_MODE_CLK_DIVIDER 4 (64 frames * 8 clocks + cmd/addr/wait).
+// The ring holds two of them.
+#define ROM_STREAM_BLOCK_WORDS (64)
+#define ROM_STREAM_PAGE_WORDS (1024 / sizeof(uint32_t))
+#define ROM_STREAM_RING_BITS (9)
+#define ROM_STREAM_RING_MASK ((1 << ROM_STREAM_RING_BITS) - 1)
+#define ROM_STREAM_RING_WORDS ((1 << ROM_STREAM_RING_BITS) / sizeof(uint32_t))
+volatile uint32_t rom_stream_buf[ROM_STREAM_RING_WORDS] __attribute__((aligned(1 << ROM_STREAM_RING_BITS)));
+volatile int rom_stream_chan = -1;
+static uintptr_t rom_stream_end; // Ring address after the last word of the current block
+static uint32_t rom_stream_addr; // Chip address of the next block
+// The SSI only raises DREQ_XIP_SSIRX with RDMAE set. XIP reads come out of
+// the same fifo and the channel would take their data, so RDMAE is only set
+// while the stream has the SSI.
+static bool rom_stream_owns_ssi = false;
 volatile int dma_chan = -1;
 volatile int dma_chan_high = -1;
 volatile int sram_dma_chan = -1;
@@ -49,32 +105,84 @@ volatile uint16_t dma_bi = 0;
 
 uint16_t rom_mapping[MAPPING_TABLE_LEN];
 
+// Fastest PI bus timing known to work for a system clock and PSRAM divider.
+// Roms are served with the one for the clock we run at, anything not listed
+// gets PI_TIMING_SLOWEST. Notes from the hardware runs that found them:
+//   0x8040, 0x4040, 0x3040 boot @ 266/4
+//   0x1B40 boots @ 266/4 with the single half-word dma loop, 0x1A40 doesn't
+//   0x1640 boots @ 300/4
+//   0x1740 @ 336/4 with the dma kicked off after pio->txf[0]
+//   0x2040 boots and runs games @ 360/4 (qspi at 90MHz)
+//   0x1240 only if psram/flash is readable at 133MHz
+// pi_sim with the streaming rom path passes 0x0240 @ 266/4, not tried on a cart yet.
+const pi_timing_profile_t pi_timing_profiles[] = {
+	{ 266000, 4, 0x2040 },
+	{ 300000, 4, 0x1640 },
+	{ 336000, 4, 0x1740 },
+	{ 360000, 4, 0x2040 },
+};
+const int pi_timing_profile_count = sizeof(pi_timing_profiles) / sizeof(pi_timing_profiles[0]);
+
+// Served in the rom header, picked when the handler starts
+static uint16_t pi_timing_header_word = PI_TIMING_SLOWEST;
+// Set by the menu through DDR64_REGISTER_PI_TIMING, 0 uses the profile
+volatile uint16_t pi_timing_override = 0;
+// Found for this board by the test rom calibration, loaded from the sd card with each rom. 0 if there isn't one.
+volatile uint16_t pi_timing_calibrated = 0;
+// DDR64_REGISTER_PI_CALIBRATION, handed to core1 to save
+volatile uint32_t pi_calibration_register = 0;
+
+// Handler for every 1MB of the address space
+uint8_t pi_region_table[PI_REGION_TABLE_LEN];
+
 #if COMPRESSED_ROM
 // do something
 #else
 static const uint16_t *rom_file_16 = (uint16_t *) rom_chunks;
 #endif
 
-// Num bytes to offset from address based on chip index
-#define PSRAM_ADDRESS_MODIFIER_1 (0)
-#define PSRAM_ADDRESS_MODIFIER_2 (PSRAM_CHIP_CAPACITY_BYTES)
-#define PSRAM_ADDRESS_MODIFIER_3 (PSRAM_CHIP_CAPACITY_BYTES * 2)
-#define PSRAM_ADDRESS_MODIFIER_4 (PSRAM_CHIP_CAPACITY_BYTES * 3)
-#define PSRAM_ADDRESS_MODIFIER_5 (PSRAM_CHIP_CAPACITY_BYTES * 4)
-#define PSRAM_ADDRESS_MODIFIER_6 (PSRAM_CHIP_CAPACITY_BYTES * 5)
-#define PSRAM_ADDRESS_MODIFIER_7 (PSRAM_CHIP_CAPACITY_BYTES * 6)
-#define PSRAM_ADDRESS_MODIFIER_8 (PSRAM_CHIP_CAPACITY_BYTES * 7)
-uint32_t g_addressModifierTable[] = {
-	0, // no chip 0
-	PSRAM_ADDRESS_MODIFIER_1, // start at chip 1
-	PSRAM_ADDRESS_MODIFIER_2,
-	PSRAM_ADDRESS_MODIFIER_3,
-	PSRAM_ADDRESS_MODIFIER_4,
-	PSRAM_ADDRESS_MODIFIER_5,
-	PSRAM_ADDRESS_MODIFIER_6,
-	PSRAM_ADDRESS_MODIFIER_7,
-	PSRAM_ADDRESS_MODIFIER_8
-};
+volatile pi_region_stats_t pi_stats[PI_REGION_COUNT];
+
+// Each update is a load and store of volatile memory, some inside the spin loops
+#if PI_STATS
+#define PI_STAT_ADD(region, field, n) (pi_stats[region].field += (n))
+#else
+#define PI_STAT_ADD(region, field, n) ((void)0)
+#endif
+
+uint16_t pi_timing_for(uint32_t sys_khz, uint32_t qspi_clk_divider)
+{
+	for (int i = 0; i < pi_timing_profile_count; i++) {
+		if (pi_timing_profiles[i].sys_khz == sys_khz && pi_timing_profiles[i].qspi_clk_divider == qspi_clk_divider) {
+			return pi_timing_profiles[i].header_word;
+		}
+	}
+
+	return PI_TIMING_SLOWEST;
+}
+
+void pi_region_table_init(void)
+{
+	for (uint32_t i = 0; i < PI_REGION_TABLE_LEN; i++) {
+		uint32_t address = i << PI_REGION_TABLE_SHIFT;
+
+		if (address == CART_DOM1_ADDR2_START) {
+			// Holds the header, which gets the bus timing patched in
+			pi_region_table[i] = PI_REGION_ROM_HEADER;
+		} else if (address >= CART_DOM1_ADDR2_START && address <= CART_DOM1_ADDR2_END) {
+			pi_region_table[i] = PI_REGION_ROM;
+		} else if (address >= CART_SRAM_START && address <= CART_SRAM_END) {
+			pi_region_table[i] = PI_REGION_SRAM;
+		} else if (address == (DDR64_BASE_ADDRESS_START & ~(PI_REGION_SIZE - 1))) {
+			// BASE and CIBASE share this 1MB, the handler checks the exact ranges
+			pi_region_table[i] = PI_REGION_DDR64;
+		} else if (address == 0x81000000) {
+			pi_region_table[i] = PI_REGION_DEBUG;
+		} else {
+			pi_region_table[i] = PI_REGION_UNHANDLED;
+		}
+	}
+}
 
 static inline uint32_t n64_pi_get_value(PIO pio)
 {
@@ -82,6 +190,59 @@ static inline uint32_t n64_pi_get_value(PIO pio)
 	return value;
 }
 
+// Read from `chip_addr` to the end of its block on the selected PSRAM chip.
+// Anything still streaming is dropped. Returns where the first word will land,
+// right after whatever is in the ring now.
+static inline volatile uint32_t *rom_stream_read(uint32_t chip_addr)
+{
+	// Stop at the end of the 1KB PSRAM page, the chips only burst across it at low clocks
+	uint32_t words = ROM_STREAM_PAGE_WORDS - ((chip_addr >> 2) & (ROM_STREAM_PAGE_WORDS - 1));
+	if (words > ROM_STREAM_BLOCK_WORDS) {
+		words = ROM_STREAM_BLOCK_WORDS;
+	}
+
+	// Disabling the SSI ends the last transaction and clears its fifos.
+	// ctrlr1 can only be written while disabled.
+	ssi_hw->ssienr = 0;
+	ssi_hw->ctrlr1 = words - 1;
+	if (!rom_stream_owns_ssi) {
+		// DREQ as soon as a frame is in the fifo
+		ssi_hw->dmardlr = 0;
+		ssi_hw->dmacr = SSI_DMACR_RDMAE_BITS;
+		rom_stream_owns_ssi = true;
+	}
+	ssi_hw->ssienr = 1;
+
+	// Nothing lands in the ring between the disable and the command going out
+	uintptr_t landed = dma_hw->ch[rom_stream_chan].write_addr;
+	rom_stream_end = ((landed + words * 4) & ROM_STREAM_RING_MASK) | (uintptr_t)rom_stream_buf;
+	rom_stream_addr = (chip_addr & ~3) + words * 4;
+
+	// Same quad fast read qspi_init_qspi sets up for XIP. The flash array
+	// chips take the address with a mode byte after it, see qspi_init_flash_qspi.
+	ssi_hw->dr0 = 0xEB;
+	ssi_hw->dr0 = g_romFromFlashArray ? (chip_addr & ~3) << 8 : chip_addr & ~3;
+
+	return (volatile uint32_t *)landed;
+}
+
+static inline volatile uint32_t *rom_stream_next(volatile uint32_t *pos)
+{
+	return (volatile uint32_t *)(((uintptr_t)(pos + 1) & ROM_STREAM_RING_MASK) | (uintptr_t)rom_stream_buf);
+}
+
+// Hand the SSI back to XIP: end the stream, one frame per access and no DMA
+static inline void rom_stream_release_ssi(void)
+{
+	if (rom_stream_owns_ssi) {
+		ssi_hw->ssienr = 0;
+		ssi_hw->ctrlr1 = 0;
+		ssi_hw->dmacr = 0;
+		ssi_hw->ssienr = 1;
+		rom_stream_owns_ssi = false;
+	}
+}
+
 void __no_inline_not_in_flash_func(n64_pi_run)(void)
 {
 	// allocate space for sram
@@ -91,14 +252,31 @@ void __no_inline_not_in_flash_func(n64_pi_run)(void)
 	// } else {
 	// 	printf("SUCCESS! 1Mb of sram allocated.\n");
 	// }
-	// If we aren't able to allocate 1Mbit, use the "stock" size of 256kbit
-	sram = malloc(SRAM_256KBIT_SIZE / sizeof(uint16_t));
+	// If we aren't able to allocate 1Mbit, use the "stock" size of 256kbit.
+	// Kept across restarts, the backup for the next rom goes into it.
+	if (sram == NULL) {
+		sram = (uint16_t *)malloc(SRAM_256KBIT_SIZE);
+		memset(sram, 0, SRAM_256KBIT_SIZE);
+	}
 
 	// Probably already restarted or first time start, we want to run the loop
 	// until this is true, so always reset it
 	g_restart_pi_handler = false;
 
-	g_currentMemoryArrayChip = START_ROM_LOAD_CHIP_INDEX;
+	g_currentMemoryArrayChip = g_romFromFlashArray ? FLASH_CHIP_INDEX : START_ROM_LOAD_CHIP_INDEX;
+	rom_stream_owns_ssi = false;
+	memset((void *)pi_stats, 0, sizeof(pi_stats));
+	if (g_psramRomXipCached) {
+		xip_ctrl_hw->flush = 1;
+		(void)xip_ctrl_hw->flush;
+		xip_half_chip[0] = 0;
+		xip_half_chip[1] = 0;
+		xip_half_chip[g_currentMemoryArrayChip & 1] = g_currentMemoryArrayChip;
+	}
+
+	pi_region_table_init();
+	// Keyed by the divider the QSPI is actually running at, not QSPI_QUAD_MODE_CLK_DIVIDER
+	pi_timing_header_word = pi_timing_for(clock_get_hz(clk_sys) / 1000, ssi_hw->baudr);
 
 	// Init PIO
 	PIO pio = pio0;
@@ -108,22 +286,44 @@ void __no_inline_not_in_flash_func(n64_pi_run)(void)
 
 	dma_chan = dma_claim_unused_channel(true);
 	dma_channel_config c = dma_channel_get_default_config(dma_chan);
-	channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
 	channel_config_set_read_increment(&c, true);
-	channel_config_set_write_increment(&c, false);
+	channel_config_set_write_increment(&c, true);
+	channel_config_set_ring(&c, true, 3); // wrap writes around rom_prefetch_buf
+	// Two big-endian rom half-words, first one ends up in the upper 16 bits
 	channel_config_set_bswap(&c, true);
 	channel_config_set_high_priority(&c, true);
 
-	volatile uint16_t dmaValue = 0;
 	dma_channel_configure(
 		dma_chan,        // Channel to be configured
 		&c,              // The configuration we just created
-		&dmaValue,
-		ptr16,           // The initial read address
+		rom_prefetch_buf,
+		ptr32,           // The initial read address
 		1, 				 // Number of transfers;
 		false
 	);
 
+	// Drains the SSI while a psram rom stream runs. Started once and left
+	// running, it only moves data when the SSI has some.
+	rom_stream_chan = dma_claim_unused_channel(true);
+	dma_channel_config sc = dma_channel_get_default_config(rom_stream_chan);
+	channel_config_set_transfer_data_size(&sc, DMA_SIZE_32);
+	channel_config_set_read_increment(&sc, false);
+	channel_config_set_write_increment(&sc, true);
+	channel_config_set_ring(&sc, true, ROM_STREAM_RING_BITS);
+	channel_config_set_dreq(&sc, DREQ_XIP_SSIRX);
+	// No bswap, the first byte clocked in is already in the top of the frame
+	channel_config_set_high_priority(&sc, true);
+
+	dma_channel_configure(
+		rom_stream_chan,
+		&sc,
+		rom_stream_buf,
+		&ssi_hw->dr0,
+		0xFFFFFFFF,
+		true
+	);
+
 	// Wait for reset to be released
 	while (gpio_get(PIN_N64_COLD_RESET) == 0) {
 		tight_loop_contents();
@@ -134,6 +334,11 @@ void __no_inline_not_in_flash_func(n64_pi_run)(void)
 	volatile uint32_t next_word;
 	volatile uint32_t startTicks = 0;
 	volatile uint32_t sram_addr = 0;
+	uint8_t region = PI_REGION_UNHANDLED;
+	uint32_t burst_addr = 0; // First address of the burst being served
+	uint32_t rom_word = 0; // Two rom half-words, the one at the lower address in the upper 16 bits
+	uint32_t rom_slot = 0; // rom_prefetch_buf slot the dma fills next
+	volatile uint32_t *rom_stream_pos = rom_stream_buf; // Next word of the psram stream
 
 	// Was attempting to figure out a way to go back to the menu rom
 	// if the user hits reset... This doesn't work.
@@ -152,16 +357,242 @@ void __no_inline_not_in_flash_func(n64_pi_run)(void)
 	addr = n64_pi_get_value(pio);
 
 	uint32_t lastUpdate = 0;
+	last_addr = 0;
 	while (1 && !g_restart_pi_handler) {
+		// Every path moves last_addr past what it served, so the last burst
+		// is counted here instead of per strobe
+		PI_STAT_ADD(region, halfwords, (last_addr - burst_addr) >> 1);
+
 		// addr must not be a WRITE or READ request here,
 		// it should contain a 16-bit aligned address.
 		// Address aquired
 		last_addr = addr;
+		burst_addr = addr;
 
-		// Handle access based on memory region
+		// Handle access based on memory region, looked up from the top
+		// address bits so the rom path is reached after a single load and compare.
 		// Note that the if-cases are ordered in priority from
 		// most timing critical to least.
-		if (last_addr == 0x10000000) {
+		region = pi_region_table[last_addr >> PI_REGION_TABLE_SHIFT];
+		PI_STAT_ADD(region, addresses, 1);
+		if (region == PI_REGION_ROM) {
+ handle_d1a2_address:
+			// Domain 1, Address 2 Cartridge ROM
+
+			if (g_loadRomFromMemoryArray) {
+				if (g_romFromFlashArray) {
+ handle_d1a2_flash_array:
+					// Deduplicated rom in the flash array. Each 1KB of rom is a chunk
+					// somewhere in the array, streamed up to the end of the chunk.
+					{
+						uint32_t array_addr = FLASH_ARRAY_CHUNK_ADDRESS(rom_mapping[(last_addr & 0xFFFFFF) >> FLASH_ARRAY_CHUNK_SHIFT]) +
+							(last_addr & (FLASH_ARRAY_CHUNK_BYTES - 1));
+						tempChip = FLASH_ARRAY_CHIP(array_addr);
+						if (tempChip != g_currentMemoryArrayChip) {
+							ssi_hw->ssienr = 0;
+							psram_switch_cs(g_currentMemoryArrayChip, tempChip);
+							g_currentMemoryArrayChip = tempChip;
+							PI_STAT_ADD(region, chip_switches, 1);
+						}
+						rom_stream_pos = rom_stream_read(FLASH_ARRAY_OFFSET(array_addr));
+					}
+					goto handle_d1a2_stream;
+				}
+
+#if PI_ROM_READY_CHECK
+				if (g_romReadyCheck) {
+					uint32_t block = (last_addr >> PI_ROM_READY_BLOCK_SHIFT) & (PI_ROM_READY_WORDS * 32 - 1);
+					if (!(pi_rom_ready[block >> 5] & (1u << (block & 31)))) {
+						PI_STAT_ADD(region, not_ready, 1);
+						goto handle_d1a2_not_ready;
+					}
+				}
+#endif
+
+ handle_d1a2_select:
+				// Change the banked memory chip if needed
+				tempChip = PSRAM_ROM_CHIP(last_addr);
+				if (tempChip != g_currentMemoryArrayChip) {
+					// Don't move the chip select under a running stream or line fill
+					if (g_psramRomXipCached) {
+						while(!!(dma_hw->ch[dma_chan].al1_ctrl & DMA_CH0_CTRL_TRIG_BUSY_BITS)) { PI_STAT_ADD(region, dma_stalls, 1); }
+					} else {
+						ssi_hw->ssienr = 0;
+					}
+					// Set the new chip
+					psram_switch_cs(g_currentMemoryArrayChip, tempChip);
+					g_currentMemoryArrayChip = tempChip;
+					PI_STAT_ADD(region, chip_switches, 1);
+
+					if (g_psramRomXipCached && xip_half_chip[tempChip & 1] != tempChip) {
+						if (xip_half_chip[tempChip & 1]) {
+							// Drop the old chip's lines, reading the flush back blocks until it's done
+							xip_ctrl_hw->flush = 1;
+							(void)xip_ctrl_hw->flush;
+							xip_half_chip[(tempChip & 1) ^ 1] = 0;
+						}
+						xip_half_chip[tempChip & 1] = tempChip;
+					}
+				}
+
+				if (g_psramRomXipCached) {
+					rom_stream_release_ssi();
+					// A fetch left over from the last burst may still be filling a line
+					while(!!(dma_hw->ch[dma_chan].al1_ctrl & DMA_CH0_CTRL_TRIG_BUSY_BITS)) { PI_STAT_ADD(region, dma_stalls, 1); }
+					dma_hw->ch[dma_chan].write_addr = (uintptr_t)rom_prefetch_buf;
+					(&dma_hw->ch[dma_chan])->al3_read_addr_trig = XIP_BASE + ((g_currentMemoryArrayChip & 1) * PSRAM_CHIP_CAPACITY_BYTES) +
+						(PSRAM_ROM_OFFSET(last_addr) & ~3);
+					rom_slot = 0;
+					goto handle_d1a2_fetch;
+				}
+
+				rom_stream_pos = rom_stream_read(PSRAM_ROM_OFFSET(last_addr));
+
+ handle_d1a2_stream:
+				// Wait for the first word of the stream
+				while ((uintptr_t)rom_stream_pos == dma_hw->ch[rom_stream_chan].write_addr) { PI_STAT_ADD(region, dma_stalls, 1); }
+				rom_word = *rom_stream_pos;
+				rom_stream_pos = rom_stream_next(rom_stream_pos);
+				next_word = (last_addr & 2) ? (rom_word & 0xFFFF) : (rom_word >> 16);
+
+				do {
+					// Wait for pio
+					while((pio->fstat & 0x100) != 0) tight_loop_contents();
+					addr = pio->rxf[0];
+
+					if (addr == 0) {
+						// READ
+						pio->txf[0] = next_word;
+						last_addr += 2;
+
+					} else if (addr & 0x00000001) {
+						// WRITE
+						// Ignore data since we're asked to write to the ROM.
+						last_addr += 2;
+						PI_STAT_ADD(region, writes_ignored, 1);
+					} else {
+						// New address
+						break;
+					}
+
+					if (last_addr & 2) {
+						// Second half-word is already here
+						next_word = rom_word & 0xFFFF;
+					} else {
+						// Once the block is in, queue the next one as long as the ring
+						// has room for it next to the words not served yet
+						uintptr_t landed = dma_hw->ch[rom_stream_chan].write_addr;
+						if (landed == rom_stream_end && ((landed - (uintptr_t)rom_stream_pos) & ROM_STREAM_RING_MASK) <= ROM_STREAM_BLOCK_WORDS * 4) {
+							rom_stream_read(rom_stream_addr);
+						}
+
+						// The SSI clocks a word out every 8 qspi clocks, well ahead of the bus
+						while ((uintptr_t)rom_stream_pos == dma_hw->ch[rom_stream_chan].write_addr) { PI_STAT_ADD(region, dma_stalls, 1); }
+						rom_word = *rom_stream_pos;
+						rom_stream_pos = rom_stream_next(rom_stream_pos);
+						next_word = rom_word >> 16;
+					}
+				} while (1);
+
+				// New address
+				continue;
+
+#if PI_ROM_READY_CHECK
+ handle_d1a2_not_ready:
+				// Still loading, nothing to serve
+				do {
+					while((pio->fstat & 0x100) != 0) tight_loop_contents();
+					addr = pio->rxf[0];
+
+					if (addr == 0) {
+						// READ
+						pio->txf[0] = 0;
+						last_addr += 2;
+					} else if (addr & 0x00000001) {
+						// WRITE
+						last_addr += 2;
+						PI_STAT_ADD(region, writes_ignored, 1);
+					} else {
+						// New address
+						break;
+					}
+				} while (1);
+
+				continue;
+#endif
+			}
+
+			// Rom in flash, read through the XIP cache
+			rom_stream_release_ssi();
+			{
+				uint32_t chunk_index = rom_mapping[(last_addr & 0xFFFFFF) >> COMPRESSION_SHIFT_AMOUNT];
+				const uint32_t *chunk_32 = (const uint32_t *)rom_chunks[chunk_index];
+				dma_hw->ch[dma_chan].write_addr = (uintptr_t)rom_prefetch_buf;
+				(&dma_hw->ch[dma_chan])->al3_read_addr_trig = (uintptr_t)(
+					chunk_32 + ((last_addr & COMPRESSION_MASK) >> 2)
+					);
+				rom_slot = 0;
+			}
+
+ handle_d1a2_fetch:
+			// Wait for the first 32 bits from flash/psram
+			while(!!(dma_hw->ch[dma_chan].al1_ctrl & DMA_CH0_CTRL_TRIG_BUSY_BITS)) { PI_STAT_ADD(region, dma_stalls, 1); }
+			// Kick off the next 32 bits into the other slot before touching this one
+			dma_hw->multi_channel_trigger = 1u << dma_chan;
+			rom_word = rom_prefetch_buf[rom_slot];
+			rom_slot ^= 1;
+			next_word = (last_addr & 2) ? (rom_word & 0xFFFF) : (rom_word >> 16);
+
+			do {
+				// Wait for pio
+				while((pio->fstat & 0x100) != 0) tight_loop_contents();
+				addr = pio->rxf[0];
+
+				if (addr == 0) {
+					// READ
+					pio->txf[0] = next_word;
+					last_addr += 2;
+
+				} else if (addr & 0x00000001) {
+					// WRITE
+					// Ignore data since we're asked to write to the ROM.
+					last_addr += 2;
+					PI_STAT_ADD(region, writes_ignored, 1);
+				} else {
+					// New address
+					break;
+				}
+
+				if (last_addr & 2) {
+					// Second half-word is already here
+					next_word = rom_word & 0xFFFF;
+				} else {
+#if COMPRESSION_SHIFT_AMOUNT < 9
+					// Chunks smaller than the 512 byte PI page, the burst can run
+					// into the next chunk. What was prefetched is the wrong data,
+					// fetch the word again from where the mapping says.
+					if (!(last_addr & COMPRESSION_MASK) && !g_loadRomFromMemoryArray) {
+						while(!!(dma_hw->ch[dma_chan].al1_ctrl & DMA_CH0_CTRL_TRIG_BUSY_BITS)) { PI_STAT_ADD(region, dma_stalls, 1); }
+						dma_hw->ch[dma_chan].write_addr = (uintptr_t)&rom_prefetch_buf[rom_slot];
+						(&dma_hw->ch[dma_chan])->al3_read_addr_trig = (uintptr_t)rom_chunks[rom_mapping[(last_addr & 0xFFFFFF) >> COMPRESSION_SHIFT_AMOUNT]];
+					}
+#endif
+
+					// The next 32 bits were fetched while the last two half-words
+					// were served, so this rarely spins.
+					while(!!(dma_hw->ch[dma_chan].al1_ctrl & DMA_CH0_CTRL_TRIG_BUSY_BITS)) { PI_STAT_ADD(region, dma_stalls, 1); }
+					dma_hw->multi_channel_trigger = 1u << dma_chan;
+					rom_word = rom_prefetch_buf[rom_slot];
+					rom_slot ^= 1;
+					next_word = rom_word >> 16;
+				}
+			} while (1);
+		} else if (region == PI_REGION_ROM_HEADER) {
+			if (last_addr != 0x10000000) {
+				// Rest of the first 1MB of rom
+				goto handle_d1a2_address;
+			}
+
 			// Configure bus to run slowly.
 			// This is better patched in the rom, so we won't need a branch here.
 			// But let's keep it here so it's easy to import roms.
@@ -174,45 +605,8 @@ void __no_inline_not_in_flash_func(n64_pi_run)(void)
 			pio_sm_put(pio, 0, next_word);
 			last_addr += 2;
 
-			// next_word = 0x3340; // 140/2
-			// next_word = 0x2740; // 160/2
-			// next_word = 0x2240; // 180/2
-			// next_word = 0x1C40; // 210/2
-			// next_word = 0x1C40; // 300/4
-
-			// next_word = 0x1C40; // 300/4 with dma after pio->txf[0]
-			// next_word = 0x1740; // 336/4 with dma after pio->txf[0]
-
-			// Before adding in the if/else block for flash vs psram checks
-			// next_word = 0x1240; // 340/4 with dma before pio->txf[0]
-			// next_word = 0x1340; // 336/4 with dma before pio->txf[0]
-			// next_word = 0x1540; // 300/4 with dma before pio->txf[0]
-			// next_word = 0x1940; // 266/4 with dma before pio->txf[0]
-
-			// next_word = 0x1640; // 266/4 with dma before pio->txf[0], using 0B read command
-			// next_word = 0x1340; // 300/4 with dma before pio->txf[0], using 0B read command
-
-
-			// Patch bus speed here if needed
-			// next_word = 0xFF40; // Slowest speed
-			// next_word = 0x8040; // boots @ 266MHz
-			// next_word = 0x4040; // boots @ 266
-			// next_word = 0x3040; // boots @ 266
-			next_word = 0x2040; // Should boot with rp2040's @ 360MHz (qspi at 90MHz)
-			// next_word = 0x1B40;
-
-			//0x1B40 boots@266/4 with dmaValue
-			//0x1A40 no boot@266/4 with dmaValue
-			// next_word = 0x1A40;
-
-			// next_word = 0x1940;
-			// next_word = 0x1840;
-			// next_word = 0x1740;
-			// next_word = 0x1640; // boots @ 300 (psram divider = 4)
-			// next_word = 0x1540;
-			// next_word = 0x1440;
-			// next_word = 0x1340;
-			// next_word = 0x1240; // Only usable if psram/flash is readable at 133MHz
+			// Bus speed for the clock we run at, or what the menu asked for this rom
+			next_word = pi_timing_override ? pi_timing_override : pi_timing_calibrated ? pi_timing_calibrated : pi_timing_header_word;
 
 			addr = n64_pi_get_value(pio);
 
@@ -220,31 +614,28 @@ void __no_inline_not_in_flash_func(n64_pi_run)(void)
 			pio_sm_put(pio, 0, next_word);
 			last_addr += 2;
 
-			// If we are loading data from psram, use dma, otherwise just use the array in flash.
+			// If we are loading data from psram, stream it, otherwise just use the array in flash.
 			if (g_loadRomFromMemoryArray) {
-				(&dma_hw->ch[dma_chan])->al3_read_addr_trig = (uintptr_t)(ptr16 + (((last_addr - g_addressModifierTable[g_currentMemoryArrayChip]) & 0xFFFFFF) >> 1));
-			} else {
-				uint32_t chunk_index = rom_mapping[(last_addr & 0xFFFFFF) >> COMPRESSION_SHIFT_AMOUNT];
-				const uint16_t *chunk_16 = (const uint16_t *)rom_chunks[chunk_index];
-				(&dma_hw->ch[dma_chan])->al3_read_addr_trig = (uintptr_t)(chunk_16 + ((last_addr & COMPRESSION_MASK) >> 1));
+				if (g_romFromFlashArray) {
+					goto handle_d1a2_flash_array;
+				}
+				// The last rom read may have left another chip selected
+				goto handle_d1a2_select;
 			}
 
-			while(!!(dma_hw->ch[dma_chan].al1_ctrl & DMA_CH0_CTRL_TRIG_BUSY_BITS)) { tight_loop_contents(); }
-			next_word = dmaValue;
-			dma_hw->multi_channel_trigger = 1u << dma_chan;
-
-			// ROM patching done
-			addr = n64_pi_get_value(pio);
-			if (addr == 0) {
-				// I apologise for the use of goto, but it seemed like a fast way
-				// to enter the next state immediately.
-				goto handle_d1a2_read;
-			} else {
-				continue;
-			}
-		} else if (last_addr >= CART_SRAM_START && last_addr <= CART_SRAM_END) {
+			uint32_t chunk_index = rom_mapping[(last_addr & 0xFFFFFF) >> COMPRESSION_SHIFT_AMOUNT];
+			const uint32_t *chunk_32 = (const uint32_t *)rom_chunks[chunk_index];
+			dma_hw->ch[dma_chan].write_addr = (uintptr_t)rom_prefetch_buf;
+			(&dma_hw->ch[dma_chan])->al3_read_addr_trig = (uintptr_t)(chunk_32 + ((last_addr & COMPRESSION_MASK) >> 2));
+			rom_slot = 0;
+
+			// ROM patching done, serve the rest of the burst from the rom loop.
+			// I apologise for the use of goto, but it seemed like a fast way
+			// to enter the next state immediately.
+			goto handle_d1a2_fetch;
+		} else if (region == PI_REGION_SRAM) {
 			// Domain 2, Address 2 Cartridge SRAM
-			sram_addr = (last_addr & (SRAM_1MBIT_SIZE - 1)) >> 1; 	// 4 cycles
+			sram_addr = (last_addr & (SRAM_256KBIT_SIZE - 1)) >> 1; 	// 4 cycles
 			next_word = sram[sram_addr]; 			// 3 cycles?
 
 			// variable++ takes about 5 cycles
@@ -282,57 +673,9 @@ void __no_inline_not_in_flash_func(n64_pi_run)(void)
 					break;
 				}
 			} while (1);
-		} else if (last_addr >= 0x10000000 && last_addr <= 0x1FBFFFFF) {
-			// Domain 1, Address 2 Cartridge ROM
 
-			if (g_loadRomFromMemoryArray) {
-				// Change the banked memory chip if needed
-				tempChip = ((last_addr >> 23) & 0x7) + 1;// psram_addr_to_chip(last_addr);
-				if (tempChip != g_currentMemoryArrayChip) {
-					g_currentMemoryArrayChip = tempChip;
-					// Set the new chip
-					psram_set_cs(g_currentMemoryArrayChip);
-				}
-
-				// Set the correct read address
-				(&dma_hw->ch[dma_chan])->al3_read_addr_trig = (uintptr_t)(ptr16 + (((last_addr - g_addressModifierTable[g_currentMemoryArrayChip]) & 0xFFFFFF) >> 1));
-			}
-			else {
-				uint32_t chunk_index = rom_mapping[(last_addr & 0xFFFFFF) >> COMPRESSION_SHIFT_AMOUNT];
-				const uint16_t *chunk_16 = (const uint16_t *)rom_chunks[chunk_index];
-				(&dma_hw->ch[dma_chan])->al3_read_addr_trig = (uintptr_t)(
-					chunk_16 + ((last_addr & COMPRESSION_MASK) >> 1)
-					);
-			}
-
-			do {
-
-				// Wait for value from flash/psram
-				while(!!(dma_hw->ch[dma_chan].al1_ctrl & DMA_CH0_CTRL_TRIG_BUSY_BITS)) { tight_loop_contents(); } // dma_channel_wait_for_finish_blocking(dma_chan);
-				next_word = dmaValue;
-				// Kick off next value fetch in the background
-				dma_hw->multi_channel_trigger = 1u << dma_chan; // fetch here for faster processor/lower qspi
-
-				// Wait for pio
-				while((pio->fstat & 0x100) != 0) tight_loop_contents();
-				addr = pio->rxf[0];
-
-				if (addr == 0) {
-					// READ
- handle_d1a2_read:
- 					pio->txf[0] = next_word;
-					last_addr += 2;
-					// dma_hw->multi_channel_trigger = 1u << dma_chan; // fetch here for slower processor speed/faster qspi
-
-				} else if (addr & 0x00000001) {
-					// WRITE
-					// Ignore data since we're asked to write to the ROM.
-					last_addr += 2;
-				} else {
-					// New address
-					break;
-				}
-			} while (1);
+			// The burst moved sram_addr instead of last_addr
+			last_addr += (sram_addr - ((burst_addr & (SRAM_256KBIT_SIZE - 1)) >> 1)) << 1;
 		}
 #if 0
 		else if (last_addr >= 0x05000000 && last_addr <= 0x05FFFFFF) {
@@ -381,7 +724,7 @@ void __no_inline_not_in_flash_func(n64_pi_run)(void)
 			} while (1);
 		}
 #endif
-		else if (last_addr >= DDR64_BASE_ADDRESS_START && last_addr <= DDR64_BASE_ADDRESS_END) {
+		else if (region == PI_REGION_DDR64 && last_addr >= DDR64_BASE_ADDRESS_START && last_addr <= DDR64_BASE_ADDRESS_END) {
 			// PicoCart64 BASE address space
 			do {
 				// Pre-fetch from the address
@@ -413,7 +756,7 @@ void __no_inline_not_in_flash_func(n64_pi_run)(void)
 				}
 			} while (1);
 
-		} else if (last_addr >= DDR64_CIBASE_ADDRESS_START && last_addr <= DDR64_CIBASE_ADDRESS_END) {
+		} else if (region == PI_REGION_DDR64 && last_addr >= DDR64_CIBASE_ADDRESS_START && last_addr <= DDR64_CIBASE_ADDRESS_END) {
 			// PicoCart64 CIBASE address space
 			do {
 				// Read command/address
@@ -468,6 +811,10 @@ void __no_inline_not_in_flash_func(n64_pi_run)(void)
 						break;
 
 					default:
+						if (last_addr - DDR64_CIBASE_ADDRESS_START - DDR64_REGISTER_PI_STATS < sizeof(pi_stats)) {
+							uint32_t stat = ((volatile uint32_t *)pi_stats)[(last_addr - DDR64_CIBASE_ADDRESS_START - DDR64_REGISTER_PI_STATS) >> 2];
+							pio_sm_put(pio, 0, (last_addr & 2) ? (stat & 0xFFFF) : (stat >> 16));
+						}
 						next_word = 0;
 					}
 
@@ -545,6 +892,56 @@ void __no_inline_not_in_flash_func(n64_pi_run)(void)
 						ddr64_set_rom_meta_data(write_word >> 16, 1);
 						break;
 
+					case (DDR64_REGISTER_PI_TIMING + 2):
+						pi_timing_override = write_word >> 16;
+						break;
+
+					case (DDR64_REGISTER_PSRAM_SAMPLE_DLY + 2):
+						qspi_rx_sample_dly = write_word >> 16;
+						// Only latched while the SSI is disabled, let a flash prefetch finish first.
+						// A psram stream is restarted by the next rom read anyway.
+						while(!!(dma_hw->ch[dma_chan].al1_ctrl & DMA_CH0_CTRL_TRIG_BUSY_BITS)) { tight_loop_contents(); }
+						ssi_hw->ssienr = 0;
+						ssi_hw->rx_sample_dly = qspi_rx_sample_dly;
+						ssi_hw->ssienr = 1;
+						break;
+
+					case DDR64_REGISTER_PI_CALIBRATION:
+						pi_calibration_register = write_word;
+						break;
+
+					case (DDR64_REGISTER_PI_CALIBRATION + 2):
+						pi_calibration_register |= write_word >> 16;
+						multicore_fifo_push_blocking(CORE1_SAVE_PI_CALIBRATION_CMD);
+						break;
+
+					case (DDR64_REGISTER_PI_STATS + 2):
+						memset((void *)pi_stats, 0, sizeof(pi_stats));
+						// This write's own burst isn't counted either
+						burst_addr = last_addr + 2;
+						break;
+
+					case (DDR64_REGISTER_PI_STATS_DUMP + 2):
+						multicore_fifo_push_blocking(CORE1_SEND_PI_STATS_CMD);
+						break;
+
+					case (DDR64_REGISTER_SD_PIN_ROM + 2):
+						ddr64_set_sd_rom_selection((char *)ddr64_uart_tx_buf, write_word);
+						multicore_fifo_push_blocking(CORE1_PIN_ROM_CMD);
+						break;
+
+					case (DDR64_REGISTER_PSRAM_XIP_CACHED + 2):
+						// Chip switches while streaming don't track the cache halves,
+						// so start over with only the current chip's lines
+						while(!!(dma_hw->ch[dma_chan].al1_ctrl & DMA_CH0_CTRL_TRIG_BUSY_BITS)) { tight_loop_contents(); }
+						g_psramRomXipCached = (write_word >> 16) & 1;
+						xip_ctrl_hw->flush = 1;
+						(void)xip_ctrl_hw->flush;
+						xip_half_chip[0] = 0;
+						xip_half_chip[1] = 0;
+						xip_half_chip[g_currentMemoryArrayChip & 1] = g_currentMemoryArrayChip;
+						break;
+
 					default:
 						break;
 					}
@@ -559,7 +956,7 @@ void __no_inline_not_in_flash_func(n64_pi_run)(void)
 					break;
 				}
 			} while (1);
-		} else if (last_addr >= 0x81000000 && last_addr <= 0x81001000) {
+		} else if (region == PI_REGION_DEBUG && last_addr <= 0x81001000) {
 			uart_tx_program_putc(0x09);
 			uart_tx_program_putc(0x08);
 			uart_tx_program_putc(0x07);
@@ -584,6 +981,12 @@ void __no_inline_not_in_flash_func(n64_pi_run)(void)
 			addr = n64_pi_get_value(pio);
 		}
 	}
+	PI_STAT_ADD(region, halfwords, (last_addr - burst_addr) >> 1);
+
+	// Leave the SSI as XIP expects it
+	rom_stream_release_ssi();
+	dma_channel_abort(rom_stream_chan);
+	dma_channel_unclaim(rom_stream_chan);
 
 	// Tear down the pio sm so the function can be called again.
 	pio_sm_set_enabled(pio, 0, false);
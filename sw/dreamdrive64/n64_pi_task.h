@@ -6,10 +6,85 @@
 
 #pragma once
 
+#include <stdint.h>
+
 enum {
     CORE1_SEND_SD_READ_CMD,
-    CORE1_LOAD_NEW_ROM_CMD
+    CORE1_LOAD_NEW_ROM_CMD,
+    CORE1_SAVE_PI_CALIBRATION_CMD,
+    CORE1_SEND_PI_STATS_CMD,
+    CORE1_PIN_ROM_CMD
+};
+// The PI handler picks the handler for an address from a table indexed by
+// the top 12 address bits
+#define PI_REGION_TABLE_SHIFT (20)
+#define PI_REGION_SIZE (1 << PI_REGION_TABLE_SHIFT)
+#define PI_REGION_TABLE_LEN (1 << (32 - PI_REGION_TABLE_SHIFT))
+
+enum {
+    PI_REGION_ROM,
+    PI_REGION_ROM_HEADER,
+    PI_REGION_SRAM,
+    PI_REGION_DDR64,
+    PI_REGION_DEBUG,
+    PI_REGION_UNHANDLED,
+    PI_REGION_COUNT
 };
+
+extern uint8_t pi_region_table[PI_REGION_TABLE_LEN];
+void pi_region_table_init(void);
+
+// PI bus timing served in the second rom header word, PWD << 8 | LAT
+#define PI_TIMING_SLOWEST (0xFF40)
+
+typedef struct {
+    uint32_t sys_khz;
+    uint32_t qspi_clk_divider;
+    uint16_t header_word;
+} pi_timing_profile_t;
+
+extern const pi_timing_profile_t pi_timing_profiles[];
+extern const int pi_timing_profile_count;
+extern volatile uint16_t pi_timing_override;
+extern volatile uint16_t pi_timing_calibrated;
+extern volatile uint32_t pi_calibration_register;
+uint16_t pi_timing_for(uint32_t sys_khz, uint32_t qspi_clk_divider);
+
+// Serve psram roms through the XIP cache instead of streaming them
+extern volatile bool g_psramRomXipCached;
+
+// Per region counters since the handler started, readable at DDR64_REGISTER_PI_STATS.
+// Keep the field order in sync with the description in ddr64_regs.h. They cost
+// time on the bus, so they stay at 0 unless PI_STATS is 1.
+#ifndef PI_STATS
+#define PI_STATS 0
+#endif
+typedef struct {
+    uint32_t addresses;      // New addresses
+    uint32_t halfwords;      // Read and write strobes served
+    uint32_t writes_ignored; // Writes to rom
+    uint32_t chip_switches;  // PSRAM chip selects moved
+    uint32_t dma_stalls;     // Spins waiting on the rom DMA or stream
+    uint32_t not_ready;      // Addresses in rom blocks not loaded yet
+} pi_region_stats_t;
+
+extern volatile pi_region_stats_t pi_stats[PI_REGION_COUNT];
+
+// 1MB rom blocks that are in PSRAM, MCU2 sends them as a load goes. With
+// g_romReadyCheck set, bursts in any other block read as 0. The N64 is held
+// off for the whole load until the bus can be handed over part way through,
+// so the check is left out of the handler unless PI_ROM_READY_CHECK is 1.
+#ifndef PI_ROM_READY_CHECK
+#define PI_ROM_READY_CHECK 0
+#endif
+#define PI_ROM_READY_BLOCK_SHIFT 20
+#define PI_ROM_READY_WORDS 2 // 64MB of rom
+extern volatile uint32_t pi_rom_ready[PI_ROM_READY_WORDS];
+extern volatile bool g_romReadyCheck;
+
+// Forget the blocks of the last rom, call when a load starts
+void n64_pi_rom_ready_clear(void);
+
 void n64_pi_run(void);
 extern volatile bool g_restart_pi_handler;
 
@@ -8,6 +8,7 @@
 #include "pins_mcu1.h"
 
 #include "pico/stdlib.h"
+#include "hardware/dma.h"
 
 pio_uart_inst_t uart_rx = {
         .pio = pio1,
@@ -19,78 +20,164 @@ pio_uart_inst_t uart_tx = {
         .sm = 1
 };
 
-RXRingBuffer_t rxRingBuffer = {};
-void rx_uart_interrupt() {
-    while(uart_rx_program_is_readable()) {
-        char c = uart_rx_program_getc();
-        rxRingBuffer.buf[rxRingBuffer.head++] = c;
-        if (rxRingBuffer.head == RX_RING_BUFFER_SIZE) {
-            rxRingBuffer.head = 0;
-        }
+uint pioUartRXOffset = 0;
+uint pioUartTXOffset = 0;
+// uart or clocked, whichever each direction was started with
+static const pio_program_t *pioUartRXProgram = NULL;
+static const pio_program_t *pioUartTXProgram = NULL;
+uint8_t isUartTXRunning = false;
+uint8_t isUartRXRunning = false;
+
+// The rx fifo is copied into the ring by DMA, no interrupt per byte. The ring
+// is aligned to its size so the DMA wraps its write address around it.
+// Positions count every byte since boot and index the ring modulo its size.
+static uint8_t rx_ring[RX_RING_BUFFER_SIZE] __attribute__((aligned(RX_RING_BUFFER_SIZE)));
+static int uart_rx_dma_chan = -1;
+static uint32_t rx_received_before_arm = 0;   // Bytes received before the channel was last started
+static uint32_t rx_tail = 0;
+static uint32_t rx_overflow_bytes = 0;
+
+// As many transfers as the channel takes, hours of traffic. It is started
+// again when it runs out.
+#define RX_DMA_TRANSFER_COUNT 0xFFFFFFFFu
+
+static void uart_rx_dma_init() {
+    if (uart_rx_dma_chan < 0) {
+        uart_rx_dma_chan = dma_claim_unused_channel(true);
+    }
+
+    dma_channel_config c = dma_channel_get_default_config(uart_rx_dma_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, __builtin_ctz(RX_RING_BUFFER_SIZE));
+    channel_config_set_dreq(&c, pio_get_dreq(uart_rx.pio, uart_rx.sm, false));
+
+    // The byte is in the top of the fifo word, as data is left-justified
+    io_rw_8 *rxfifo_shift = (io_rw_8*)&uart_rx.pio->rxf[uart_rx.sm] + 3;
+    rx_received_before_arm = 0;
+    rx_tail = 0;
+    dma_channel_configure(uart_rx_dma_chan, &c, rx_ring, rxfifo_shift, RX_DMA_TRANSFER_COUNT, true);
+}
+
+static uint32_t rx_received() {
+    if (!dma_channel_is_busy(uart_rx_dma_chan)) {
+        // Ran out of transfers, carry on from where it stopped
+        rx_received_before_arm += RX_DMA_TRANSFER_COUNT;
+        dma_channel_set_trans_count(uart_rx_dma_chan, RX_DMA_TRANSFER_COUNT, true);
     }
+    return rx_received_before_arm + (RX_DMA_TRANSFER_COUNT - dma_channel_hw_addr(uart_rx_dma_chan)->transfer_count);
 }
 
 bool rx_uart_buffer_has_data() {
-    return rxRingBuffer.tail != rxRingBuffer.head;
+    if (!isUartRXRunning) { return false; }
+
+    uint32_t received = rx_received();
+    if (received - rx_tail >= RX_RING_BUFFER_SIZE) {
+        // The DMA has written over bytes that weren't read, drop all of it.
+        // The packet they were part of fails its crc.
+        rx_overflow_bytes += received - rx_tail;
+        rx_tail = received;
+    }
+    return rx_tail != received;
 }
 
 uint8_t rx_uart_buffer_get() {
-    uint8_t ret = rxRingBuffer.buf[rxRingBuffer.tail++];
-    if (rxRingBuffer.tail >= RX_RING_BUFFER_SIZE) {
-        rxRingBuffer.tail = 0;
-    }
-    return ret;
+    return rx_ring[rx_tail++ & (RX_RING_BUFFER_SIZE - 1)];
 }
 
 void rx_uart_buffer_reset() {
-    rxRingBuffer.head = 0;
-    rxRingBuffer.tail = 0;
+    if (!isUartRXRunning) { return; }
+    // Whole bytes only. The clocked receiver finds byte boundaries itself at
+    // the next pause in the data, restarting it here could land mid byte.
+    rx_tail = rx_received();
 }
 
-uint pioUartRXOffset = 0;
-uint pioUartTXOffset = 0;
-uint8_t isUartTXRunning = false;
-uint8_t isUartRXRunning = false;
+uint32_t rx_uart_buffer_overflow_bytes() {
+    return rx_overflow_bytes;
+}
+
+// Feeds the tx fifo a byte per DREQ. Polled, the DMA irqs belong to the
+// qspi writer and the sd card driver.
+static int uart_tx_dma_chan = -1;
+
+static void uart_tx_dma_init() {
+    if (uart_tx_dma_chan >= 0) {
+        return;
+    }
+    uart_tx_dma_chan = dma_claim_unused_channel(true);
+
+    dma_channel_config c = dma_channel_get_default_config(uart_tx_dma_chan);
+    // A byte write lands in every lane of the fifo word, the program shifts out the low 8 bits
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(uart_tx.pio, uart_tx.sm, true));
+    dma_channel_configure(uart_tx_dma_chan, &c, &uart_tx.pio->txf[uart_tx.sm], NULL, 0, false);
+}
+
+static void pio_uart_init_rx(int rxPin, int rxClockPin) {
+    if (rxClockPin >= 0) {
+        pioUartRXProgram = &clocked_rx_program;
+        pioUartRXOffset = pio_add_program(uart_rx.pio, pioUartRXProgram);
+        clocked_rx_program_init(uart_rx.pio, uart_rx.sm, pioUartRXOffset, rxPin, rxClockPin);
+    } else {
+        pioUartRXProgram = &uart_rx_program;
+        pioUartRXOffset = pio_add_program(uart_rx.pio, pioUartRXProgram);
+        uart_rx_program_init(uart_rx.pio, uart_rx.sm, pioUartRXOffset, rxPin, PIO_UART_DIVIDER);
+    }
+    uart_rx_dma_init();
+    isUartRXRunning = true;
+}
+
+static void pio_uart_init_tx(int txPin, int txClockPin) {
+    if (txClockPin >= 0) {
+        pioUartTXProgram = &clocked_tx_program;
+        pioUartTXOffset = pio_add_program(uart_tx.pio, pioUartTXProgram);
+        clocked_tx_program_init(uart_tx.pio, uart_tx.sm, pioUartTXOffset, txPin, txClockPin, PIO_UART_CLOCKED_DIVIDER);
+    } else {
+        pioUartTXProgram = &uart_tx_program;
+        pioUartTXOffset = pio_add_program(uart_tx.pio, pioUartTXProgram);
+        uart_tx_program_init(uart_tx.pio, uart_tx.sm, pioUartTXOffset, txPin, PIO_UART_DIVIDER);
+    }
+    uart_tx_dma_init();
+    isUartTXRunning = true;
+}
 
 void pio_uart_init(int rxPin, int txPin) {
-    uint divider = 8; // Clock divider
+    pio_uart_init_clocked(rxPin, -1, txPin, -1);
+}
 
+void pio_uart_init_clocked(int rxPin, int rxClockPin, int txPin, int txClockPin) {
     if (rxPin >= 0) {
-	    pioUartRXOffset = pio_add_program(uart_rx.pio, &uart_rx_program);
-        uart_rx_program_init(uart_rx.pio, uart_rx.sm, pioUartRXOffset, rxPin, divider);
-        isUartRXRunning = true;
-        // Finally, set irq for rx
-        irq_set_exclusive_handler(PIO1_IRQ_0, rx_uart_interrupt);
-	    pio_set_irq0_source_enabled(pio1, pis_sm0_rx_fifo_not_empty, true);
-        irq_set_enabled(PIO1_IRQ_0, true);
+        pio_uart_init_rx(rxPin, rxClockPin);
     }
 
     if (txPin >= 0) {
-	    pioUartTXOffset = pio_add_program(uart_tx.pio, &uart_tx_program);
-        uart_tx_program_init(uart_tx.pio, uart_tx.sm, pioUartTXOffset, txPin, divider);
-        isUartTXRunning = true;
+        pio_uart_init_tx(txPin, txClockPin);
     }
 }
 
 void pio_uart_stop(bool tx, bool rx) {
     if (tx) {
+        uart_tx_program_write_wait();
         isUartTXRunning = false;
         pio_sm_set_enabled(uart_tx.pio, uart_tx.sm, false);
-        pio_remove_program(uart_tx.pio, &uart_tx_program, pioUartTXOffset);
+        pio_remove_program(uart_tx.pio, pioUartTXProgram, pioUartTXOffset);
     }
 
     if (rx) {
         isUartRXRunning = false;
+        // Joybus gets the state machine next, its fifo isn't ours to drain
+        dma_channel_abort(uart_rx_dma_chan);
         pio_sm_set_enabled(uart_rx.pio, uart_rx.sm, false);
-        pio_remove_program(uart_rx.pio, &uart_rx_program, pioUartRXOffset);
-        irq_set_enabled(PIO1_IRQ_0, false);
-        pio_set_irq0_source_enabled(pio1, pis_sm0_rx_fifo_not_empty, false);
-        irq_remove_handler(PIO1_IRQ_0, rx_uart_interrupt);
+        pio_remove_program(uart_rx.pio, pioUartRXProgram, pioUartRXOffset);
     }
 }
 
 void uart_tx_program_putc(char c) {
     if (!isUartTXRunning) { return; }
+    uart_tx_program_write_wait();
     pio_sm_put_blocking(uart_tx.pio, uart_tx.sm, (uint32_t)c);
 }
 
@@ -100,20 +187,23 @@ void uart_tx_program_puts(const char *s) {
         uart_tx_program_putc(*s++);
 }
 
-char uart_rx_program_getc() {
-    if (!isUartRXRunning) { return 0; }
+void uart_tx_program_write_async(const uint8_t *data, uint32_t len) {
+    if (!isUartTXRunning) { return; }
+    uart_tx_program_write_wait();
+    if (len == 0) {
+        return;
+    }
+    dma_channel_transfer_from_buffer_now(uart_tx_dma_chan, data, len);
+}
 
-    // 8-bit read from the uppermost byte of the FIFO, as data is left-justified
-    io_rw_8 *rxfifo_shift = (io_rw_8*)&uart_rx.pio->rxf[uart_rx.sm] + 3;
-    while (pio_sm_is_rx_fifo_empty(uart_rx.pio, uart_rx.sm))
-        tight_loop_contents();
-    return (char)*rxfifo_shift;
+bool uart_tx_program_write_busy() {
+    return uart_tx_dma_chan >= 0 && dma_channel_is_busy(uart_tx_dma_chan);
 }
 
-// If there is data in the rx fifo, then return true
-bool uart_rx_program_is_readable() {
-    if (!isUartRXRunning) { return false; }
-    return !pio_sm_is_rx_fifo_empty(uart_rx.pio, uart_rx.sm);
+void uart_tx_program_write_wait() {
+    while (uart_tx_program_write_busy()) {
+        tight_loop_contents();
+    }
 }
 
 bool uart_tx_program_is_writable() {
@@ -121,15 +211,35 @@ bool uart_tx_program_is_writable() {
     return !pio_sm_is_tx_fifo_full(uart_tx.pio, uart_tx.sm);
 }
 
-void inter_mcu_comms_test() {
-    int testSize = 1023;// * 1024 * 1; // 1MB
+#define COMMS_TEST_BYTES (256 * 1024)
+
+static void comms_test_send(const char *transport) {
+    // Zeros, which the packet layer on the other side skips
+    static uint8_t block[1024];
+
     uint32_t startTime = time_us_32();
-    for(int i = 0; i < testSize; i++) {
-        while(!uart_tx_program_is_writable()) { tight_loop_contents(); }
-        uart_tx_program_putc(i);
+    for (int i = 0; i < COMMS_TEST_BYTES / sizeof(block); i++) {
+        uart_tx_program_write_async(block, sizeof(block));
     }
+    uart_tx_program_write_wait();
+    while (!pio_sm_is_tx_fifo_empty(uart_tx.pio, uart_tx.sm)) { tight_loop_contents(); }
     uint32_t totalTime = time_us_32() - startTime;
+
     float totalSeconds = (((float)totalTime) / 1000.0f / 1000.0f);
-    float mbs = (1.0f / 1024.0f) / (totalSeconds);
-    printf("Sent 1MB in %dus, %dms, %fMB/s\n", totalTime, totalTime / 1000, mbs);
-}
\ No newline at end of file
+    float mbs = ((float)COMMS_TEST_BYTES / 1024.0f / 1024.0f) / totalSeconds;
+    printf("%s: sent %dKB in %dus, %fMB/s\n", transport, COMMS_TEST_BYTES / 1024, totalTime, mbs);
+}
+
+void inter_mcu_comms_test(int txPin, int txClockPin) {
+    pio_uart_stop(true, false);
+    pio_uart_init_tx(txPin, -1);
+    comms_test_send("uart");
+
+    if (txClockPin >= 0) {
+        pio_uart_stop(true, false);
+        pio_uart_init_tx(txPin, txClockPin);
+        comms_test_send("clocked");
+    }
+
+    // Tx is left on the last transport tested, pass the pins the link runs on
+}
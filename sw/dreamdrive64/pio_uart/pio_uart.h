@@ -15,30 +15,51 @@ typedef struct pio_uart_inst {
     uint sm;
 } pio_uart_inst_t;
 
-#define RX_RING_BUFFER_SIZE 1024//512
-typedef struct RXRingBuffer_t {                                                                  
-    uint8_t  buf[RX_RING_BUFFER_SIZE];                                                
-    uint32_t head;                                                   
-    uint32_t tail;                                                   
-} RXRingBuffer_t;
+// Power of 2, the DMA wraps around it. Holds a whole COMMAND_SD_DATA packet,
+// about 4.1KB, with as much again to spare while mcu1 is busy serving the bus.
+#define RX_RING_BUFFER_SIZE 8192
 
 bool rx_uart_buffer_has_data();
 uint8_t rx_uart_buffer_get();
 void rx_uart_buffer_reset();
 
-// Use the rxRingBuffer to read from the uart
+// Bytes dropped because the ring filled up before they were read
+uint32_t rx_uart_buffer_overflow_bytes();
+
+// Clock dividers. The uart takes 8 state machine cycles a bit and 10 bits a
+// byte, 640 system clocks. The clocked transport takes 4 cycles a bit and 8
+// bits a byte, 128 system clocks, about 2MB/s at 266MHz. Its receiver runs
+// at full speed and needs a few clocks to see each 8 clock phase.
+#define PIO_UART_DIVIDER 8
+#define PIO_UART_CLOCKED_DIVIDER 4
+
+// Use the rx_uart_buffer methods to read from the uart
 // Pass -1 to not enable that program
 void pio_uart_init(int rxPin, int txPin);
 
+// Same, but a direction with a clock pin uses the clocked transport: the
+// sender drives the clock and the receiver samples data on its rising edge.
+// There are no start bits, the receiver finds where bytes start at pauses in
+// the data. Pass -1 as the clock pin for the uart. Packets go over either the
+// same way.
+void pio_uart_init_clocked(int rxPin, int rxClockPin, int txPin, int txClockPin);
+
 // pass true to stop, and false to do nothing
 void pio_uart_stop(bool tx, bool rx);
 
 void uart_tx_program_putc(char c);
 void uart_tx_program_puts(const char *s);
-char uart_rx_program_getc();
-bool uart_rx_program_is_readable();
+
+// Sends len bytes with DMA, paced by the tx fifo, and returns right away.
+// data must be left alone until uart_tx_program_write_busy is false. Waits
+// for the write before it, putc waits for it too, so bytes go out in order.
+void uart_tx_program_write_async(const uint8_t *data, uint32_t len);
+bool uart_tx_program_write_busy();
+void uart_tx_program_write_wait();
 bool uart_tx_program_is_writable();
 
-void inter_mcu_comms_test();
+// Sends over tx with the uart, then with the clocked transport if there is a
+// clock pin, and prints the MB/s of each
+void inter_mcu_comms_test(int txPin, int txClockPin);
 
 #endif
@@ -46,7 +46,7 @@ void set_demux_mcu_variables(int demux_pin0, int demux_pin1, int demux_pin2, int
 
 inline uint8_t psram_addr_to_chip(uint32_t address)
 {
-	return ((address >> 23) & 0x7) + START_ROM_LOAD_CHIP_INDEX;
+	return PSRAM_ROM_CHIP(address);
 }
 //   0: Deassert all CS
 // 1-8: Assert the specific PSRAM CS (1 indexed, matches U1, U2 ... U8)
@@ -68,6 +68,14 @@ inline void psram_set_cs(uint8_t chip)
 	sio_hw->gpio_out = (old_gpio_out & (~mask)) | new_mask;
 }
 
+// Move the chip select from one PSRAM chip (1-8) to another with a single
+// toggle of the demux address pins. The demux stays enabled throughout, so
+// there's no read-modify-write of gpio_out on the PI handler's path.
+void psram_switch_cs(uint8_t from, uint8_t to)
+{
+	sio_hw->gpio_togl = (uint32_t)((from - 1) ^ (to - 1)) << current_mcu_demux_pin_0;
+}
+
 void current_mcu_enable_demux(bool enabled) {
 	if (enabled) {
 		gpio_configure(current_demux_enabled_config, ARRAY_SIZE(current_demux_enabled_config));
@@ -25,8 +25,15 @@
 // Starting index of first flash chip used to store rom data
 #define FLASH_CHIP_INDEX (7)
 
+// Roms are laid out linearly, one 8MB chip after the other from
+// START_ROM_LOAD_CHIP_INDEX, so the chip and the offset in it are a shift and
+// a mask of the rom address. The loader and the PI handler both go through these.
+#define PSRAM_ROM_CHIP(address) ((((address) >> 23) & 0x7) + START_ROM_LOAD_CHIP_INDEX)
+#define PSRAM_ROM_OFFSET(address) ((address) & (PSRAM_CHIP_CAPACITY_BYTES - 1))
+
 uint8_t psram_addr_to_chip(uint32_t address);
 void psram_set_cs(uint8_t chip);
+void psram_switch_cs(uint8_t from, uint8_t to);
 
 void set_demux_mcu_variables(int demux_pin0, int demux_pin1, int demux_pin2, int demux_pinIE);
 void current_mcu_enable_demux(bool enabled);
@@ -9,6 +9,7 @@
 #include "psram.h"
 // #include "hardware/flash.h"
 #include "hardware/resets.h" // pico-sdk reset defines
+#include "hardware/irq.h"
 // #include "gpio_helper.h"
 
 // #define VERBOSE
@@ -16,6 +17,7 @@
 bool hasSavedValues = false;
 uint32_t pad_values[NUM_QSPI_GPIOS];
 uint32_t pad_pull_values[NUM_QSPI_GPIOS];
+volatile uint32_t qspi_rx_sample_dly = QSPI_DEFAULT_RX_SAMPLE_DLY;
 void qspi_print_pull(void)
 {
 	for (int i = 0; i < NUM_QSPI_GPIOS; i++) {
@@ -158,6 +160,14 @@ void qspi_oeover_disable(void)
 #define CMD_FAST_QUAD_READ   		0xEB
 #define CMD_READ_STATUS      		0x05
 #define PSRAM_ENTER_QUAD_MODE	  	0x35
+#define PSRAM_EXIT_QUAD_MODE	  	0xF5
+#define FLASH_WRITE_ENABLE			0x06
+#define FLASH_SECTOR_ERASE			0x20
+#define FLASH_BLOCK_ERASE			0xD8
+#define FLASH_READ_STATUS2			0x35
+#define FLASH_WRITE_STATUS2			0x31
+#define FLASH_STATUS2_QE			0x02
+#define FLASH_PAGE_BYTES			256
 
 #define SPI_DEFAULT_CLK_DIVIDER 	4 // when running in spi mode, divide sys clk by 4
 ////////////////////////////////////////////////////////////
@@ -267,10 +277,8 @@ void qspi_enable_flash(int clk_divider) {
 
 	ssi_hw->ssienr = 0;
 	ssi_hw->baudr = clk_divider; // change baud
-    // ssi->rx_sample_dly = 4;  // 300-360
-    // ssi->rx_sample_dly = 3;  // ??
-    ssi->rx_sample_dly = 2;  // 266
-    // ssi->rx_sample_dly = 0;  // ??
+    // 4 worked @ 300-360, 2 @ 266
+    ssi->rx_sample_dly = qspi_rx_sample_dly;
 	ssi_hw->ssienr = 1;
 }
 
@@ -575,6 +583,234 @@ void qspi_spi_write_buf(uint32_t addr, const uint8_t* data, uint32_t len) {
     qspi_spi_put_get(data, NULL, len, 4);
 }
 
+// ----------------------------------------------------------------------------
+// Async write
+
+// Bytes written per CS low, one PSRAM page. A burst never crosses a page.
+#define QSPI_WRITE_BURST_BYTES 1024
+
+static int write_tx_chan = -1;
+static int write_rx_chan = -1;
+static uint8_t write_rx_discard;
+static const uint8_t *write_data;
+static uint32_t write_addr;
+static uint32_t write_remaining;
+static uint32_t write_started_us;
+static volatile bool write_busy;
+static bool write_quad;
+volatile uint32_t qspi_write_busy_us;
+
+static void qspi_wait_tx_done() {
+    while ((ssi->sr & (SSI_SR_TFE_BITS | SSI_SR_BUSY_BITS)) != SSI_SR_TFE_BITS) {
+        tight_loop_contents();
+    }
+}
+
+// Quad tx only frames, instruction and address on all four lines too.
+// addr_l of 0 sends the instruction alone.
+static void qspi_init_quad_write(uint32_t addr_l) {
+    ssi->ssienr = 0;
+    ssi->ctrlr0 =
+            (SSI_CTRLR0_SPI_FRF_VALUE_QUAD << SSI_CTRLR0_SPI_FRF_LSB) | // Quad SPI serial frames
+            (7 << SSI_CTRLR0_DFS_32_LSB) |                             // 8 bits per data frame
+            (SSI_CTRLR0_TMOD_VALUE_TX_ONLY << SSI_CTRLR0_TMOD_LSB);    // Nothing comes back
+    ssi->spi_ctrlr0 =
+            (SSI_SPI_CTRLR0_INST_L_VALUE_8B << SSI_SPI_CTRLR0_INST_L_LSB) |
+            (addr_l << SSI_SPI_CTRLR0_ADDR_L_LSB) |
+            (SSI_SPI_CTRLR0_TRANS_TYPE_VALUE_2C2A << SSI_SPI_CTRLR0_TRANS_TYPE_LSB);
+    ssi->ssienr = 1;
+}
+
+// The last channel to finish tells us the burst is out
+static void qspi_write_set_quad(bool quad) {
+    write_quad = quad;
+    dma_channel_set_irq0_enabled(write_tx_chan, quad);
+    dma_channel_set_irq0_enabled(write_rx_chan, !quad);
+}
+
+static void qspi_write_next_burst() {
+    uint32_t len = QSPI_WRITE_BURST_BYTES - (write_addr & (QSPI_WRITE_BURST_BYTES - 1));
+    if (len > write_remaining) {
+        len = write_remaining;
+    }
+
+    if (write_quad) {
+        // Deselecting the slave holds off the transfer until data is queued
+        // behind the command and address, an empty fifo would end it early
+        ssi->ser = 0;
+        qspi_cs_force(OUTOVER_LOW);
+        ssi->dr0 = CMD_QUAD_WRITE;
+        ssi->dr0 = write_addr;
+        dma_channel_transfer_from_buffer_now(write_tx_chan, write_data, len);
+        ssi->ser = 1;
+    } else {
+        // The rx channel swallows the echo of the command, address and data, so
+        // once it completes the whole burst has been clocked out
+        dma_channel_transfer_to_buffer_now(write_rx_chan, &write_rx_discard, len + 4);
+        qspi_spi_put_cmd_addr(CMD_WRITE, write_addr);
+        dma_channel_transfer_from_buffer_now(write_tx_chan, write_data, len);
+    }
+
+    write_data += len;
+    write_addr += len;
+    write_remaining -= len;
+}
+
+static void qspi_write_dma_irq() {
+    uint32_t mask = 1u << (write_quad ? write_tx_chan : write_rx_chan);
+    if (!(dma_hw->ints0 & mask)) {
+        return;
+    }
+    dma_hw->ints0 = mask;
+
+    if (write_quad) {
+        // The last few bytes are still in the fifo
+        qspi_wait_tx_done();
+    }
+    qspi_cs_force(OUTOVER_HIGH);
+    if (write_remaining) {
+        qspi_write_next_burst();
+    } else {
+        qspi_write_busy_us += time_us_32() - write_started_us;
+        write_busy = false;
+    }
+}
+
+void qspi_spi_write_async_init() {
+    write_tx_chan = dma_claim_unused_channel(true);
+    write_rx_chan = dma_claim_unused_channel(true);
+    qspi_write_busy_us = 0;
+
+    dma_channel_config c = dma_channel_get_default_config(write_tx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, DREQ_XIP_SSITX);
+    dma_channel_configure(write_tx_chan, &c, &ssi->dr0, NULL, 0, false);
+
+    c = dma_channel_get_default_config(write_rx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, DREQ_XIP_SSIRX);
+    dma_channel_configure(write_rx_chan, &c, &write_rx_discard, &ssi->dr0, 0, false);
+
+    ssi->dmatdlr = 4;
+    ssi->dmardlr = 0;
+    ssi->dmacr = SSI_DMACR_TDMAE_BITS | SSI_DMACR_RDMAE_BITS;
+
+    // The SD card driver owns DMA_IRQ_1
+    irq_set_exclusive_handler(DMA_IRQ_0, qspi_write_dma_irq);
+    qspi_write_set_quad(false);
+    irq_set_enabled(DMA_IRQ_0, true);
+}
+
+void qspi_spi_write_async_deinit() {
+    qspi_spi_write_wait();
+
+    if (write_quad) {
+        qspi_quad_write_exit();
+    }
+
+    irq_set_enabled(DMA_IRQ_0, false);
+    dma_channel_set_irq0_enabled(write_tx_chan, false);
+    dma_channel_set_irq0_enabled(write_rx_chan, false);
+    irq_remove_handler(DMA_IRQ_0, qspi_write_dma_irq);
+    ssi->dmacr = 0;
+
+    dma_channel_unclaim(write_tx_chan);
+    dma_channel_unclaim(write_rx_chan);
+    write_tx_chan = -1;
+    write_rx_chan = -1;
+}
+
+void qspi_spi_write_buf_async(uint32_t addr, const uint8_t* data, uint32_t len) {
+    qspi_spi_write_wait();
+    if (len == 0) {
+        return;
+    }
+
+    write_data = data;
+    write_addr = addr;
+    write_remaining = len;
+    write_started_us = time_us_32();
+    write_busy = true;
+    qspi_write_next_burst();
+}
+
+// Puts the chip in quad mode and writes to it 4 bits per clock from here on.
+// The ssi must be in spi mode with the async writer set up.
+void qspi_quad_write_enter(int chip) {
+    qspi_spi_write_wait();
+    psram_set_cs(chip);
+    qspi_spi_do_cmd(PSRAM_ENTER_QUAD_MODE, NULL, NULL, 0);
+    qspi_init_quad_write(6u); // 24 bit address
+    qspi_write_set_quad(true);
+}
+
+// Takes the current chip back out of quad mode, so it answers spi commands
+// again, and returns the ssi to spi mode
+void qspi_quad_write_exit() {
+    qspi_spi_write_wait();
+    qspi_init_quad_write(0);
+    qspi_cs_force(OUTOVER_LOW);
+    ssi->dr0 = PSRAM_EXIT_QUAD_MODE;
+    qspi_wait_tx_done();
+    qspi_cs_force(OUTOVER_HIGH);
+
+    qspi_init_spi(ssi->baudr);
+    qspi_write_set_quad(false);
+}
+
+// Blocking DMA read in spi mode, for checking what was written.
+// Borrows the async writer's channels, so it must be set up and not in quad mode.
+void qspi_spi_read_data_dma(uint32_t addr, uint8_t *rx, uint32_t count) {
+    static const uint8_t zero = 0;
+    assert(!write_quad);
+    qspi_spi_write_wait();
+    dma_channel_set_irq0_enabled(write_rx_chan, false);
+
+    // Drop the echo of the command and address before the dma takes over
+    qspi_spi_put_cmd_addr(CMD_READ_DATA, addr);
+    for (int skip = 4; skip;) {
+        if (ssi->rxflr) {
+            (void) ssi->dr0;
+            --skip;
+        }
+    }
+
+    dma_channel_config tx = dma_get_channel_config(write_tx_chan);
+    dma_channel_config rxc = dma_get_channel_config(write_rx_chan);
+    channel_config_set_read_increment(&tx, false);
+    channel_config_set_write_increment(&rxc, true);
+    dma_channel_set_config(write_tx_chan, &tx, false);
+    dma_channel_set_config(write_rx_chan, &rxc, false);
+
+    dma_channel_transfer_to_buffer_now(write_rx_chan, rx, count);
+    dma_channel_transfer_from_buffer_now(write_tx_chan, &zero, count);
+    dma_channel_wait_for_finish_blocking(write_rx_chan);
+    qspi_cs_force(OUTOVER_HIGH);
+
+    channel_config_set_read_increment(&tx, true);
+    channel_config_set_write_increment(&rxc, false);
+    dma_channel_set_config(write_tx_chan, &tx, false);
+    dma_channel_set_config(write_rx_chan, &rxc, false);
+
+    // Don't let the finished read look like a finished write
+    dma_hw->ints0 = 1u << write_rx_chan;
+    qspi_write_set_quad(false);
+}
+
+bool qspi_spi_write_busy() {
+    return write_busy;
+}
+
+void qspi_spi_write_wait() {
+    while (write_busy) {
+        tight_loop_contents();
+    }
+}
+
 // Force MISO input to SSI low so that an in-progress SR polling loop will
 // fall through. This is needed when a flash programming task in async task
 // context is locked up (e.g. if there is no flash device, and a hard pullup
@@ -594,6 +830,79 @@ static int qspi_was_hard_aborted() {
            & IO_QSPI_GPIO_QSPI_SD1_CTRL_INOVER_BITS;
 }
 
+// ----------------------------------------------------------------------------
+// NOR flash, the flash array chips. SPI mode, on the selected chip.
+
+// Quad reads need the quad enable bit. It's non volatile, so only written once.
+void qspi_flash_enable_quad() {
+    uint8_t status2;
+    qspi_spi_do_cmd(FLASH_READ_STATUS2, NULL, &status2, 1);
+    if (status2 & FLASH_STATUS2_QE) {
+        return;
+    }
+
+    status2 |= FLASH_STATUS2_QE;
+    qspi_spi_do_cmd(FLASH_WRITE_ENABLE, NULL, NULL, 0);
+    qspi_spi_do_cmd(FLASH_WRITE_STATUS2, &status2, NULL, 1);
+    qspi_spi_wait_ready();
+}
+
+// Erases the 4KB sector holding addr
+void qspi_flash_erase_sector(uint32_t addr) {
+    qspi_spi_do_cmd(FLASH_WRITE_ENABLE, NULL, NULL, 0);
+    qspi_spi_put_cmd_addr(FLASH_SECTOR_ERASE, addr);
+    qspi_spi_put_get(NULL, NULL, 0, 4);
+    qspi_spi_wait_ready();
+}
+
+// Erases the 64KB block holding addr
+void qspi_flash_erase_block(uint32_t addr) {
+    qspi_spi_do_cmd(FLASH_WRITE_ENABLE, NULL, NULL, 0);
+    qspi_spi_put_cmd_addr(FLASH_BLOCK_ERASE, addr);
+    qspi_spi_put_get(NULL, NULL, 0, 4);
+    qspi_spi_wait_ready();
+}
+
+// Programs an erased range, one page program per 256 byte page
+void qspi_flash_program(uint32_t addr, const uint8_t *data, uint32_t len) {
+    while (len) {
+        uint32_t n = FLASH_PAGE_BYTES - (addr & (FLASH_PAGE_BYTES - 1));
+        if (n > len) {
+            n = len;
+        }
+
+        qspi_spi_do_cmd(FLASH_WRITE_ENABLE, NULL, NULL, 0);
+        qspi_spi_write_buf(addr, data, n);
+        qspi_spi_wait_ready();
+
+        addr += n;
+        data += n;
+        len -= n;
+    }
+}
+
+// Quad reads from a flash array chip for the rom stream. The instruction goes
+// out on one line, the address and the mode byte on four, so address words are
+// written as (addr << 8). Mode 0 keeps the chip out of continuous read.
+void qspi_init_flash_qspi() {
+    ssi->ssienr = 0;
+    ssi->baudr = QSPI_QUAD_MODE_CLK_DIVIDER;
+    ssi->ctrlr0 =
+            (SSI_CTRLR0_SPI_FRF_VALUE_QUAD << SSI_CTRLR0_SPI_FRF_LSB) |  // Quad SPI serial frames
+            (31 << SSI_CTRLR0_DFS_32_LSB) |                             // 32 clocks per data frame
+            (SSI_CTRLR0_TMOD_VALUE_EEPROM_READ << SSI_CTRLR0_TMOD_LSB); // Send instr + addr, receive data
+    ssi->spi_ctrlr0 =
+            (CMD_FAST_QUAD_READ << SSI_SPI_CTRLR0_XIP_CMD_LSB) |
+            (4u << SSI_SPI_CTRLR0_WAIT_CYCLES_LSB) |
+            (SSI_SPI_CTRLR0_INST_L_VALUE_8B << SSI_SPI_CTRLR0_INST_L_LSB) |
+            (8u << SSI_SPI_CTRLR0_ADDR_L_LSB) |    // 24-bit address + 8 mode bits
+            (SSI_SPI_CTRLR0_TRANS_TYPE_VALUE_1C2A  // Command serial, address quad
+                    << SSI_SPI_CTRLR0_TRANS_TYPE_LSB);
+
+    ssi->rx_sample_dly = qspi_rx_sample_dly;
+    ssi->ssienr = 1;
+}
+
 // ----------------------------------------------------------------------------
 // Read
 
@@ -637,9 +946,7 @@ void qspi_init_qspi() {
             (SSI_SPI_CTRLR0_TRANS_TYPE_VALUE_2C2A  // Command and address both in serial format
                     << SSI_SPI_CTRLR0_TRANS_TYPE_LSB);
 
-	// ssi->rx_sample_dly = 3;
-    ssi->rx_sample_dly = 2;
-    // ssi->rx_sample_dly = 1;
+    ssi->rx_sample_dly = qspi_rx_sample_dly;
     ssi->ssienr = 1;
 }
 
@@ -36,6 +36,10 @@ extern bool g_isMCU1;
 
 #define QSPI_QUAD_MODE_CLK_DIVIDER 4 // rp2040@266MHz = 133MHz psram clk
 
+// Default SSI RX sample delay, in system clocks. Boards can run with a calibrated one.
+#define QSPI_DEFAULT_RX_SAMPLE_DLY 2 // 266
+extern volatile uint32_t qspi_rx_sample_dly;
+
 #define LOG_BUFFER_SIZE 2048
 extern uint32_t log_buffer[LOG_BUFFER_SIZE]; // store addresses
 void add_log_to_buffer(uint32_t value);
@@ -59,8 +63,27 @@ void qspi_spi_put_get(const uint8_t *tx, uint8_t *rx, size_t count, size_t rx_sk
 void qspi_spi_do_cmd(uint8_t cmd, const uint8_t *tx, uint8_t *rx, size_t count);
 void qspi_spi_put_cmd_addr(uint8_t cmd, uint32_t addr);
 void qspi_spi_write_buf(uint32_t addr, const uint8_t* data, uint32_t len);
+
+// DMA fed writes, the cpu is free while the bytes go out. Data must stay put
+// until the write completes. Uses two DMA channels and DMA_IRQ_0 between init and deinit.
+extern volatile uint32_t qspi_write_busy_us; // time spent writing since init
+void qspi_spi_write_async_init();
+void qspi_spi_write_async_deinit();
+void qspi_spi_write_buf_async(uint32_t addr, const uint8_t* data, uint32_t len);
+void qspi_quad_write_enter(int chip);
+void qspi_quad_write_exit();
+void qspi_spi_read_data_dma(uint32_t addr, uint8_t *rx, uint32_t count);
+bool qspi_spi_write_busy();
+void qspi_spi_write_wait();
 void qspi_spi_read_data(uint32_t addr, uint8_t *rx, size_t count);
 void qspi_spi_wait_ready();
 
+// NOR flash chips of the flash array, on the selected chip
+void qspi_flash_enable_quad();
+void qspi_flash_erase_sector(uint32_t addr);
+void qspi_flash_erase_block(uint32_t addr);
+void qspi_flash_program(uint32_t addr, const uint8_t *data, uint32_t len);
+void qspi_init_flash_qspi();
+
 // LEGACY FUNCTION, DON'T USE
 void program_flash_enter_cmd_xip(bool isPSRAM);
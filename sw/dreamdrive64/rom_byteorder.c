@@ -0,0 +1,50 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+#include "rom_byteorder.h"
+
+rom_byte_order_t rom_detect_byte_order(const uint8_t *header) {
+    uint32_t word = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) | ((uint32_t)header[2] << 8) | header[3];
+    switch (word) {
+        case 0x80371240: return ROM_BYTE_ORDER_Z64;
+        case 0x37804012: return ROM_BYTE_ORDER_V64;
+        case 0x40123780: return ROM_BYTE_ORDER_N64;
+        default: return ROM_BYTE_ORDER_UNKNOWN;
+    }
+}
+
+const char *rom_byte_order_name(rom_byte_order_t order) {
+    switch (order) {
+        case ROM_BYTE_ORDER_Z64: return "z64";
+        case ROM_BYTE_ORDER_V64: return "v64";
+        case ROM_BYTE_ORDER_N64: return "n64";
+        default: return "unknown";
+    }
+}
+
+void rom_convert_to_z64(rom_byte_order_t order, uint8_t *buf, uint32_t len) {
+    // Whole words first, one or two instructions per word
+    uint32_t *words = (uint32_t *)buf;
+    uint32_t count = len / 4;
+
+    if (order == ROM_BYTE_ORDER_V64) {
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t w = words[i];
+            words[i] = ((w & 0x00FF00FF) << 8) | ((w >> 8) & 0x00FF00FF);
+        }
+        // A trailing half word still swaps
+        if (len & 2) {
+            uint8_t *tail = buf + count * 4;
+            uint8_t b = tail[0];
+            tail[0] = tail[1];
+            tail[1] = b;
+        }
+    } else if (order == ROM_BYTE_ORDER_N64) {
+        for (uint32_t i = 0; i < count; i++) {
+            words[i] = __builtin_bswap32(words[i]);
+        }
+    }
+}
@@ -0,0 +1,25 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Rom dumps come in three byte orders, told apart by the first word.
+// PSRAM always holds the big endian (.z64) order the PI handler serves.
+typedef enum {
+    ROM_BYTE_ORDER_Z64, // 80 37 12 40, big endian
+    ROM_BYTE_ORDER_V64, // 37 80 40 12, 16 bit words swapped
+    ROM_BYTE_ORDER_N64, // 40 12 37 80, 32 bit words little endian
+    ROM_BYTE_ORDER_UNKNOWN
+} rom_byte_order_t;
+
+rom_byte_order_t rom_detect_byte_order(const uint8_t *header);
+const char *rom_byte_order_name(rom_byte_order_t order);
+
+// Converts in place to .z64 order. buf must be word aligned and chunks must
+// start on a word boundary in the file. Unknown and .z64 are left alone.
+void rom_convert_to_z64(rom_byte_order_t order, uint8_t *buf, uint32_t len);
@@ -1,14 +1,24 @@
 #define MAPPING_TABLE_LEN (16384 - 8)
 
 #define COMPRESSED_ROM 1
+
+// Chunk size of the rom in mcu1's flash. load_rom picks it per rom and
+// writes it to rom_chunk_size.h next to rom.h. A rom.h from before that is
+// in 1KB chunks.
+#if __has_include("rom_chunk_size.h")
+#include "rom_chunk_size.h"
+#else
 #define COMPRESSION_SHIFT_AMOUNT 10
 #define COMPRESSION_MASK 1023
+#endif
 
 extern const char picocart_header[16];
 extern uint16_t rom_mapping[MAPPING_TABLE_LEN];
 extern const uint16_t flash_rom_mapping[];
 
-extern const unsigned char rom_chunks[][1024];
+extern const unsigned char rom_chunks[][1 << COMPRESSION_SHIFT_AMOUNT];
 
 extern volatile bool g_loadRomFromMemoryArray;
+extern volatile bool g_romFromFlashArray; // rom deduplicated in the flash array, see flash_array.h
+extern volatile uint32_t g_flashArrayMappingAddress; // where in the flash array its mapping table is
 extern volatile int g_currentMemoryArrayChip;
@@ -11,6 +11,7 @@
 
 #include "pico/stdlib.h"
 #include "hardware/structs/systick.h"
+#include "hardware/clocks.h"
 
 #include "ff.h" /* Obtains integer types */
 #include "diskio.h" /* Declarations of disk functions */
@@ -25,6 +26,11 @@
 #include "ringbuf.h"
 #include "joybus/joybus.h"
 #include "sram.h"
+#include "n64_pi_task.h"
+#include "rom_byteorder.h"
+#include "crc32.h"
+#include "flash_array.h"
+#include "mcu_packet.h"
 
 #include "utils.h"
 #include "FreeRTOS.h"
@@ -35,8 +41,6 @@
 #define REGISTER_SD_COMMAND             0x0 // 1 byte, r/w
 #define REGISTER_SD_READ_SECTOR         0x1 // 4 bytes
 #define REGISTER_SD_READ_SECTOR_COUNT   0x5 // 4 bytes
-#define COMMAND_START                   0xDE
-#define COMMAND_START2                  0xAD
 #define COMMAND_SD_READ                 0x72 // literally the r char
 #define COMMAND_SD_WRITE                0x77 // literally the w char
 #define COMMAND_LOAD_ROM                0x6C // literally the l char
@@ -48,6 +52,14 @@
 #define COMMAND_SET_ROM_META_INFO       (0xA1)
 #define COMMAND_BACKUP_SRAM             (0xA2)
 #define COMMAND_LOAD_SRAM_BACKUP        (0x2A)
+#define COMMAND_SAVE_PI_CALIBRATION     (0xCA)
+#define COMMAND_SET_PI_CALIBRATION      (0xAC)
+#define COMMAND_PI_STATS                (0x57)
+#define COMMAND_ROM_READY               (0x52)
+#define COMMAND_ROM_IN_FLASH_ARRAY      (0x46) // literally the F char
+#define COMMAND_PIN_ROM                 (0x50) // literally the P char
+#define COMMAND_ROM_PINNED              (0xAF) // inverse of the pin rom command
+#define COMMAND_SD_DATA                 (0x44) // literally the D char, the sector asked for with COMMAND_SD_READ
 #define DISK_READ_BUFFER_SIZE 512
 
 #define DEBUG_MCU2_PSRAM_SANITY_TEST 0
@@ -58,17 +70,81 @@
 
 int DDR64_MCU_ID = -1;
 
-volatile int bufferIndex = 0; // Used on MCU1 to track where to put the next byte received from MCU2
-uint8_t lastBufferValue = 0;
-int bufferByteIndex = 0;
 volatile bool ddr64_useDynamicBuffer = false; // Toggle to use the default buffer or large buffer
 volatile uint16_t ddr64_uart_tx_buf[DDR64_BASE_ADDRESS_LENGTH];
 volatile uint8_t* ddr64_dynamic_large_buffer; // Set based on needs that might be larger than the uart tx buf. e.g. sram save
 
+static void ddr64_uart_putc(uint8_t byte) {
+    uart_tx_program_putc(byte);
+}
+
+// Packets to the other mcu
+mcu_packet_tx_t ddr64_packet_tx = { .putc = ddr64_uart_putc };
+
+// COMMAND_SD_DATA is the sector number as sent with COMMAND_SD_READ, then the sectors
+#define SD_READ_SECTOR_BYTES 8
+#define SD_DATA_LENGTH(count) (SD_READ_SECTOR_BYTES + (count) * SD_CARD_SECTOR_SIZE)
+
+// As many sectors as fit in the N64's 4KB window onto ddr64_uart_tx_buf
+#define SD_READ_MAX_SECTORS (DDR64_BASE_ADDRESS_LENGTH / SD_CARD_SECTOR_SIZE)
+
+// MCU1 asks for the sector again if it hasn't arrived intact by then. A
+// damaged packet is dropped and waits this out too, as a bad length can't
+// say where the sector ends.
+#define SD_READ_RETRY_US (20 * 1000)
+static uint8_t sd_read_sector[SD_READ_SECTOR_BYTES];
+static uint32_t sd_read_count = 1;
+static uint8_t sd_data_rx_buf[SD_DATA_LENGTH(SD_READ_MAX_SECTORS)];
+static volatile bool sd_read_pending = false;
+static uint32_t sd_read_sent_us = 0;
+volatile uint32_t sd_read_retries = 0;
+
+// The sram backup is staged here, a damaged one would overwrite the save.
+// Once its crc checks out it waits for the end of the load, the N64 is
+// still held off by sd_is_busy then and can't be reading sram.
+static uint8_t *sram_backup_rx_buf = NULL;
+static uint16_t sram_backup_len = 0;
+
+static uint8_t *mcu1_packet_buffer(uint8_t cmd, uint16_t len) {
+    if (cmd == COMMAND_SD_DATA) {
+        return len <= sizeof(sd_data_rx_buf) ? sd_data_rx_buf : NULL;
+
+    } else if (cmd == COMMAND_LOAD_SRAM_BACKUP) {
+        if (len > SRAM_256KBIT_SIZE) {
+            return NULL;
+        }
+        // Left over if the last one was damaged
+        free(sram_backup_rx_buf);
+        sram_backup_rx_buf = malloc(len);
+        sram_backup_len = 0;
+        return sram_backup_rx_buf;
+    }
+
+    // Use the regular buffer
+    return len <= sizeof(ddr64_uart_tx_buf) ? (uint8_t*)ddr64_uart_tx_buf : NULL;
+}
+
+static uint8_t *mcu2_packet_buffer(uint8_t cmd, uint16_t len) {
+    // TODO just use the dynamic buffer for everything?
+    // If we are reading large data, use the dynamic buffer
+    if (len > sizeof(ddr64_uart_tx_buf)) {
+        if (ddr64_dynamic_large_buffer == 0) {
+            free((void*)ddr64_dynamic_large_buffer);
+        }
+        ddr64_useDynamicBuffer = true;
+        ddr64_dynamic_large_buffer = malloc(len+1);
+        return (uint8_t*)ddr64_dynamic_large_buffer;
+    }
+
+    ddr64_useDynamicBuffer = false;
+    return (uint8_t*)ddr64_uart_tx_buf;
+}
+
+static mcu_packet_rx_t mcu1_packet_rx = { .buffer_for = mcu1_packet_buffer };
+static mcu_packet_rx_t mcu2_packet_rx = { .buffer_for = mcu2_packet_buffer };
+
 volatile uint32_t sd_sector_registers[4];
 volatile uint32_t sd_sector_count_registers[2];
-volatile uint32_t sd_read_sector_start;
-volatile uint32_t sd_read_sector_count;
 char sd_selected_rom_title[256]; // TODO this buffer will need to be larger if the rom is in a sub directory
 volatile uint32_t sd_selected_title_length_registers[2];
 volatile uint32_t sd_selected_title_length = 0;
@@ -97,6 +173,26 @@ volatile uint32_t verifyDataTime = 0;
 // Used to set if an sram write has occured
 volatile bool did_write_SRAM = false;
 
+// PI calibration, as it is stored on the sd card:
+// header timing (2 bytes), rx sample delay (2 bytes), mcu1 clock in kHz it was found at (4 bytes)
+#define PI_CALIBRATION_FILE "0:/ddr_firmware/pi_calibration.bin"
+#define PI_CALIBRATION_LENGTH 8
+uint8_t pi_calibration[PI_CALIBRATION_LENGTH];
+volatile bool start_savePiCalibration = false;
+
+// PI handler counters sent by mcu1, pi_stats as 32-bit big endian words,
+// followed by mcu1's counters for the link from mcu2: bad packets, missed
+// packets, sd read retries and rx bytes overflowed
+#define PI_STATS_LENGTH (PI_REGION_COUNT * sizeof(pi_region_stats_t))
+#define MCU1_LINK_STATS_WORDS 4
+#define PI_STATS_PACKET_LENGTH (PI_STATS_LENGTH + MCU1_LINK_STATS_WORDS * 4)
+uint8_t pi_stats_dump[PI_STATS_PACKET_LENGTH];
+volatile bool start_printPiStats = false;
+
+// Rom to pin or unpin in the flash array library, sent by mcu1
+char pin_rom_title[256];
+volatile bool start_pinRom = false;
+
 // There is some kind of limitation on the number of FIL objects which is causing
 // EEPROM saving to stop working after a rom is loaded :/
 // Just use a global FIL object. Janky but should be okay for now.
@@ -122,7 +218,12 @@ void ddr64_set_sd_rom_selection_length_register(uint32_t value, int index) {
 
 void ddr64_set_sd_rom_selection(char* titleBuffer, uint32_t len) {
     sd_selected_title_length = len >> 16;
+    if (sd_selected_title_length >= sizeof(sd_selected_rom_title)) {
+        sd_selected_title_length = sizeof(sd_selected_rom_title) - 1;
+    }
     strncpy(sd_selected_rom_title, titleBuffer, sd_selected_title_length);
+    // A shorter title than the last one mustn't keep its tail
+    sd_selected_rom_title[sd_selected_title_length] = '\0';
 }
 
 void ddr64_set_rom_meta_data(uint32_t value, int index) {
@@ -137,38 +238,38 @@ void ddr64_send_sd_read_command(void) {
     // Block cart while waiting for data
     sd_is_busy = true;
     sendDataReady = false;
-    bufferIndex = 0;
-    bufferByteIndex = 0;
-    uint32_t sectorCount = 1;
 
-    // Signal start
-    uart_tx_program_putc(COMMAND_START);
-    uart_tx_program_putc(COMMAND_START2);
-
-    // command
-    uart_tx_program_putc(COMMAND_SD_READ);
+    // Written as two half words, high half first. Menus that never write
+    // it read one sector at a time.
+    uint32_t sectorCount = (sd_sector_count_registers[1] & 0xFFFF0000) | (sd_sector_count_registers[0] >> 16);
+    if (sectorCount == 0) {
+        sectorCount = 1;
+    } else if (sectorCount > SD_READ_MAX_SECTORS) {
+        sectorCount = SD_READ_MAX_SECTORS;
+    }
+    sd_read_count = sectorCount;
 
-    // 12 bytes to read
-    uart_tx_program_putc(0);
-    uart_tx_program_putc(12);
+    // Drop whatever was part way in, the buffer it came from was reset
+    mcu_packet_rx_reset(&mcu1_packet_rx);
 
-    // sector (top bytes)
-    uart_tx_program_putc((char)(sd_sector_registers[0] >> 24));
-    uart_tx_program_putc((char)(sd_sector_registers[0] >> 16));
-    uart_tx_program_putc((char)(sd_sector_registers[1] >> 24));
-    uart_tx_program_putc((char)(sd_sector_registers[1] >> 16));
+    // sector, the top bytes of each register
+    for (int i = 0; i < 4; i++) {
+        sd_read_sector[i * 2] = sd_sector_registers[i] >> 24;
+        sd_read_sector[i * 2 + 1] = sd_sector_registers[i] >> 16;
+    }
 
-    // sector (bottom bytes)
-    uart_tx_program_putc((char)(sd_sector_registers[2] >> 24));
-    uart_tx_program_putc((char)(sd_sector_registers[2] >> 16));
-    uart_tx_program_putc((char)(sd_sector_registers[3] >> 24));
-    uart_tx_program_putc((char)(sd_sector_registers[3] >> 16));
+    mcu_packet_tx_begin(&ddr64_packet_tx, COMMAND_SD_READ, SD_READ_SECTOR_BYTES + 4);
+    mcu_packet_tx_write(&ddr64_packet_tx, sd_read_sector, SD_READ_SECTOR_BYTES);
 
     // num sectors
-    uart_tx_program_putc((char)((sectorCount & 0xFF000000) >> 24));
-    uart_tx_program_putc((char)((sectorCount & 0x00FF0000) >> 16));
-    uart_tx_program_putc((char)((sectorCount & 0x0000FF00) >> 8));
-    uart_tx_program_putc((char) (sectorCount & 0x000000FF));
+    mcu_packet_tx_put(&ddr64_packet_tx, sectorCount >> 24);
+    mcu_packet_tx_put(&ddr64_packet_tx, sectorCount >> 16);
+    mcu_packet_tx_put(&ddr64_packet_tx, sectorCount >> 8);
+    mcu_packet_tx_put(&ddr64_packet_tx, sectorCount);
+    mcu_packet_tx_end(&ddr64_packet_tx);
+
+    sd_read_sent_us = time_us_32();
+    sd_read_pending = true;
 }
 
 // Send command from MCU1 to MCU2 to start loading a rom
@@ -177,42 +278,86 @@ void ddr64_send_load_new_rom_command() {
     sd_is_busy = true;
     sendDataReady = false;
     romLoading = true;
-    bufferIndex = 0;
-    bufferByteIndex = 0;
+    sd_read_pending = false;
+    mcu_packet_rx_reset(&mcu1_packet_rx);
 
     // send metadata first
-    uart_tx_program_putc(COMMAND_START);
-    uart_tx_program_putc(COMMAND_START2);
-
-    // Command
-    uart_tx_program_putc(COMMAND_SET_ROM_META_INFO);
+    mcu_packet_tx_begin(&ddr64_packet_tx, COMMAND_SET_ROM_META_INFO, 4);
+    mcu_packet_tx_put(&ddr64_packet_tx, selected_rom_metadata_register >> 24);
+    mcu_packet_tx_put(&ddr64_packet_tx, selected_rom_metadata_register >> 16);
+    mcu_packet_tx_put(&ddr64_packet_tx, selected_rom_metadata_register >> 8);
+    mcu_packet_tx_put(&ddr64_packet_tx, selected_rom_metadata_register);
+    mcu_packet_tx_end(&ddr64_packet_tx);
 
-    // Sending 4 bytes
-    uart_tx_program_putc(0);
-    uart_tx_program_putc(4);
+    // Now send rom to load info
+    uint32_t rom_title_len = strlen(sd_selected_rom_title);
+    mcu_packet_send(&ddr64_packet_tx, COMMAND_LOAD_ROM, (const uint8_t *)sd_selected_rom_title, rom_title_len);
+}
 
-    // Data
-    uart_tx_program_putc(selected_rom_metadata_register >> 24);
-    uart_tx_program_putc(selected_rom_metadata_register >> 16);
-    uart_tx_program_putc(selected_rom_metadata_register >> 8);
-    uart_tx_program_putc(selected_rom_metadata_register);
+// Send command from MCU1 to MCU2 to pin or unpin the selected rom in the flash array library
+void ddr64_send_pin_rom_command() {
+    // Block cart while mcu2 has the bus
+    sd_is_busy = true;
+    sendDataReady = false;
+    romLoading = true;
+    sd_read_pending = false;
+    mcu_packet_rx_reset(&mcu1_packet_rx);
 
-    // Now send rom to load info
     uint32_t rom_title_len = strlen(sd_selected_rom_title);
+    mcu_packet_send(&ddr64_packet_tx, COMMAND_PIN_ROM, (const uint8_t *)sd_selected_rom_title, rom_title_len);
+}
 
-    // Signal start
-    uart_tx_program_putc(COMMAND_START);
-    uart_tx_program_putc(COMMAND_START2);
+void ddr64_send_pi_calibration(uint32_t calibration) {
+    // Only valid at the clock it was found at
+    uint32_t sys_khz = clock_get_hz(clk_sys) / 1000;
+
+    mcu_packet_tx_begin(&ddr64_packet_tx, COMMAND_SAVE_PI_CALIBRATION, PI_CALIBRATION_LENGTH);
+    mcu_packet_tx_put(&ddr64_packet_tx, calibration >> 24);
+    mcu_packet_tx_put(&ddr64_packet_tx, calibration >> 16);
+    mcu_packet_tx_put(&ddr64_packet_tx, calibration >> 8);
+    mcu_packet_tx_put(&ddr64_packet_tx, calibration);
+    mcu_packet_tx_put(&ddr64_packet_tx, sys_khz >> 24);
+    mcu_packet_tx_put(&ddr64_packet_tx, sys_khz >> 16);
+    mcu_packet_tx_put(&ddr64_packet_tx, sys_khz >> 8);
+    mcu_packet_tx_put(&ddr64_packet_tx, sys_khz);
+    mcu_packet_tx_end(&ddr64_packet_tx);
+}
 
-    // command
-    uart_tx_program_putc(COMMAND_LOAD_ROM);
+void ddr64_send_pi_stats() {
+    // Copy first so the bytes sent are at least consistent per counter
+    pi_region_stats_t stats[PI_REGION_COUNT];
+    memcpy(stats, (const void *)pi_stats, sizeof(stats));
+    const uint32_t *words = (const uint32_t *)stats;
+    uint32_t link[MCU1_LINK_STATS_WORDS] = {
+        mcu1_packet_rx.bad, mcu1_packet_rx.missed, sd_read_retries, rx_uart_buffer_overflow_bytes()
+    };
+
+    mcu_packet_tx_begin(&ddr64_packet_tx, COMMAND_PI_STATS, PI_STATS_PACKET_LENGTH);
+    for (int i = 0; i < PI_STATS_PACKET_LENGTH / 4; i++) {
+        uint32_t word = i < PI_STATS_LENGTH / 4 ? words[i] : link[i - PI_STATS_LENGTH / 4];
+        mcu_packet_tx_put(&ddr64_packet_tx, word >> 24);
+        mcu_packet_tx_put(&ddr64_packet_tx, word >> 16);
+        mcu_packet_tx_put(&ddr64_packet_tx, word >> 8);
+        mcu_packet_tx_put(&ddr64_packet_tx, word);
+    }
+    mcu_packet_tx_end(&ddr64_packet_tx);
+}
 
-    // Number of bytes based on the length of the rom title
-    uart_tx_program_putc(rom_title_len >> 8);
-    uart_tx_program_putc(rom_title_len);
+// Tell mcu1 which 1MB blocks of the rom being loaded are in PSRAM
+void ddr64_send_rom_ready(const uint32_t *ready) {
+    mcu_packet_tx_begin(&ddr64_packet_tx, COMMAND_ROM_READY, PI_ROM_READY_WORDS * 4);
+    for (int i = 0; i < PI_ROM_READY_WORDS; i++) {
+        mcu_packet_tx_put(&ddr64_packet_tx, ready[i] >> 24);
+        mcu_packet_tx_put(&ddr64_packet_tx, ready[i] >> 16);
+        mcu_packet_tx_put(&ddr64_packet_tx, ready[i] >> 8);
+        mcu_packet_tx_put(&ddr64_packet_tx, ready[i]);
+    }
+    mcu_packet_tx_end(&ddr64_packet_tx);
+}
 
-    for(int i = 0; i < rom_title_len; i++) {
-        uart_tx_program_putc(sd_selected_rom_title[i]);
+static void rom_ready_mark(uint32_t *ready, uint32_t start, uint32_t end) {
+    for (uint32_t block = start >> PI_ROM_READY_BLOCK_SHIFT; block < (end >> PI_ROM_READY_BLOCK_SHIFT) && block < PI_ROM_READY_WORDS * 32; block++) {
+        ready[block >> 5] |= 1u << (block & 31);
     }
 }
 
@@ -227,20 +372,27 @@ void send_SRAM_data() {
     // uint8_t backupCommand;
     // uint16_t numBytesToSend = 0x8000; // 32KB, default sram save size
 
-    // uart_tx_program_putc(COMMAND_START);
-    // uart_tx_program_putc(COMMAND_START2);
-    // uart_tx_program_putc(COMMAND_BACKUP_SRAM);
-    // uart_tx_program_putc((uint8_t)(numBytesToSend >> 8));
-    // uart_tx_program_putc((uint8_t)(numBytesToSend));
+    // mcu_packet_send(&ddr64_packet_tx, COMMAND_BACKUP_SRAM, (const uint8_t*)sram, numBytesToSend);
+}
+
+// Send the saved PI calibration, if there is one, to mcu1 while it waits for the rom
+static void send_pi_calibration_from_sd(FIL* fil) {
+    FRESULT fr = f_open(fil, PI_CALIBRATION_FILE, FA_READ);
+    if (FR_OK != fr) {
+        printf("No PI calibration, using the default timing\n");
+        return;
+    }
 
-    // uint8_t* sram_8Bit = (uint8_t*)sram;
+    uint numRead = 0;
+    fr = f_read(fil, pi_calibration, PI_CALIBRATION_LENGTH, &numRead);
+    f_close(fil);
+    if (fr != FR_OK || numRead != PI_CALIBRATION_LENGTH) {
+        printf("Error reading '%s'. Error: %u\n", PI_CALIBRATION_FILE, fr);
+        return;
+    }
 
-    // for (int i = 0; i < numBytesToSend; i++) {
-    //     while (!uart_tx_program_is_writable()) {
-    //         tight_loop_contents();
-    //     }
-    //     uart_tx_program_putc(sram_8Bit[i]);
-    // }
+    printf("Sending PI calibration to mcu1...\n");
+    mcu_packet_send(&ddr64_packet_tx, COMMAND_SET_PI_CALIBRATION, pi_calibration, PI_CALIBRATION_LENGTH);
 }
 
 void extract_metadata_and_send_save_info(char* buf, FIL* fil) {
@@ -252,31 +404,26 @@ void extract_metadata_and_send_save_info(char* buf, FIL* fil) {
     printf("meta register: %08x\n", selected_rom_metadata_register);
     printf("CIC: %d, saveType: %d, country: %c\n", selected_rom_cic, saveType, buf[0x3E]);
 
+    send_pi_calibration_from_sd(fil);
+
     // Depending on the save type (sram or eeprom, or in some cases BOTH)
     // Send the appropriate save data to mcu1
 
     printf("Sending eeprom info to mcu1...\n");
-    uart_tx_program_putc(COMMAND_START);
-    uart_tx_program_putc(COMMAND_START2);
-    uart_tx_program_putc(COMMAND_SET_EEPROM_TYPE);
-    uart_tx_program_putc(0);
-    uart_tx_program_putc(2);
-
     if(saveType == 3) {
         eeprom_type = EEPROM_TYPE_4K;
-        uart_tx_program_putc((uint8_t)(EEPROM_TYPE_4K >> 8));
-        uart_tx_program_putc((uint8_t)(EEPROM_TYPE_4K));
     } else if (saveType == 4) {
         eeprom_type = EEPROM_TYPE_16K;
-        uart_tx_program_putc((uint8_t)(EEPROM_TYPE_16K >> 8));
-        uart_tx_program_putc((uint8_t)(EEPROM_TYPE_16K));
     } else {
         // Don't use eeprom
         eeprom_type = 0;
-        uart_tx_program_putc(0);
-        uart_tx_program_putc(0);
     }
 
+    mcu_packet_tx_begin(&ddr64_packet_tx, COMMAND_SET_EEPROM_TYPE, 2);
+    mcu_packet_tx_put(&ddr64_packet_tx, (uint8_t)(eeprom_type >> 8));
+    mcu_packet_tx_put(&ddr64_packet_tx, (uint8_t)(eeprom_type));
+    mcu_packet_tx_end(&ddr64_packet_tx);
+
     if (saveType == 3 || saveType == 4) {
         // Busy wait for a few cycles then send eeprom data
         for(int i = 0; i < 10000; i++) { tight_loop_contents(); }
@@ -286,17 +433,226 @@ void extract_metadata_and_send_save_info(char* buf, FIL* fil) {
         printf("Finished sending eeprom data to mcu1!\n");
 
         // for(int i = 0; i < 10000; i++) { tight_loop_contents(); }
+    } else if (saveType == 1) {
+        load_saveData_from_sd(fil, sd_selected_rom_title, 1);
     }
 }
 
 void load_selected_rom() {
     printf("Loading '%s'...\n", sd_selected_rom_title);
+    if (load_rom_from_flash_library(sd_selected_rom_title)) {
+        return;
+    }
     load_new_rom(sd_selected_rom_title);
 }
 
+// Let MCU1 know that the rom is ready to serve, and from where
+static void send_rom_loaded(bool inFlashArray, uint32_t mappingAddress) {
+    if (inFlashArray) {
+        mcu_packet_tx_begin(&ddr64_packet_tx, COMMAND_ROM_IN_FLASH_ARRAY, 4);
+        mcu_packet_tx_put(&ddr64_packet_tx, mappingAddress >> 24);
+        mcu_packet_tx_put(&ddr64_packet_tx, mappingAddress >> 16);
+        mcu_packet_tx_put(&ddr64_packet_tx, mappingAddress >> 8);
+        mcu_packet_tx_put(&ddr64_packet_tx, mappingAddress);
+        mcu_packet_tx_end(&ddr64_packet_tx);
+    }
+
+    mcu_packet_send(&ddr64_packet_tx, COMMAND_ROM_LOADED, NULL, 0);
+}
+
+// Rom load buffers. One is filled from the sd card while the other is written
+// to psram. Static as the task stack is far too small for them.
+#define ROM_LOAD_BUFFER_BYTES (8 * 1024)
+// Write the rom 4 bits per clock, each chip is in quad mode while it is written
+#define ROM_LOAD_QUAD_WRITES 1
+static uint8_t rom_load_buf[2][ROM_LOAD_BUFFER_BYTES] __attribute__((aligned(4)));
+
+static uint32_t rom_load_kBps(uint32_t bytes, uint64_t us) {
+    return us ? (uint32_t)(((uint64_t)bytes * 1000000) / 1024 / us) : 0;
+}
+
+// What each rom chip holds, so selecting the same rom again skips the copy.
+// PSRAM keeps its contents over a console reset but not a power cycle, and so
+// does MCU2's RAM. Chip n holds the n-th 8MB of the file.
+#define ROM_CACHE_CHIPS (MAX_MEMORY_ARRAY_CHIP_INDEX - START_ROM_LOAD_CHIP_INDEX + 1)
+// A block from every MB of a chip is hashed when written and read back before reuse
+#define ROM_CACHE_SAMPLE_STRIDE (1024 * 1024)
+#define ROM_CACHE_SAMPLE_BYTES 512
+#define ROM_CACHE_HASH_SEED 2166136261u
+
+typedef struct {
+    bool valid;
+    char path[256];
+    FSIZE_t size;
+    WORD fdate;
+    WORD ftime;
+    uint32_t sample_hash;
+} rom_cache_chip_t;
+
+static rom_cache_chip_t rom_cache[ROM_CACHE_CHIPS];
+
+// FNV-1a
+static uint32_t rom_cache_hash(uint32_t hash, const uint8_t *data, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t rom_cache_chip_bytes(int index, FSIZE_t size) {
+    FSIZE_t start = (FSIZE_t)index * PSRAM_CHIP_CAPACITY_BYTES;
+    return size - start < PSRAM_CHIP_CAPACITY_BYTES ? (uint32_t)(size - start) : PSRAM_CHIP_CAPACITY_BYTES;
+}
+
+// Needs the async writer set up, the samples are read back over DMA
+static bool rom_cache_chip_is_loaded(int index, const char *path, const FILINFO *info, uint8_t *scratch) {
+    const rom_cache_chip_t *entry = &rom_cache[index];
+    if (!entry->valid || entry->size != info->fsize || entry->fdate != info->fdate ||
+        entry->ftime != info->ftime || strcmp(entry->path, path) != 0) {
+        return false;
+    }
+
+    uint32_t chipBytes = rom_cache_chip_bytes(index, info->fsize);
+    uint32_t hash = ROM_CACHE_HASH_SEED;
+    for (uint32_t offset = 0; offset < chipBytes; offset += ROM_CACHE_SAMPLE_STRIDE) {
+        uint32_t n = chipBytes - offset < ROM_CACHE_SAMPLE_BYTES ? chipBytes - offset : ROM_CACHE_SAMPLE_BYTES;
+        qspi_spi_read_data_dma(offset, scratch, n);
+        hash = rom_cache_hash(hash, scratch, n);
+    }
+    return hash == entry->sample_hash;
+}
+
+// For anything else that writes to the rom chips
+void rom_cache_invalidate() {
+    memset(rom_cache, 0, sizeof(rom_cache));
+}
+
+// Every 64KB block written in a load is CRC'd on its way to PSRAM, then read
+// back once the load is done, so a bad write is reported before mcu1 serves it.
+// Reading back is 1-bit spi, so by default only one block in every
+// ROM_VERIFY_SAMPLE_BLOCKS is checked, a different one each load.
+// 2 checks every block, at about a second per 8MB.
+#define ROM_LOAD_VERIFY 1
+#define ROM_VERIFY_BLOCK_SHIFT 16
+#define ROM_VERIFY_BLOCK_BYTES (1u << ROM_VERIFY_BLOCK_SHIFT)
+#define ROM_VERIFY_BLOCKS (ROM_CACHE_CHIPS * (PSRAM_CHIP_CAPACITY_BYTES >> ROM_VERIFY_BLOCK_SHIFT))
+#if ROM_LOAD_VERIFY == 2
+#define ROM_VERIFY_SAMPLE_BLOCKS 1
+#else
+#define ROM_VERIFY_SAMPLE_BLOCKS 16 // One per MB
+#endif
+
+static uint32_t rom_verify_crc[ROM_VERIFY_BLOCKS];
+static uint32_t rom_verify_round;
+
+// Buffers start on a block or inside the one the last buffer was in
+static void rom_verify_add(uint32_t address, const uint8_t *buf, uint32_t len) {
+    uint32_t block = address >> ROM_VERIFY_BLOCK_SHIFT;
+    if (block < ROM_VERIFY_BLOCKS) {
+        uint32_t crc = (address & (ROM_VERIFY_BLOCK_BYTES - 1)) ? rom_verify_crc[block] : 0;
+        rom_verify_crc[block] = crc32_update(crc, buf, len);
+    }
+}
+
+// Reads the sampled blocks of the chips that were written back in spi mode,
+// the async writer must be set up and out of quad mode. Marks the chips a block
+// failed on and adds the bytes read to *checked.
+static uint32_t rom_verify_blocks(uint32_t romBytes, const bool *chipLoaded, bool *chipBad, uint8_t *scratch,
+    uint32_t *checked) {
+    uint32_t bad = 0;
+    uint32_t sample = rom_verify_round++ % ROM_VERIFY_SAMPLE_BLOCKS;
+    for (uint32_t address = sample * ROM_VERIFY_BLOCK_BYTES; address < romBytes;
+        address += ROM_VERIFY_SAMPLE_BLOCKS * ROM_VERIFY_BLOCK_BYTES) {
+        int chipIndex = PSRAM_ROM_CHIP(address) - START_ROM_LOAD_CHIP_INDEX;
+        if ((address >> ROM_VERIFY_BLOCK_SHIFT) >= ROM_VERIFY_BLOCKS || chipLoaded[chipIndex]) {
+            continue;
+        }
+
+        psram_set_cs(PSRAM_ROM_CHIP(address));
+        uint32_t blockBytes = romBytes - address < ROM_VERIFY_BLOCK_BYTES ? romBytes - address : ROM_VERIFY_BLOCK_BYTES;
+        uint32_t crc = 0;
+        for (uint32_t done = 0; done < blockBytes; done += ROM_LOAD_BUFFER_BYTES) {
+            uint32_t n = blockBytes - done < ROM_LOAD_BUFFER_BYTES ? blockBytes - done : ROM_LOAD_BUFFER_BYTES;
+            qspi_spi_read_data_dma(PSRAM_ROM_OFFSET(address + done), scratch, n);
+            crc = crc32_update(crc, scratch, n);
+        }
+        *checked += blockBytes;
+
+        uint32_t expected = rom_verify_crc[address >> ROM_VERIFY_BLOCK_SHIFT];
+        if (crc != expected) {
+            printf("PSRAM U%d block at 0x%08x reads back with crc %08x, %08x was written\n",
+                PSRAM_ROM_CHIP(address), address, crc, expected);
+            chipBad[chipIndex] = true;
+            bad++;
+        }
+    }
+    return bad;
+}
+
+// Writes the load buffer over and over to the first rom chip, in 1-bit and
+// quad mode, then reads it back. Prints the rate next to what the ssi clock
+// allows without command, address or cs overhead.
+void psram_write_benchmark() {
+    const int chip = START_ROM_LOAD_CHIP_INDEX;
+    const uint32_t rounds = 64; // 512KB per pass
+    const uint32_t bytes = rounds * ROM_LOAD_BUFFER_BYTES;
+    const int clk_divider = 4;
+    uint8_t *src = rom_load_buf[0];
+    uint8_t *dst = rom_load_buf[1];
+
+    for (int i = 0; i < ROM_LOAD_BUFFER_BYTES; i++) {
+        src[i] = (uint8_t)(i * 7 + (i >> 8));
+    }
+
+    uint32_t ssi_kBps = clock_get_hz(clk_sys) / clk_divider / 8 / 1024;
+    printf("PSRAM benchmark, ssi clock %d kHz\n", clock_get_hz(clk_sys) / clk_divider / 1000);
+
+    rom_cache_invalidate();
+    qspi_enable_spi(clk_divider, chip);
+    qspi_spi_write_async_init();
+
+    for (int quad = 0; quad <= 1; quad++) {
+        if (quad) {
+            qspi_quad_write_enter(chip);
+        }
+
+        uint32_t t = time_us_32();
+        for (uint32_t r = 0; r < rounds; r++) {
+            qspi_spi_write_buf_async(r * ROM_LOAD_BUFFER_BYTES, src, ROM_LOAD_BUFFER_BYTES);
+        }
+        qspi_spi_write_wait();
+        t = time_us_32() - t;
+
+        if (quad) {
+            qspi_quad_write_exit();
+        }
+        printf("%s write: %d kB in %d us, %d kB/s of %d kB/s\n", quad ? "Quad" : "SPI",
+            bytes / 1024, t, rom_load_kBps(bytes, t), ssi_kBps * (quad ? 4 : 1));
+
+        uint32_t errors = 0;
+        t = time_us_32();
+        for (uint32_t r = 0; r < rounds; r++) {
+            qspi_spi_read_data_dma(r * ROM_LOAD_BUFFER_BYTES, dst, ROM_LOAD_BUFFER_BYTES);
+            for (int i = 0; i < ROM_LOAD_BUFFER_BYTES; i++) {
+                errors += dst[i] != src[i];
+            }
+        }
+        t = time_us_32() - t;
+        printf("SPI read back: %d kB in %d us, %d kB/s of %d kB/s, %d bad bytes\n",
+            bytes / 1024, t, rom_load_kBps(bytes, t), ssi_kBps, errors);
+
+        // So the quad pass can't pass on the spi pass's data
+        for (int i = 0; i < ROM_LOAD_BUFFER_BYTES; i++) {
+            src[i] ^= 0xFF;
+        }
+    }
+
+    qspi_spi_write_async_deinit();
+    qspi_disable();
+}
+
 void load_new_rom(char* filename) {
     sd_is_busy = true;
-    char buf[512 * 4];
     printf("Mounting sd card...\n");
     sd_card_t *pSD = sd_get_by_num(0);
 	FRESULT fr = f_mount(&pSD->fatfs, pSD->pcName, 1);
@@ -321,20 +677,122 @@ void load_new_rom(char* filename) {
 
     int currentPSRAMChip = START_ROM_LOAD_CHIP_INDEX;
     qspi_enable_spi(4, currentPSRAMChip);
+    qspi_spi_write_async_init();
+
+    // Find the chips that still hold their part of this rom, the rest are
+    // written and their sample hashes worked out as they go
+    bool chipLoaded[ROM_CACHE_CHIPS] = { false };
+    uint32_t chipHash[ROM_CACHE_CHIPS];
+    int romChips = 0;
+    int loadedChips = 0;
+    for (int i = 0; i < ROM_CACHE_CHIPS && (FSIZE_t)i * PSRAM_CHIP_CAPACITY_BYTES < filinfo.fsize; i++) {
+        // MCU1 leaves the chips in quad mode
+        psram_set_cs(START_ROM_LOAD_CHIP_INDEX + i);
+        qspi_quad_write_exit();
+
+        chipLoaded[i] = rom_cache_chip_is_loaded(i, filename, &filinfo, rom_load_buf[0]);
+        rom_cache[i].valid = chipLoaded[i];
+        chipHash[i] = ROM_CACHE_HASH_SEED;
+        loadedChips += chipLoaded[i];
+        romChips++;
+    }
+    printf("%d of %d rom chips already loaded\n", loadedChips, romChips);
+    psram_set_cs(currentPSRAMChip);
+
+    // Blocks are reported to mcu1 as they land, starting with the chips kept
+    uint32_t romReady[PI_ROM_READY_WORDS] = { 0 };
+    for (int i = 0; i < romChips; i++) {
+        if (chipLoaded[i]) {
+            uint32_t start = i * PSRAM_CHIP_CAPACITY_BYTES;
+            rom_ready_mark(romReady, start, start + PSRAM_CHIP_CAPACITY_BYTES);
+        }
+    }
+    ddr64_send_rom_ready(romReady);
+    uint32_t readySent = 0;
+
+#if ROM_LOAD_QUAD_WRITES == 1
+    qspi_quad_write_enter(currentPSRAMChip);
+#endif
 
     printf("Writing to psram...\n");
 	int len = 0;
 	int total = 0;
+    int bufIndex = 0;
+    uint32_t sdReadUs = 0;
+    uint32_t psramWaitUs = 0;
+    uint32_t skipped = 0;
+    rom_byte_order_t byteOrder = ROM_BYTE_ORDER_Z64;
     volatile bool isFirstRead = true;
 	uint64_t t0 = to_us_since_boot(get_absolute_time());
 	do {
-        fr = f_read(&g_file, buf, sizeof(buf), &len);
-        uint32_t addr = total - ((currentPSRAMChip - START_ROM_LOAD_CHIP_INDEX) * PSRAM_CHIP_CAPACITY_BYTES);
+        uint8_t *buf = rom_load_buf[bufIndex];
+        int chipIndex = PSRAM_ROM_CHIP(total) - START_ROM_LOAD_CHIP_INDEX;
+
+        // Skip the rest of a chip that is already loaded. The first chunk is
+        // still read, it has the header the metadata comes from.
+        if (!isFirstRead && chipLoaded[chipIndex]) {
+            len = PSRAM_CHIP_CAPACITY_BYTES - PSRAM_ROM_OFFSET(total);
+            if (len > filinfo.fsize - total) {
+                len = filinfo.fsize - total;
+            }
+            total += len;
+            skipped += len;
+            f_lseek(&g_file, total);
+            continue;
+        }
 
-        // Write data to the psram chips
-        qspi_spi_write_buf(addr, buf, len);
+        uint32_t t = time_us_32();
+        fr = f_read(&g_file, buf, ROM_LOAD_BUFFER_BYTES, &len);
+        sdReadUs += time_us_32() - t;
+
+        // .v64 and .n64 dumps are turned into .z64 order on the way through
+        if (isFirstRead && len >= 4) {
+            byteOrder = rom_detect_byte_order(buf);
+            printf("Rom byte order: %s\n", rom_byte_order_name(byteOrder));
+        }
+        rom_convert_to_z64(byteOrder, buf, len);
+
+        // The previous buffer must be out before the chip select can change
+        t = time_us_32();
+        qspi_spi_write_wait();
+        psramWaitUs += time_us_32() - t;
+
+        // Everything before this buffer is in PSRAM now
+        if ((total >> PI_ROM_READY_BLOCK_SHIFT) > readySent) {
+            readySent = total >> PI_ROM_READY_BLOCK_SHIFT;
+            rom_ready_mark(romReady, 0, total);
+            ddr64_send_rom_ready(romReady);
+        }
+
+        if (len > 0 && !chipLoaded[chipIndex]) {
+            int newChip = PSRAM_ROM_CHIP(total);
+            if (newChip != currentPSRAMChip && newChip <= MAX_MEMORY_ARRAY_CHIP_INDEX) {
+                printf("Changing memory array chip. Was: %d, now: %d\n", currentPSRAMChip, newChip);
+                printf("Total bytes: %d. Bytes remaining = %ld\n", total, (filinfo.fsize - total));
+                currentPSRAMChip = newChip;
+#if ROM_LOAD_QUAD_WRITES == 1
+                qspi_quad_write_exit();
+                qspi_quad_write_enter(currentPSRAMChip);
+#else
+                psram_set_cs(currentPSRAMChip); // Switch the PSRAM chip
+#endif
+            }
+
+            // Buffers start on a sample block, the stride is a multiple of their size
+            if (PSRAM_ROM_OFFSET(total) % ROM_CACHE_SAMPLE_STRIDE == 0) {
+                uint32_t n = len < ROM_CACHE_SAMPLE_BYTES ? len : ROM_CACHE_SAMPLE_BYTES;
+                chipHash[chipIndex] = rom_cache_hash(chipHash[chipIndex], buf, n);
+            }
+
+            // Write data to the psram chips while the next buffer is read
+            qspi_spi_write_buf_async(PSRAM_ROM_OFFSET(total), buf, len);
+#if ROM_LOAD_VERIFY >= 1
+            rom_verify_add(total, buf, len);
+#endif
+        }
 
         total += len;
+        bufIndex ^= 1;
 
         // Once we have read the first chunk of bytes this includes the rom header
         // With this info we can lookup save and cic info for this rom!
@@ -345,28 +803,58 @@ void load_new_rom(char* filename) {
             fr = f_close(&g_file);
 
             printf("Finding rom info...\n");
-            extract_metadata_and_send_save_info(buf, &g_file);
+            extract_metadata_and_send_save_info((char *)buf, &g_file);
             printf("Resuming rom load...\n");
 
             fr = f_open(&g_file, filename, FA_OPEN_EXISTING | FA_READ);
             f_lseek(&g_file, len);
         }
+	} while (len > 0);
 
-        int newChip = psram_addr_to_chip(total);
-        if (newChip != currentPSRAMChip && newChip <= MAX_MEMORY_ARRAY_CHIP_INDEX) {
-            printf("Changing memory array chip. Was: %d, now: %d\n", currentPSRAMChip, newChip);
-            printf("Total bytes: %d. Bytes remaining = %ld\n", total, (filinfo.fsize - total));
-            currentPSRAMChip = newChip;
-            psram_set_cs(currentPSRAMChip); // Switch the PSRAM chip
+    bool chipBad[ROM_CACHE_CHIPS] = { false };
+    uint32_t verifyUs = 0;
+#if ROM_LOAD_VERIFY >= 1
+    verifyUs = time_us_32();
+#if ROM_LOAD_QUAD_WRITES == 1
+    qspi_quad_write_exit();
+#endif
+    uint32_t verified = 0;
+    uint32_t badBlocks = rom_verify_blocks(total, chipLoaded, chipBad, rom_load_buf[0], &verified);
+    verifyUs = time_us_32() - verifyUs;
+    printf("Verified %d of %d kB of PSRAM, %d bad 64kB blocks\n", verified / 1024, (total - skipped) / 1024, badBlocks);
+#endif
+
+    qspi_spi_write_async_deinit();
+
+    // The last block can be a partial one
+    rom_ready_mark(romReady, 0, total + (1u << PI_ROM_READY_BLOCK_SHIFT) - 1);
+    ddr64_send_rom_ready(romReady);
+
+    // Only a complete load is worth remembering, a chip that failed its check
+    // is written again next time
+    if (total == filinfo.fsize) {
+        for (int i = 0; i < romChips; i++) {
+            if (!chipLoaded[i] && !chipBad[i]) {
+                rom_cache_chip_t *entry = &rom_cache[i];
+                entry->valid = true;
+                snprintf(entry->path, sizeof(entry->path), "%s", filename);
+                entry->size = filinfo.fsize;
+                entry->fdate = filinfo.fdate;
+                entry->ftime = filinfo.ftime;
+                entry->sample_hash = chipHash[i];
+            }
         }
-
-	} while (len > 0);
+    }
 
 	uint64_t t1 = to_us_since_boot(get_absolute_time());
 	uint32_t delta = (t1 - t0) / 1000;
-	uint32_t kBps = (uint32_t) ((float)(total / 1024.0f) / (float)(delta / 1000.0f));
 
-	printf("Read %d bytes and programmed PSRAM in %d ms (%d kB/s)\n\n\n", total, delta, kBps);
+	printf("Read %d bytes and programmed PSRAM in %d ms (%d kB/s), %d bytes were already loaded\n",
+        total - skipped, delta, rom_load_kBps(total - skipped, t1 - t0), skipped);
+	printf("SD read: %d ms (%d kB/s), PSRAM write: %d ms (%d kB/s), waited on PSRAM: %d ms, verify: %d ms\n\n\n",
+        sdReadUs / 1000, rom_load_kBps(total - skipped, sdReadUs),
+        qspi_write_busy_us / 1000, rom_load_kBps(total - skipped, qspi_write_busy_us),
+        psramWaitUs / 1000, verifyUs / 1000);
 
 	fr = f_close(&g_file);
 	if (FR_OK != fr) {
@@ -403,34 +891,306 @@ void load_new_rom(char* filename) {
     printf("Rom Loaded, MCU2 qspi: OFF, sending mcu1 rom loaded command\n");
 
     // Let MCU1 know that we are finished
-    uart_tx_program_putc(COMMAND_START);
-    uart_tx_program_putc(COMMAND_START2);
-    uart_tx_program_putc(COMMAND_ROM_LOADED);
-    // Zero bytes to read!
-    uart_tx_program_putc(0x00);
-    uart_tx_program_putc(0x00);
+    send_rom_loaded(false, 0);
 
     // TODO/OFI
     // Send mcu1 the size of the loaded rom
     // and any other relevant metadata
 }
 
+// Rom library in the NOR flash array, see flash_array.h
+#define FLASH_ARRAY_MAPPING_PAGE_ENTRIES (FLASH_ARRAY_PAGE_BYTES / sizeof(uint16_t))
+static flash_array_dedup_t flash_array_dedup;
+static flash_library_t flash_library;
+static uint16_t flash_array_mapping_page[FLASH_ARRAY_MAPPING_PAGE_ENTRIES];
+// Next free chunk in the block the rom being programmed fills
+static uint32_t flash_library_next_chunk;
+
+static void flash_array_select(uint32_t address) {
+    psram_set_cs(FLASH_ARRAY_CHIP(address));
+}
+
+static void flash_array_read(uint32_t address, uint8_t *data, uint32_t len) {
+    flash_array_select(address);
+    qspi_spi_read_data(FLASH_ARRAY_OFFSET(address), data, len);
+}
+
+static void flash_array_program(uint32_t address, const uint8_t *data, uint32_t len) {
+    flash_array_select(address);
+    qspi_flash_program(FLASH_ARRAY_OFFSET(address), data, len);
+}
+
+static bool flash_array_chunk_matches(uint16_t chunk, const uint8_t *data, uint8_t *scratch) {
+    flash_array_read(FLASH_ARRAY_CHUNK_ADDRESS(chunk), scratch, FLASH_ARRAY_CHUNK_BYTES);
+    return memcmp(scratch, data, FLASH_ARRAY_CHUNK_BYTES) == 0;
+}
+
+// Mapping entries are programmed a page at a time
+static void flash_array_map(uint32_t mappingAddress, uint32_t entry, uint16_t chunk) {
+    flash_array_mapping_page[entry % FLASH_ARRAY_MAPPING_PAGE_ENTRIES] = chunk;
+    if (entry % FLASH_ARRAY_MAPPING_PAGE_ENTRIES == FLASH_ARRAY_MAPPING_PAGE_ENTRIES - 1 || entry == MAPPING_TABLE_LEN - 1) {
+        uint32_t first = entry - entry % FLASH_ARRAY_MAPPING_PAGE_ENTRIES;
+        flash_array_program(mappingAddress + first * sizeof(uint16_t), (const uint8_t *)flash_array_mapping_page,
+            (entry - first + 1) * sizeof(uint16_t));
+    }
+}
+
+// Erases the least worn free block for the entry, returns its first chunk
+static uint32_t flash_library_erase_block(int entry) {
+    // flash_library_make_room leaves enough blocks for the whole rom
+    int block = flash_library_alloc_block(&flash_library, entry);
+    uint32_t address = FLASH_ARRAY_BLOCK_ADDRESS(block);
+    flash_array_select(address);
+    qspi_flash_erase_block(FLASH_ARRAY_OFFSET(address));
+    return block * FLASH_ARRAY_CHUNKS_PER_BLOCK;
+}
+
+static uint16_t flash_library_take_chunk(int entry) {
+    if (flash_library_next_chunk % FLASH_ARRAY_CHUNKS_PER_BLOCK == 0) {
+        flash_library_next_chunk = flash_library_erase_block(entry);
+    }
+    return flash_library_next_chunk++;
+}
+
+// Reads the current library table, or starts an empty one
+static void flash_library_read() {
+    flash_library_t *other = (flash_library_t *)rom_load_buf[1];
+    flash_array_read(FLASH_LIBRARY_TABLE_ADDRESS(0), (uint8_t *)&flash_library, sizeof(flash_library_t));
+    flash_array_read(FLASH_LIBRARY_TABLE_ADDRESS(1), (uint8_t *)other, sizeof(flash_library_t));
+
+    const flash_library_t *newest = flash_library_newest(&flash_library, other);
+    if (newest == NULL) {
+        printf("No rom library in the flash array, starting one\n");
+        flash_library_init(&flash_library);
+    } else if (newest == other) {
+        memcpy(&flash_library, other, sizeof(flash_library_t));
+    }
+}
+
+// Written over the older copy, the current one stays until this one is whole
+static void flash_library_write() {
+    uint32_t address = FLASH_LIBRARY_TABLE_ADDRESS(flash_library_seal(&flash_library));
+    flash_array_select(address);
+    qspi_flash_erase_sector(FLASH_ARRAY_OFFSET(address));
+    flash_array_program(address, (const uint8_t *)&flash_library, sizeof(flash_library_t));
+}
+
+// Programs the rom into the library in 1KB chunks, each unique chunk once.
+// Room for every chunk is found first, so the oldest unpinned roms are evicted
+// and the table written before anything is erased. With sendRomInfo the save
+// and cic info goes to mcu1 after the first read, like a psram load. Returns
+// the entry, or FLASH_LIBRARY_NO_ENTRY if the rom doesn't fit or can't be read.
+static int flash_library_program(char* filename, const FILINFO *filinfo, uint16_t flags, bool sendRomInfo) {
+    if (filinfo->fsize > FLASH_ARRAY_MAX_ROM_BYTES || strlen(filename) >= FLASH_LIBRARY_PATH_LENGTH) {
+        printf("%s [size=%llu] can't go in the flash array\n", filinfo->fname, filinfo->fsize);
+        return FLASH_LIBRARY_NO_ENTRY;
+    }
+    int entry = flash_library_make_room(&flash_library, FLASH_ARRAY_ROM_BLOCKS(filinfo->fsize));
+    if (entry == FLASH_LIBRARY_NO_ENTRY) {
+        printf("No room for %s in the flash array, pinned roms fill it\n", filinfo->fname);
+        return FLASH_LIBRARY_NO_ENTRY;
+    }
+
+    // The evicted roms leave the table before their blocks are erased
+    flash_library_write();
+
+	FRESULT fr = f_open(&g_file, filename, FA_OPEN_EXISTING | FA_READ);
+	if (FR_OK != fr) {
+		panic("f_open(%s) error: %s (%d)\n", filename, FRESULT_str(fr), fr);
+	}
+
+    for (int chip = FLASH_CHIP_INDEX; chip < FLASH_CHIP_INDEX + FLASH_ARRAY_CHIPS; chip++) {
+        psram_set_cs(chip);
+        qspi_flash_enable_quad();
+    }
+
+    // The mapping table starts the rom's first block
+    uint32_t firstChunk = flash_library_erase_block(entry);
+    uint32_t mappingAddress = FLASH_ARRAY_CHUNK_ADDRESS(firstChunk);
+    flash_library_next_chunk = firstChunk + FLASH_ARRAY_MAPPING_CHUNKS;
+    flash_array_dedup_reset(&flash_array_dedup);
+
+    printf("Programming %s into the flash array...\n", filinfo->fname);
+    uint8_t *buf = rom_load_buf[0];
+    uint8_t *scratch = rom_load_buf[1];
+    rom_byte_order_t byteOrder = ROM_BYTE_ORDER_Z64;
+    uint32_t chunks = 0;
+    uint32_t uniqueChunks = 0;
+    int len = 0;
+    int total = 0;
+    bool isFirstRead = true;
+	uint64_t t0 = to_us_since_boot(get_absolute_time());
+    do {
+        fr = f_read(&g_file, buf, ROM_LOAD_BUFFER_BYTES, &len);
+
+        if (isFirstRead && len >= 4) {
+            byteOrder = rom_detect_byte_order(buf);
+            printf("Rom byte order: %s\n", rom_byte_order_name(byteOrder));
+        }
+        rom_convert_to_z64(byteOrder, buf, len);
+
+        // Pad the last chunk like erased flash
+        if (len % FLASH_ARRAY_CHUNK_BYTES) {
+            memset(buf + len, 0xFF, FLASH_ARRAY_CHUNK_BYTES - len % FLASH_ARRAY_CHUNK_BYTES);
+        }
+
+        for (int offset = 0; offset < len; offset += FLASH_ARRAY_CHUNK_BYTES) {
+            const uint8_t *chunk = buf + offset;
+            uint32_t hash = flash_array_chunk_hash(chunk);
+            uint16_t index = flash_array_dedup_lookup(&flash_array_dedup, hash);
+            if (index == FLASH_ARRAY_NO_CHUNK || !flash_array_chunk_matches(index, chunk, scratch)) {
+                index = flash_library_take_chunk(entry);
+                uniqueChunks++;
+                flash_array_program(FLASH_ARRAY_CHUNK_ADDRESS(index), chunk, FLASH_ARRAY_CHUNK_BYTES);
+                flash_array_dedup_insert(&flash_array_dedup, hash, index);
+            }
+            flash_array_map(mappingAddress, chunks++, index);
+        }
+        total += len;
+
+        // The first chunk has the rom header, look up the save and cic info
+        // and load any saved eeprom to mcu1
+        if (isFirstRead && sendRomInfo) {
+            fr = f_close(&g_file);
+
+            printf("Finding rom info...\n");
+            extract_metadata_and_send_save_info((char *)buf, &g_file);
+
+            printf("Resuming rom load...\n");
+            fr = f_open(&g_file, filename, FA_OPEN_EXISTING | FA_READ);
+            f_lseek(&g_file, len);
+        }
+        isFirstRead = false;
+    } while (FR_OK == fr && len > 0);
+
+    FRESULT readResult = fr;
+    fr = f_close(&g_file);
+    if (FR_OK != fr) {
+        printf("f_close error: %s (%d)\n", FRESULT_str(fr), fr);
+    }
+
+    // A partial rom stays out of the table, its blocks are free again
+    if (FR_OK != readResult || total != filinfo->fsize) {
+        printf("f_read(%s) error: %s (%d), read %d of %llu bytes\n", filename,
+            FRESULT_str(readResult), readResult, total, filinfo->fsize);
+        flash_library_remove(&flash_library, entry);
+        return FLASH_LIBRARY_NO_ENTRY;
+    }
+
+    // Past the end of the rom maps to its first chunk, mcu1 reads the whole table
+    while (chunks < MAPPING_TABLE_LEN) {
+        flash_array_map(mappingAddress, chunks++, firstChunk + FLASH_ARRAY_MAPPING_CHUNKS);
+    }
+
+    // The table goes in last, a rom that doesn't finish isn't in it
+    flash_library_entry_t *e = &flash_library.entries[entry];
+    snprintf(e->path, sizeof(e->path), "%s", filename);
+    e->size = filinfo->fsize;
+    e->fdate = filinfo->fdate;
+    e->ftime = filinfo->ftime;
+    e->mapping_address = mappingAddress;
+    e->added = flash_library.sequence + 1;
+    e->unique_chunks = uniqueChunks;
+    e->flags = flags;
+    flash_library_write();
+
+    uint64_t t1 = to_us_since_boot(get_absolute_time());
+    printf("Programmed %d of %d chunks (%d kB) into the flash array in %d ms, %d free blocks left\n",
+        uniqueChunks, (total + FLASH_ARRAY_CHUNK_BYTES - 1) / FLASH_ARRAY_CHUNK_BYTES,
+        uniqueChunks * FLASH_ARRAY_CHUNK_BYTES / 1024, (uint32_t)((t1 - t0) / 1000),
+        flash_library_free_blocks(&flash_library));
+    return entry;
+}
+
+static bool flash_library_stat(char* filename, FILINFO *filinfo) {
+    sd_card_t *pSD = sd_get_by_num(0);
+	FRESULT fr = f_mount(&pSD->fatfs, pSD->pcName, 1);
+	if (FR_OK != fr) {
+		panic("f_mount error: %s (%d)\n", FRESULT_str(fr), fr);
+	}
+
+	fr = f_stat(filename, filinfo);
+	if (FR_OK != fr) {
+		printf("f_stat(%s) error: %s (%d)\n", filename, FRESULT_str(fr), fr);
+        return false;
+	}
+    return true;
+}
+
+// Serves the rom from the flash array if it is in the library. Otherwise, with
+// ERASE_AND_WRITE_TO_FLASH_ARRAY, it is programmed into the library unpinned.
+// Returns false if the rom goes to PSRAM instead.
+bool load_rom_from_flash_library(char* filename) {
+    sd_is_busy = true;
+    FILINFO filinfo;
+    if (!flash_library_stat(filename, &filinfo)) {
+        return false;
+    }
+
+    qspi_enable_spi(4, FLASH_CHIP_INDEX);
+    flash_library_read();
+
+    int entry = flash_library_find(&flash_library, filename, filinfo.fsize, filinfo.fdate, filinfo.ftime);
+    if (entry != FLASH_LIBRARY_NO_ENTRY) {
+        flash_library_entry_t *e = &flash_library.entries[entry];
+        printf("%s is in the flash array%s, %d unique chunks\n", filinfo.fname,
+            e->flags & FLASH_LIBRARY_PINNED ? " pinned" : "", e->unique_chunks);
+
+        // The rom header is in the first chunk
+        uint16_t firstChunk;
+        uint8_t *buf = rom_load_buf[0];
+        flash_array_read(e->mapping_address, (uint8_t *)&firstChunk, sizeof(firstChunk));
+        flash_array_read(FLASH_ARRAY_CHUNK_ADDRESS(firstChunk), buf, FLASH_ARRAY_CHUNK_BYTES);
+        printf("Finding rom info...\n");
+        extract_metadata_and_send_save_info((char *)buf, &g_file);
+    } else {
+#if ERASE_AND_WRITE_TO_FLASH_ARRAY == 1
+        entry = flash_library_program(filename, &filinfo, 0, true);
+#endif
+    }
+
+    uint32_t mappingAddress = entry != FLASH_LIBRARY_NO_ENTRY ? flash_library.entries[entry].mapping_address : 0;
+
+    // Now turn off the ssi hardware so mcu1 can use it, or psram can be loaded
+    qspi_disable();
+
+    if (entry == FLASH_LIBRARY_NO_ENTRY) {
+        return false;
+    }
+
+    printf("Rom in the flash array, MCU2 qspi: OFF, sending mcu1 rom loaded command\n");
+    send_rom_loaded(true, mappingAddress);
+    return true;
+}
+
+// Pins the rom in pin_rom_title so it is never evicted, programming it into
+// the library if it isn't there yet. A pinned rom is unpinned instead, it
+// stays in the library until the space is needed.
+void pin_selected_rom() {
+    printf("Pin '%s'...\n", pin_rom_title);
+    FILINFO filinfo;
+    if (flash_library_stat(pin_rom_title, &filinfo)) {
+        qspi_enable_spi(4, FLASH_CHIP_INDEX);
+        flash_library_read();
+
+        int entry = flash_library_find(&flash_library, pin_rom_title, filinfo.fsize, filinfo.fdate, filinfo.ftime);
+        if (entry == FLASH_LIBRARY_NO_ENTRY) {
+            entry = flash_library_program(pin_rom_title, &filinfo, FLASH_LIBRARY_PINNED, false);
+            printf("%s %s\n", filinfo.fname, entry != FLASH_LIBRARY_NO_ENTRY ? "pinned" : "not pinned");
+        } else {
+            flash_library.entries[entry].flags ^= FLASH_LIBRARY_PINNED;
+            flash_library_write();
+            printf("%s %s\n", filinfo.fname, flash_library.entries[entry].flags & FLASH_LIBRARY_PINNED ? "pinned" : "unpinned");
+        }
+
+        qspi_disable();
+    }
+
+    // Let MCU1 take the bus back
+    mcu_packet_send(&ddr64_packet_tx, COMMAND_ROM_PINNED, NULL, 0);
+}
+
 // MCU listens for other MCU commands and will respond accordingly
-int startIndex = 0;
-bool mayHaveStart = false;
-bool mayHaveFinish = false;
-bool receivingData = false;
-bool isReadingCommandHeader = false;
-uint8_t command_headerBufferIndex = 0;
-uint16_t command_numBytesToRead = 0;
-bool command_processBuffer = false;
-
-#define COMMAND_HEADER_LENGTH 3
-//COMMAND, NUM_BYTES_HIGH, NUM_BYTES_LOW
-uint8_t commandHeaderBuffer[COMMAND_HEADER_LENGTH];
-
-unsigned char mcu2_cmd_buffer[64]; // TODO rename
-int echoIndex = 0;
 void mcu1_process_rx_buffer() {
     while (rx_uart_buffer_has_data()) {
         uint8_t value = rx_uart_buffer_get();
@@ -439,99 +1199,83 @@ void mcu1_process_rx_buffer() {
         uart_tx_program_putc(value);
         #endif
 
-        if (romLoading) {
-            if (receivingData) {
-                // Special case to send bytes directly into the eeprom array
-                if (commandHeaderBuffer[0] == COMMAND_LOAD_BACKUP_EEPROM) {
-                    eeprom[bufferIndex] = value;
-
-                // Special case to send bytes directly into the sram array
-                } else if (commandHeaderBuffer[0] == COMMAND_LOAD_SRAM_BACKUP) {
-                    ((uint8_t*)(sram))[bufferIndex] = value;
-
-                // Use the regular buffer
-                } else {
-                    ((uint8_t*)(ddr64_uart_tx_buf))[bufferIndex] = value;
-                }
-
-                bufferIndex++;
-                if (bufferIndex >= command_numBytesToRead) {
-                    command_processBuffer = true;
-                    bufferIndex = 0;
-                }
-
-            } else if (isReadingCommandHeader) {
-                commandHeaderBuffer[command_headerBufferIndex++] = value;
+        if (mcu_packet_rx_feed(&mcu1_packet_rx, value) != MCU_PACKET_READY) {
+            continue;
+        }
 
-                if (command_headerBufferIndex >= COMMAND_HEADER_LENGTH) {
-                    command_numBytesToRead = (commandHeaderBuffer[1] << 8) | commandHeaderBuffer[2];
-                    isReadingCommandHeader = false;
-                    command_headerBufferIndex = 0;
+        // process what was sent
+        uint8_t* buffer = mcu1_packet_rx.payload;
+        uint8_t command = mcu1_packet_rx.cmd;
 
-                    // Special case for num bytes to read 0, skip right to processing command
-                    if (command_numBytesToRead == 0) {
-                        command_processBuffer = true;
-                        bufferIndex = 0;
-                    } else {
-                        receivingData = true;
-                    }
-                }
-            } else if (value == COMMAND_START && !receivingData) {
-                mayHaveStart = true;
-            } else if (value == COMMAND_START2 && mayHaveStart && !receivingData) {
-                isReadingCommandHeader = true;
+        if (command == COMMAND_SD_DATA) {
+            // A retry can leave the answer to an older read behind, only take the sectors asked for
+            if (!sd_read_pending || mcu1_packet_rx.len != SD_DATA_LENGTH(sd_read_count) ||
+                memcmp(buffer, sd_read_sector, SD_READ_SECTOR_BYTES) != 0) {
+                continue;
             }
 
-            if (command_processBuffer) {
-                command_processBuffer = false;
-                // process what was sent
-                uint8_t* buffer = (uint8_t*)ddr64_uart_tx_buf; // cast to char array
-                char command = commandHeaderBuffer[0];
+            // Combine two char values into a 16 bit value, the sectors one after another
+            const uint8_t *sector = buffer + SD_READ_SECTOR_BYTES;
+            for (uint32_t i = 0; i < sd_read_count * SD_CARD_SECTOR_SIZE / 2; i++) {
+                ddr64_uart_tx_buf[i] = (sector[i * 2] << 8) | sector[i * 2 + 1];
+            }
+            sd_read_pending = false;
+            sendDataReady = true;
+            break;
 
-                if (command == COMMAND_SET_EEPROM_TYPE) {
-                    eeprom_type = (buffer[0] << 8 | buffer[1]);
+        } else if (command == COMMAND_SET_EEPROM_TYPE) {
+            eeprom_type = (buffer[0] << 8 | buffer[1]);
 
-                } else if (command == COMMAND_LOAD_BACKUP_EEPROM) {
-                    // Already pushed these bits into the eeprom array
+        } else if (command == COMMAND_LOAD_BACKUP_EEPROM) {
+            // Only copied once the crc is checked, sized to fit the 16K eeprom
+            memcpy((void*)eeprom, buffer, mcu1_packet_rx.len <= 2048 ? mcu1_packet_rx.len : 2048);
 
-                } else if (command == COMMAND_ROM_LOADED) {
-                    romLoading = false; // signal that the rom is finished loading
-                    sendDataReady = true;
-                }
+        } else if (command == COMMAND_LOAD_SRAM_BACKUP) {
+            sram_backup_len = mcu1_packet_rx.len;
 
-                // Reset state and empty the command header buffer
-                commandHeaderBuffer[0] = 0;
-                commandHeaderBuffer[1] = 0;
-                commandHeaderBuffer[2] = 0;
-                bufferIndex = 0;
-                mayHaveFinish = false;
-                mayHaveStart = false;
-                receivingData = false;
-            }
-        } else {
-            // Combine two char values into a 16 bit value
-            // Only increment bufferIndex when adding a value
-            // else, store the ch into the holding field
-            if (bufferByteIndex % 2 == 1) {
-                uint16_t value16 = lastBufferValue << 8 | value;
-                ddr64_uart_tx_buf[bufferIndex] = value16;
-                bufferIndex += 1;
-            } else {
-                lastBufferValue = value;
+        } else if (command == COMMAND_SET_PI_CALIBRATION) {
+            // Ignore it if it was found at another clock
+            uint32_t sys_khz = (buffer[4] << 24) | (buffer[5] << 16) | (buffer[6] << 8) | buffer[7];
+            if (sys_khz == clock_get_hz(clk_sys) / 1000) {
+                pi_timing_calibrated = (buffer[0] << 8) | buffer[1];
+                // Used once qspi is enabled again after the load
+                qspi_rx_sample_dly = (buffer[2] << 8) | buffer[3];
             }
 
-            bufferByteIndex++;
-
-            if (bufferByteIndex >= SD_CARD_SECTOR_SIZE) {
-                sendDataReady = true;
-                break;
+        } else if (command == COMMAND_ROM_READY) {
+            for (int i = 0; i < PI_ROM_READY_WORDS; i++) {
+                pi_rom_ready[i] = (buffer[i * 4] << 24) | (buffer[i * 4 + 1] << 16) | (buffer[i * 4 + 2] << 8) | buffer[i * 4 + 3];
             }
+            g_romReadyCheck = true;
+
+        } else if (command == COMMAND_ROM_IN_FLASH_ARRAY) {
+            g_flashArrayMappingAddress = (buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8) | buffer[3];
+            g_romFromFlashArray = true;
 
-            if (bufferByteIndex >= 512) {
-                sendDataReady = true;
+        } else if (command == COMMAND_ROM_LOADED || command == COMMAND_ROM_PINNED) {
+            if (sram_backup_len) {
+                // Big endian in the file, like the N64 sees it
+                for (uint32_t i = 0; i < sram_backup_len / 2; i++) {
+                    sram[i] = (sram_backup_rx_buf[i * 2] << 8) | sram_backup_rx_buf[i * 2 + 1];
+                }
+                free(sram_backup_rx_buf);
+                sram_backup_rx_buf = NULL;
+                sram_backup_len = 0;
             }
+            romLoading = false; // signal that the rom is finished loading
+            sendDataReady = true;
         }
     }
+
+    // The sector was damaged, or it or the request for it was lost
+    if (sd_read_pending && time_us_32() - sd_read_sent_us > SD_READ_RETRY_US) {
+        sd_read_retries++;
+        // Drop any part packet, the answer may still be coming in but a
+        // damaged length could hold the parser past the retried one
+        mcu_packet_rx_reset(&mcu1_packet_rx);
+        rx_uart_buffer_reset();
+        ddr64_send_sd_read_command();
+    }
 }
 
 void mcu2_process_rx_buffer() {
@@ -542,116 +1286,87 @@ void mcu2_process_rx_buffer() {
         printf("%02x ", ch);
         #endif
 
-        if (receivingData) {
-            if(ddr64_useDynamicBuffer) {
-                ddr64_dynamic_large_buffer[bufferIndex] = ch;
-            } else {
-                ((uint8_t*)(ddr64_uart_tx_buf))[bufferIndex] = ch;
-            }
+        int result = mcu_packet_rx_feed(&mcu2_packet_rx, ch);
+        if (result == MCU_PACKET_BAD) {
+            // mcu1 asks for sectors again, anything else is lost
+            printf("\nBad packet from mcu1, %u bad and %u missed so far, %u bytes overflowed\n",
+                mcu2_packet_rx.bad, mcu2_packet_rx.missed, rx_uart_buffer_overflow_bytes());
+        }
+        if (result != MCU_PACKET_READY) {
+            continue;
+        }
 
-            bufferIndex++;
+        // process what was sent
+        uint8_t* buffer = mcu2_packet_rx.payload;
+        uint8_t command = mcu2_packet_rx.cmd;
+        uint16_t length = mcu2_packet_rx.len;
+
+        if (command == COMMAND_SD_READ) {
+            uint32_t sector_front =(buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8) | buffer[3];
+            uint32_t sector_back = (buffer[4] << 24) | (buffer[5] << 16) | (buffer[6] << 8) | buffer[7];
+            volatile uint32_t sectorCount = (buffer[8] << 24) | (buffer[9] << 16) | (buffer[10] << 8) | buffer[11];
+            sectorToSendRegisters[0] = sector_front;
+            sectorToSendRegisters[1] = sector_back;
+            numSectorsToSend = sectorCount;
+            sendDataReady = true;
+
+        } else if (command == COMMAND_LOAD_ROM) {
+            uint16_t len = length;
+            if (len >= sizeof(sd_selected_rom_title)) {
+                len = sizeof(sd_selected_rom_title) - 1;
+            }
+            memcpy(sd_selected_rom_title, buffer, len);
+            sd_selected_rom_title[len] = '\0';
+            startRomLoad = true;
+            #if DEBUG_MCU2_PRINT == 1
+            printf("nbtr: %u\n", length);
+            #endif
 
-            if (bufferIndex >= command_numBytesToRead) {
-                command_processBuffer = true;
-                bufferIndex = 0;
+        } else if (command == COMMAND_PIN_ROM) {
+            uint16_t len = length;
+            if (len >= sizeof(pin_rom_title)) {
+                len = sizeof(pin_rom_title) - 1;
             }
-        } else if (isReadingCommandHeader) {
-            commandHeaderBuffer[command_headerBufferIndex++] = ch;
+            memcpy(pin_rom_title, buffer, len);
+            pin_rom_title[len] = '\0';
+            start_pinRom = true;
+
+        } else if (command == COMMAND_BACKUP_EEPROM) {
+            save_data_numBytesToBackup = length;
+            start_saveEeepromData = true;
+            #if DEBUG_MCU2_PRINT == 1
+            printf("eeprom nbtr: %u\n", length);
+            #endif
 
-            if (command_headerBufferIndex >= COMMAND_HEADER_LENGTH) {
-                command_numBytesToRead = (commandHeaderBuffer[1] << 8) | commandHeaderBuffer[2];
+        } else if (command == COMMAND_VERIFY_ROM_DATA) {
+            is_verifying_rom_data_from_mcu1 = true;
 
-                // TODO just use the dynamic buffer for everything?
-                // If we are reading large data, use the dynamic buffer
-                if (command_numBytesToRead > sizeof(ddr64_uart_tx_buf)) {
-                    if (ddr64_dynamic_large_buffer == 0) {
-                        free((void*)ddr64_dynamic_large_buffer);
-                    }
-                    ddr64_useDynamicBuffer = true;
-                    ddr64_dynamic_large_buffer = malloc(command_numBytesToRead+1);
-                } else {
-                    ddr64_useDynamicBuffer = false;
-                }
+        } else if (command == COMMAND_SET_ROM_META_INFO) {
+            printf("%02x %02x %02x %02x\n", buffer[0], buffer[1], buffer[2], buffer[3]);
+            selected_rom_metadata_register = (buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8) | (buffer[3]);
 
-                isReadingCommandHeader = false;
-                receivingData = true;
-                command_headerBufferIndex = 0;
-            }
+        } else if (command == COMMAND_BACKUP_SRAM) {
+            save_data_numBytesToBackup = length;
+            start_saveSramData = true;
 
-            #if MCU2_PRINT_UART == 1
-            printf("\n");
-            #endif
-
-        } else if (ch == COMMAND_START && !receivingData) {
-            mayHaveStart = true;
-        } else if (ch == COMMAND_START2 && mayHaveStart && !receivingData) {
-            isReadingCommandHeader = true;
-        }
+        } else if (command == COMMAND_SAVE_PI_CALIBRATION) {
+            memcpy(pi_calibration, buffer, PI_CALIBRATION_LENGTH);
+            start_savePiCalibration = true;
 
-        if (command_processBuffer) {
-            command_processBuffer = false;
-            // process what was sent
-            uint8_t* buffer = (uint8_t*)ddr64_uart_tx_buf; // cast to char array
-            char command = commandHeaderBuffer[0];
-
-            if (command == COMMAND_SD_READ) {
-                uint32_t sector_front =(buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8) | buffer[3];
-                uint32_t sector_back = (buffer[4] << 24) | (buffer[5] << 16) | (buffer[6] << 8) | buffer[7];
-                volatile uint32_t sectorCount = (buffer[8] << 24) | (buffer[9] << 16) | (buffer[10] << 8) | buffer[11];
-                sectorToSendRegisters[0] = sector_front;
-                sectorToSendRegisters[1] = sector_back;
-                numSectorsToSend = 1;
-                sendDataReady = true;
-
-            } else if (command == COMMAND_LOAD_ROM) {
-                sprintf(sd_selected_rom_title, "%s", buffer);
-                startRomLoad = true;
-                #if DEBUG_MCU2_PRINT == 1
-                printf("nbtr: %u\n", command_numBytesToRead);
-                #endif
-
-            } else if (command == COMMAND_BACKUP_EEPROM) {
-                save_data_numBytesToBackup = command_numBytesToRead;
-                start_saveEeepromData = true;
-                #if DEBUG_MCU2_PRINT == 1
-                printf("eeprom nbtr: %u\n", command_numBytesToRead);
-                #endif
-
-            } else if (command == COMMAND_VERIFY_ROM_DATA) {
-                is_verifying_rom_data_from_mcu1 = true;
-
-            } else if (command == COMMAND_SET_ROM_META_INFO) {
-                printf("%02x %02x %02x %02x\n", buffer[0], buffer[1], buffer[2], buffer[3]);
-                selected_rom_metadata_register = (buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8) | (buffer[3]);
-
-            } else if (command == COMMAND_BACKUP_SRAM) {
-                save_data_numBytesToBackup = command_numBytesToRead;
-                start_saveSramData = true;
-
-            } else {
-                // not supported yet
-                printf("\nUnknown command: %x\n", command);
+        } else if (command == COMMAND_PI_STATS) {
+            if (length == PI_STATS_PACKET_LENGTH) {
+                memcpy(pi_stats_dump, buffer, PI_STATS_PACKET_LENGTH);
+                start_printPiStats = true;
             }
 
-            bufferIndex = 0;
-            mayHaveFinish = false;
-            mayHaveStart = false;
-            receivingData = false;
-            command_numBytesToRead = 0;
-
-            #if MCU2_PRINT_UART == 1
-                echoIndex = 0;
-                printf("\n");
-            #endif
         } else {
-            #if MCU2_PRINT_UART == 1
-            echoIndex++;
-            if (echoIndex >= 32) {
-                printf("\n");
-                echoIndex = 0;
-            }
-            #endif
+            // not supported yet
+            printf("\nUnknown command: %x\n", command);
         }
+
+        #if MCU2_PRINT_UART == 1
+        printf("\n");
+        #endif
     }
 }
 
@@ -686,6 +1401,47 @@ void start_sram_sd_save() {
     save_saveData_to_sd(&g_file, sd_selected_rom_title, 1);
 }
 
+void save_pi_calibration_to_sd() {
+    printf("Saving PI calibration, timing %02x%02x, rx sample delay %u\n", pi_calibration[0], pi_calibration[1],
+        (pi_calibration[2] << 8) | pi_calibration[3]);
+
+    FRESULT fr = f_open(&g_file, PI_CALIBRATION_FILE, FA_CREATE_ALWAYS | FA_WRITE);
+    if (fr != FR_OK) {
+        printf("'%s' Cannot be opened. Error: %u\n", PI_CALIBRATION_FILE, fr);
+        return;
+    }
+
+    uint numWritten = 0;
+    f_write(&g_file, pi_calibration, PI_CALIBRATION_LENGTH, &numWritten);
+    f_close(&g_file);
+
+    if (numWritten != PI_CALIBRATION_LENGTH) {
+        printf("Error saving PI calibration. Wrote %d but expected %u\n", numWritten, PI_CALIBRATION_LENGTH);
+    }
+}
+
+void print_pi_stats() {
+    static const char *region_names[PI_REGION_COUNT] = { "rom", "header", "sram", "ddr64", "debug", "unhandled" };
+
+    printf("PI stats:\n%-10s %10s %10s %10s %10s %10s %10s\n", "region", "addresses", "strobes", "rom writes", "chip sw", "dma stalls", "not ready");
+    for (int r = 0; r < PI_REGION_COUNT; r++) {
+        uint32_t counters[sizeof(pi_region_stats_t) / 4];
+        for (int i = 0; i < sizeof(pi_region_stats_t) / 4; i++) {
+            const uint8_t *b = &pi_stats_dump[r * sizeof(pi_region_stats_t) + i * 4];
+            counters[i] = (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+        }
+        printf("%-10s %10lu %10lu %10lu %10lu %10lu %10lu\n", region_names[r], counters[0], counters[1], counters[2], counters[3], counters[4], counters[5]);
+    }
+
+    uint32_t link[MCU1_LINK_STATS_WORDS];
+    for (int i = 0; i < MCU1_LINK_STATS_WORDS; i++) {
+        const uint8_t *b = &pi_stats_dump[PI_STATS_LENGTH + i * 4];
+        link[i] = (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+    }
+    printf("Packets from mcu2: %lu bad, %lu missed, %lu sd read retries, %lu bytes overflowed\n",
+        link[0], link[1], link[2], link[3]);
+}
+
 // void save_eeprom_to_sd(FIL* eepromFile) {
 //     printf("Saving eeprom data...\n");
 //     // Open or create file for currently loaded rom
@@ -831,6 +1587,9 @@ int save_saveData_to_sd(FIL* saveFile, char* saveFilename, int ddr_saveType) {
     return numWritten;
 }
 
+// EEPROM save sent to mcu1, sized to fit the 16K eeprom
+static uint8_t eeprom_frame[MCU_PACKET_FRAME_BYTES(2048)];
+
 int load_saveData_from_sd(FIL* saveFile, char* saveFilename, int ddr_saveType) {
     char* saveFilePath;
     char* fileExtension;
@@ -877,9 +1636,17 @@ int load_saveData_from_sd(FIL* saveFile, char* saveFilename, int ddr_saveType) {
 
     uint8_t* buf;
     if (ddr_saveType == 0) {
-        buf = (uint8_t*)ddr64_uart_tx_buf;
-    } else if (ddr_saveType == 1) {
-        buf = (uint8_t*)ddr64_dynamic_large_buffer;
+        // Read straight into the packet, the last one may still be on the wire
+        uart_tx_program_write_wait();
+        buf = MCU_PACKET_FRAME_PAYLOAD(eeprom_frame);
+    } else {
+        buf = malloc(numBytesToSend);
+        if (buf == NULL) {
+            printf("Unable to allocate %u bytes for the sram save\n", numBytesToSend);
+            f_close(saveFile);
+            free(dataSaveFilePath);
+            return -1;
+        }
     }
 
     uint numRead = 0;
@@ -888,35 +1655,43 @@ int load_saveData_from_sd(FIL* saveFile, char* saveFilename, int ddr_saveType) {
     if(fr != FR_OK) {
         printf("Error reading save file '%s'. Error: %u\n", dataSaveFilePath, fr);
         f_close(saveFile);
+        free(dataSaveFilePath);
+        if (ddr_saveType == 1) {
+            free(buf);
+        }
         return -1;
     }
 
     fr = f_close(saveFile);
+    free(dataSaveFilePath);
     if (numRead != numBytesToSend) {
         printf("Error reading save file. Read %d but expected %u\n", numRead, numBytesToSend);
+        if (ddr_saveType == 1) {
+            free(buf);
+        }
         return -1;
     }
 
-    free(dataSaveFilePath);
-
     printf("Sending %u bytes\n", numBytesToSend);
-    uart_tx_program_putc(COMMAND_START);
-    uart_tx_program_putc(COMMAND_START2);
-    uart_tx_program_putc(COMMAND_LOAD_BACKUP_EEPROM);
-    uart_tx_program_putc((uint8_t)(numBytesToSend >> 8));
-    uart_tx_program_putc((uint8_t)(numBytesToSend));
-
-    for(int i = 0; i < numBytesToSend; i++) {
-        while (!uart_tx_program_is_writable()) {
-            tight_loop_contents();
-        }
-        uart_tx_program_putc(buf[i]);
+    if (ddr_saveType == 0) {
+        uint32_t frameBytes = mcu_packet_frame(&ddr64_packet_tx, COMMAND_LOAD_BACKUP_EEPROM, eeprom_frame, numBytesToSend);
+        uart_tx_program_write_async(eeprom_frame, frameBytes);
+    } else {
+        mcu_packet_send(&ddr64_packet_tx, COMMAND_LOAD_SRAM_BACKUP, buf, numBytesToSend);
+        free(buf);
     }
 
     return numRead;
 }
 
-BYTE diskReadBuffer[DISK_READ_BUFFER_SIZE];
+// Sector packets. A retry can come in while the last answer is still on the
+// wire, so each read goes into the frame that isn't. Offset by a byte so the
+// sectors themselves are word aligned.
+static uint8_t sd_data_frames[2][1 + MCU_PACKET_FRAME_BYTES(SD_DATA_LENGTH(SD_READ_MAX_SECTORS))] __attribute__((aligned(4)));
+_Static_assert(MCU_PACKET_FRAME_BYTES(SD_DATA_LENGTH(SD_READ_MAX_SECTORS)) <= RX_RING_BUFFER_SIZE,
+    "mcu1's rx ring must hold a whole sector packet");
+static int sd_data_frame = 0;
+
 // MCU2 will send data once it has the information it needs
 void send_data(uint32_t sectorCount) {
     uint64_t sectorFront = sectorToSendRegisters[0];
@@ -924,30 +1699,36 @@ void send_data(uint32_t sectorCount) {
     #if DEBUG_MCU2_PRINT == 1
     printf("Count: %u, Sector: %llu\n", sectorCount, sector);
     #endif
-    int loopCount = 0;
-    uint32_t startTime = time_us_32();
-    do {
-        loopCount++;
-
-        DRESULT dr = disk_read(0, diskReadBuffer, (uint64_t)sector, 1);
-        if (dr != RES_OK) {
-            printf("Error reading disk: %d\n", dr);
-        }
 
-        sectorCount--;
+    // mcu1 never asks for more than fit, but the frame is only so big
+    if (sectorCount == 0 || sectorCount > SD_READ_MAX_SECTORS) {
+        printf("Bad sector count %u\n", sectorCount);
+        return;
+    }
 
-        // Send sector worth of data
-        for (int diskBufferIndex = 0; diskBufferIndex < DISK_READ_BUFFER_SIZE; diskBufferIndex++) {
-            // wait until uart is writable
-            while (!uart_tx_program_is_writable()) {
-                tight_loop_contents();
-            }
+    // Not the frame on the wire, that is always the last one sent
+    uint8_t *frame = &sd_data_frames[sd_data_frame][1];
+    sd_data_frame ^= 1;
+
+    // The sector number mcu1 asked for, then the sectors
+    uint8_t *payload = MCU_PACKET_FRAME_PAYLOAD(frame);
+    for (int i = 0; i < 2; i++) {
+        payload[i * 4] = sectorToSendRegisters[i] >> 24;
+        payload[i * 4 + 1] = sectorToSendRegisters[i] >> 16;
+        payload[i * 4 + 2] = sectorToSendRegisters[i] >> 8;
+        payload[i * 4 + 3] = sectorToSendRegisters[i];
+    }
+    uint8_t *diskReadBuffer = payload + SD_READ_SECTOR_BYTES;
 
-            uart_tx_program_putc(diskReadBuffer[diskBufferIndex]);
-        }
+    // One multi block read for all of them
+    DRESULT dr = disk_read(0, diskReadBuffer, (uint64_t)sector, sectorCount);
+    if (dr != RES_OK) {
+        printf("Error reading disk: %d\n", dr);
+    }
 
-    // Repeat if we are reading more than 1 sector
-    } while(sectorCount > 1);
+    // Goes out with DMA
+    uint32_t frameBytes = mcu_packet_frame(&ddr64_packet_tx, COMMAND_SD_DATA, frame, SD_DATA_LENGTH(sectorCount));
+    uart_tx_program_write_async(frame, frameBytes);
 
     #if PRINT_BUFFER_AFTER_SEND == 1
     printf("buffer for sector: %ld\n", sector);
@@ -966,9 +1747,8 @@ void send_sd_card_data() {
     sendDataReady = false;
 
     // Send the data over uart back to MCU1 so the rom can read it
-    // Sector is fetched from the sectorToSendRegisters
-    // But it's hard coded to 1 in libdragon's pc64 patch
-    send_data(1);
+    // Sector and count are fetched from the COMMAND_SD_READ mcu1 sent
+    send_data(numSectorsToSend);
 }
 
 // SD mount helper function
@@ -1010,6 +1790,7 @@ void mount_sd(void) {
 
 void test_read_psram(const char* filename) {
     char buf[512];
+    rom_cache_invalidate();
     sd_card_t *pSD = sd_get_by_num(0);
 	FRESULT fr = f_mount(&pSD->fatfs, pSD->pcName, 1);
 	if (FR_OK != fr) {
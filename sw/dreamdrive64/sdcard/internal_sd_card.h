@@ -11,8 +11,9 @@
 #include "pico/stdlib.h"
 #include "ddr64_regs.h"
 #include "pio_uart/pio_uart.h"
+#include "mcu_packet.h"
 
-#define ERASE_AND_WRITE_TO_FLASH_ARRAY 0
+#define ERASE_AND_WRITE_TO_FLASH_ARRAY 0 // 1 to keep every rom in the flash array (U7, U8) library, not just pinned ones, instead of psram
 #define LOAD_TO_PSRAM_ARRAY 2 // 1 if use psram, 0 to use flash, 2 = do nothing?
 #define SD_CARD_SECTOR_SIZE 512 // 512 bytes
 
@@ -24,6 +25,9 @@ extern volatile bool start_saveEeepromData;
 extern volatile bool start_loadEeepromData;
 extern volatile bool start_saveSramData;
 extern volatile bool start_loadSramData;
+extern volatile bool start_savePiCalibration;
+extern volatile bool start_printPiStats;
+extern volatile bool start_pinRom;
 extern volatile bool is_verifying_rom_data_from_mcu1;
 extern volatile uint32_t verifyDataTime;
 extern volatile int selected_rom_save_type;
@@ -35,6 +39,12 @@ extern volatile bool did_write_SRAM;
 // UART TX buffer
 extern volatile uint16_t ddr64_uart_tx_buf[DDR64_BASE_ADDRESS_LENGTH];
 
+// Packets to the other mcu go out through this
+extern mcu_packet_tx_t ddr64_packet_tx;
+
+// Sector reads mcu1 asked for again, as the sector didn't arrive intact
+extern volatile uint32_t sd_read_retries;
+
 // set the sector to start reading from
 void ddr64_set_sd_read_sector(uint64_t sector);
 
@@ -74,12 +84,27 @@ void mount_sd(void);
 // loads the rom file specified in sd_selected_rom_title, that is set with the load rom command from mcu1
 void load_selected_rom();
 void load_rom(const char *filename);
+bool load_rom_from_flash_library(char* filename);
+// pins or unpins the rom sent with the pin rom command from mcu1
+void pin_selected_rom();
 
 void ddr64_send_load_new_rom_command();
+void ddr64_send_pin_rom_command();
+
+// MCU1 sends a PI calibration (header timing << 16 | rx sample delay) to mcu2 to be saved to the sd card
+void ddr64_send_pi_calibration(uint32_t calibration);
+
+// MCU1 sends the PI handler counters to mcu2 to be printed on its debug uart
+void ddr64_send_pi_stats();
+void ddr64_send_rom_ready(const uint32_t *ready);
 void load_new_rom(char* filename);
+void rom_cache_invalidate();
+void psram_write_benchmark();
 
 void start_eeprom_sd_save();
 void start_sram_sd_save();
+void save_pi_calibration_to_sd();
+void print_pi_stats();
 
 void test_read_psram(const char* filename);
 
@@ -43,7 +43,8 @@
 #define DDR64_REGISTER_SD_READ_SECTOR0 (DDR64_REGISTER_SD_BUSY + 0x4)
 #define DDR64_REGISTER_SD_READ_SECTOR1 (DDR64_REGISTER_SD_READ_SECTOR0 + 0x4)
 
-// [WRITE] number of sectors to read from the sd card, 4 bytes
+// [WRITE] number of sectors to read from the sd card, 4 bytes. Up to 8, they
+// fill DDR64_BASE_ADDRESS_START one after another. 0 reads one sector.
 #define DDR64_REGISTER_SD_READ_NUM_SECTORS (DDR64_REGISTER_SD_READ_SECTOR1 + 0x4)
 
 // [WRITE] write the selected file name that should be loaded into memory
@@ -55,3 +56,41 @@
 // 0x00FF == save
 #define DDR64_REGISTER_SELECTED_ROM_META (DDR64_REGISTER_SD_SELECT_ROM + 0x4)
 
+// [WRITE] PI bus timing to serve in the rom header, PWD << 8 | LAT in the low 16 bits.
+// 0 goes back to the timing for the cart's clock. Set it before booting the rom.
+#define DDR64_REGISTER_PI_TIMING (DDR64_REGISTER_SELECTED_ROM_META + 0x4)
+
+// [WRITE] RX sample delay, in system clocks, for the cart's PSRAM/flash reads.
+// Takes effect on the next rom read. Used by the calibration in the test rom.
+#define DDR64_REGISTER_PSRAM_SAMPLE_DLY (DDR64_REGISTER_PI_TIMING + 0x4)
+
+// [WRITE] Save a PI calibration to the sd card, applied to every rom loaded after it
+// 0xFFFF0000 == header timing, PWD << 8 | LAT
+// 0x0000FFFF == RX sample delay
+#define DDR64_REGISTER_PI_CALIBRATION (DDR64_REGISTER_PSRAM_SAMPLE_DLY + 0x4)
+
+// [READ] PI handler counters since it was started, one block of
+// DDR64_PI_STATS_FIELDS 32-bit counters per region: rom, rom header, sram,
+// ddr64 registers, debug, unhandled. In each block: new addresses, strobes
+// served, rom writes ignored, PSRAM chip switches, DMA stall spins, addresses
+// in rom blocks that were not loaded yet. All 0 unless the firmware is built
+// with PI_STATS.
+// [WRITE] Clears the counters
+#define DDR64_REGISTER_PI_STATS (DDR64_REGISTER_PI_CALIBRATION + 0x4)
+#define DDR64_PI_STATS_FIELDS (6)
+#define DDR64_PI_STATS_REGIONS (6)
+
+// [WRITE] Print the PI handler counters on MCU2's debug uart, with MCU1's counts of
+// damaged and missed packets from MCU2
+#define DDR64_REGISTER_PI_STATS_DUMP (DDR64_REGISTER_PI_STATS + DDR64_PI_STATS_FIELDS * DDR64_PI_STATS_REGIONS * 4)
+
+// [WRITE] Pin the rom named in DDR64_BASE_ADDRESS_START, same as DDR64_REGISTER_SD_SELECT_ROM,
+// in the cart's flash library, or unpin it if it is pinned. A pinned rom is kept in the flash
+// array and boots without being loaded from the sd card. DDR64_REGISTER_SD_BUSY until it's done,
+// the first pin of a rom programs it, which takes a while.
+#define DDR64_REGISTER_SD_PIN_ROM (DDR64_REGISTER_PI_STATS_DUMP + 0x4)
+
+// [WRITE] 1 serves PSRAM roms through the cached XIP alias, 0 streams them from the SSI.
+// The cache helps roms that read the same data again, streaming is faster on a miss.
+// Takes effect on the next rom read.
+#define DDR64_REGISTER_PSRAM_XIP_CACHED (DDR64_REGISTER_SD_PIN_ROM + 0x4)
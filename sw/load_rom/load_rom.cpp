@@ -0,0 +1,138 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+// Writes a rom into generated/rom.h for mcu1's flash, replacing
+// scripts/load_rom.py, and its chunk size into rom_chunk_size.h next to it.
+// .v64 and .n64 dumps are converted to .z64 order.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+extern "C" {
+#include "rom_byteorder.h"
+}
+
+#include "rom_dedup.h"
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options] rom\n", name);
+	printf("  --compress       Keep each unique chunk once, with a mapping table\n");
+	printf("  --chunk-pot n    Compressed chunk size 1 << n bytes, %d to %d. By default the\n",
+		   ROM_DEDUP_MIN_CHUNK_POT, ROM_DEDUP_MAX_CHUNK_POT);
+	printf("                   smallest result of %d to %d is kept\n", ROM_DEDUP_AUTO_MIN_CHUNK_POT, ROM_DEDUP_AUTO_MAX_CHUNK_POT);
+	printf("  --incbin         Write the data to rom_mapping.bin and rom_chunks.bin next to\n");
+	printf("                   the header and pull them in with .incbin, instead of C arrays\n");
+	printf("  -o path          Header to write, default %s\n", LOAD_ROM_DEFAULT_OUTPUT);
+}
+
+int main(int argc, char **argv)
+{
+	const char *rom_path = NULL;
+	const char *out_path = LOAD_ROM_DEFAULT_OUTPUT;
+	uint32_t chunk_pot = 0; // Picked for the rom
+	bool compress = false;
+	bool incbin = false;
+
+	for (int i = 1; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+		if (strcmp(argv[i], "--compress") == 0) {
+			compress = true;
+		} else if (strcmp(argv[i], "--chunk-pot") == 0 && has_value) {
+			chunk_pot = strtoul(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "--incbin") == 0) {
+			incbin = true;
+		} else if (strcmp(argv[i], "-o") == 0 && has_value) {
+			out_path = argv[++i];
+		} else if (argv[i][0] != '-' && !rom_path) {
+			rom_path = argv[i];
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!rom_path || (chunk_pot && (!compress || chunk_pot < ROM_DEDUP_MIN_CHUNK_POT || chunk_pot > ROM_DEDUP_MAX_CHUNK_POT))) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	auto t0 = std::chrono::steady_clock::now();
+
+	FILE *f = fopen(rom_path, "rb");
+	if (!f) {
+		printf("Can't open %s\n", rom_path);
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	// Room to pad a .v64 that ends on a half word
+	std::vector<uint8_t> rom(len + 4);
+	bool read_ok = fread(rom.data(), 1, len, f) == (size_t)len;
+	fclose(f);
+	if (!read_ok || len < 4) {
+		printf("Can't read %s\n", rom_path);
+		return 1;
+	}
+
+	rom_byte_order_t order = rom_detect_byte_order(rom.data());
+	printf("Rom byte order: %s\n", rom_byte_order_name(order));
+	rom_convert_to_z64(order, rom.data(), len);
+
+	rom_dedup_t dedup;
+	if (compress && !chunk_pot) {
+		if (!rom_dedup_best(rom.data(), len, &dedup)) {
+			printf("The rom is too large to compress for the firmware's mapping table\n");
+			return 1;
+		}
+	} else {
+		rom_dedup(rom.data(), len, compress ? chunk_pot : ROM_DEDUP_DEFAULT_CHUNK_POT, compress, &dedup);
+	}
+
+	uint32_t chunk_bytes = rom_dedup_chunk_bytes(&dedup);
+	uint32_t unique = rom_dedup_unique_chunks(&dedup);
+	if (compress) {
+		if (unique > ROM_DEDUP_MAX_UNIQUE_CHUNKS) {
+			printf("%u unique chunks don't fit the 16-bit mapping, use a larger --chunk-pot\n", unique);
+			return 1;
+		}
+		if (dedup.mapping.size() > ROM_DEDUP_MAX_MAPPING_ENTRIES) {
+			printf("%u mapping entries don't fit MAPPING_TABLE_LEN, use a larger --chunk-pot\n", (uint32_t)dedup.mapping.size());
+			return 1;
+		}
+
+		size_t chunks_size = (size_t)unique * chunk_bytes;
+		size_t mapping_size = dedup.mapping.size() * 2;
+		printf("Found %u unique chunks of %u in %u byte chunks, %.1f%% of the rom\n", unique,
+			   (uint32_t)dedup.mapping.size(), chunk_bytes, 100.0 * unique / dedup.mapping.size());
+		printf("Chunk data size: %10.2f kB\n", chunks_size / 1024.0);
+		printf("Mapping size:    %10.2f kB\n", mapping_size / 1024.0);
+		printf("Total size:      %10.2f kB, saves %.2f kB\n", (chunks_size + mapping_size) / 1024.0,
+			   ((double)len - (double)(chunks_size + mapping_size)) / 1024.0);
+	}
+
+	bool written;
+	if (incbin) {
+		written = rom_dedup_write_incbin(out_path, &dedup);
+	} else {
+		FILE *out = fopen(out_path, "w");
+		written = out && rom_dedup_write_c(out, &dedup);
+		written = out && fclose(out) == 0 && written;
+	}
+	written = written && rom_dedup_write_chunk_size(out_path, &dedup);
+	if (!written) {
+		printf("Can't write %s\n", out_path);
+		return 1;
+	}
+
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+	printf("Wrote rom contents to %s in %lld ms\n", out_path, (long long)us / 1000);
+	return 0;
+}
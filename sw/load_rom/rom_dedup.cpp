@@ -0,0 +1,252 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <utility>
+
+#include "rom_dedup.h"
+
+#define ROM_DEDUP_NO_CHUNK 0xFFFFFFFFu
+
+// FNV-1a over the chunk, 8 bytes at a time
+static uint64_t chunk_hash(const uint8_t *chunk, uint32_t len)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (uint32_t i = 0; i < len; i += 8) {
+		uint64_t word;
+		memcpy(&word, chunk + i, sizeof(word));
+		hash = (hash ^ word) * 1099511628211ull;
+	}
+	return hash ^ (hash >> 29);
+}
+
+void rom_dedup(const uint8_t *rom, size_t len, uint32_t chunk_pot, bool compress, rom_dedup_t *out)
+{
+	uint32_t chunk_bytes = 1u << chunk_pot;
+	size_t chunk_count = (len + chunk_bytes - 1) >> chunk_pot;
+
+	out->chunk_pot = chunk_pot;
+	out->compressed = compress;
+	out->rom_bytes = len;
+	out->mapping.clear();
+	out->chunks.clear();
+
+	if (!compress) {
+		out->chunks.assign(rom, rom + len);
+		out->chunks.resize(chunk_count << chunk_pot, 0xFF);
+		return;
+	}
+
+	// Open addressing, at most half full. Slots hold unique chunk indexes and
+	// a matching hash is confirmed against the chunk data.
+	size_t slots = 1;
+	while (slots < chunk_count * 2) {
+		slots <<= 1;
+	}
+	std::vector<uint32_t> slot_chunk(slots, ROM_DEDUP_NO_CHUNK);
+	std::vector<uint64_t> slot_hash(slots);
+	std::vector<uint8_t> tail(chunk_bytes, 0xFF);
+
+	out->mapping.reserve(chunk_count);
+	out->chunks.reserve(chunk_count << chunk_pot);
+
+	for (size_t i = 0; i < chunk_count; i++) {
+		const uint8_t *chunk = rom + (i << chunk_pot);
+		if (((i + 1) << chunk_pot) > len) {
+			memcpy(tail.data(), chunk, len - (i << chunk_pot));
+			chunk = tail.data();
+		}
+
+		uint64_t hash = chunk_hash(chunk, chunk_bytes);
+		size_t slot = hash & (slots - 1);
+		while (slot_chunk[slot] != ROM_DEDUP_NO_CHUNK &&
+			   (slot_hash[slot] != hash || memcmp(&out->chunks[(size_t)slot_chunk[slot] << chunk_pot], chunk, chunk_bytes) != 0)) {
+			slot = (slot + 1) & (slots - 1);
+		}
+
+		if (slot_chunk[slot] == ROM_DEDUP_NO_CHUNK) {
+			slot_chunk[slot] = rom_dedup_unique_chunks(out);
+			slot_hash[slot] = hash;
+			out->chunks.insert(out->chunks.end(), chunk, chunk + chunk_bytes);
+		}
+		out->mapping.push_back(slot_chunk[slot]);
+	}
+}
+
+bool rom_dedup_fits(const rom_dedup_t *dedup)
+{
+	return dedup->mapping.size() <= ROM_DEDUP_MAX_MAPPING_ENTRIES && rom_dedup_unique_chunks(dedup) <= ROM_DEDUP_MAX_UNIQUE_CHUNKS;
+}
+
+bool rom_dedup_best(const uint8_t *rom, size_t len, rom_dedup_t *out)
+{
+	bool found = false;
+	rom_dedup_t candidate;
+	for (uint32_t pot = ROM_DEDUP_AUTO_MAX_CHUNK_POT; pot >= ROM_DEDUP_AUTO_MIN_CHUNK_POT; pot--) {
+		rom_dedup(rom, len, pot, true, &candidate);
+		if (rom_dedup_fits(&candidate) &&
+			(!found || rom_dedup_compressed_bytes(&candidate) < rom_dedup_compressed_bytes(out))) {
+			std::swap(*out, candidate);
+			found = true;
+		}
+	}
+	return found;
+}
+
+////////////////////////////////////////////////////////////
+// Writers
+
+// Buffers the output so the per byte formatting isn't a call into stdio
+typedef struct {
+	FILE *f;
+	std::vector<char> buf;
+	size_t used;
+} out_t;
+
+static void out_flush(out_t *out)
+{
+	fwrite(out->buf.data(), 1, out->used, out->f);
+	out->used = 0;
+}
+
+static void out_put(out_t *out, const char *s, size_t len)
+{
+	if (out->used + len > out->buf.size()) {
+		out_flush(out);
+	}
+	memcpy(&out->buf[out->used], s, len);
+	out->used += len;
+}
+
+static void out_str(out_t *out, const std::string &s)
+{
+	out_put(out, s.data(), s.size());
+}
+
+static const char *rom_header_text(const rom_dedup_t *dedup)
+{
+	return dedup->compressed ? "picocartcompress" : "picocart        ";
+}
+
+// Directory of the header, with the trailing slash
+static std::string header_dir(const std::string &header_path)
+{
+	size_t slash = header_path.find_last_of('/');
+	return slash == std::string::npos ? "./" : header_path.substr(0, slash + 1);
+}
+
+std::string rom_dedup_chunk_size_text(const rom_dedup_t *dedup)
+{
+	return "// Generated by load_rom with rom.h, included by rom_vars.h\n"
+		"#define COMPRESSION_SHIFT_AMOUNT " + std::to_string(dedup->chunk_pot) + "\n"
+		"#define COMPRESSION_MASK " + std::to_string(rom_dedup_chunk_bytes(dedup) - 1) + "\n";
+}
+
+bool rom_dedup_write_c(FILE *f, const rom_dedup_t *dedup)
+{
+	// Python's hex(): 0x0 to 0xff, lower case, no padding
+	static char hex_text[256][5];
+	static uint8_t hex_len[256];
+	for (int i = 0; i < 256; i++) {
+		hex_len[i] = snprintf(hex_text[i], sizeof(hex_text[i]), "0x%x", i);
+	}
+
+	out_t out = { f, std::vector<char>(1 << 20), 0 };
+	uint32_t chunk_bytes = rom_dedup_chunk_bytes(dedup);
+
+	out_str(&out, std::string("const char __attribute__((section(\".n64_rom.header\"))) picocart_header[16] = \"") + rom_header_text(dedup) + "\";\n");
+	if (dedup->compressed) {
+		out_str(&out, "const uint16_t __attribute__((section(\".n64_rom.mapping\"))) flash_rom_mapping[] = {\n");
+		for (size_t i = 0; i < dedup->mapping.size(); i++) {
+			out_str(&out, (i ? ", " : "") + std::to_string(dedup->mapping[i]));
+		}
+		out_str(&out, "\n};\n");
+	} else {
+		out_str(&out, "const uint16_t __attribute__((section(\".n64_rom.mapping\"))) flash_rom_mapping[] = {};\n");
+	}
+
+	out_str(&out, "const unsigned char __attribute__((section(\".n64_rom\"))) rom_chunks[][" + std::to_string(chunk_bytes) + "] = {\n");
+	for (size_t offset = 0; offset < dedup->chunks.size(); offset += chunk_bytes) {
+		out_put(&out, "{", 1);
+		for (uint32_t b = 0; b < chunk_bytes; b++) {
+			uint8_t value = dedup->chunks[offset + b];
+			if (b) {
+				out_put(&out, ",", 1);
+			}
+			out_put(&out, hex_text[value], hex_len[value]);
+		}
+		out_put(&out, "},\n", 3);
+	}
+
+	out_str(&out, dedup->compressed ? "};\n" : "\n};\n");
+
+	out_flush(&out);
+	return !ferror(f);
+}
+
+static bool write_file(const std::string &path, const void *data, size_t len)
+{
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f) {
+		return false;
+	}
+	bool ok = fwrite(data, 1, len, f) == len;
+	return fclose(f) == 0 && ok;
+}
+
+bool rom_dedup_write_incbin(const char *header_path, const rom_dedup_t *dedup)
+{
+	// Next to the header, .incbin gets absolute paths so it doesn't depend on
+	// the assembler's include path
+	std::string dir = header_dir(header_path);
+	char *real = realpath(dir.c_str(), NULL);
+	if (!real) {
+		return false;
+	}
+	dir = std::string(real) + "/";
+	free(real);
+	std::string mapping_path = dir + "rom_mapping.bin";
+	std::string chunks_path = dir + "rom_chunks.bin";
+
+	// Little endian, as mcu1 reads it
+	std::vector<uint8_t> mapping;
+	for (uint32_t chunk : dedup->mapping) {
+		mapping.push_back(chunk);
+		mapping.push_back(chunk >> 8);
+	}
+	if (!write_file(mapping_path, mapping.data(), mapping.size()) ||
+		!write_file(chunks_path, dedup->chunks.data(), dedup->chunks.size())) {
+		return false;
+	}
+
+	std::string code;
+	code += "// Generated by load_rom, the rom data is in rom_mapping.bin and rom_chunks.bin\n";
+	code += std::string("const char __attribute__((section(\".n64_rom.header\"))) picocart_header[16] = \"") + rom_header_text(dedup) + "\";\n";
+	code += "__asm__(\n";
+	code += "\t\".pushsection .n64_rom.mapping, \\\"a\\\"\\n\"\n";
+	code += "\t\".global flash_rom_mapping\\n\"\n";
+	code += "\t\".balign 4\\n\"\n";
+	code += "\t\"flash_rom_mapping:\\n\"\n";
+	code += "\t\".incbin \\\"" + mapping_path + "\\\"\\n\"\n";
+	code += "\t\".popsection\\n\"\n";
+	code += "\t\".pushsection .n64_rom, \\\"a\\\"\\n\"\n";
+	code += "\t\".global rom_chunks\\n\"\n";
+	code += "\t\".balign 4\\n\"\n";
+	code += "\t\"rom_chunks:\\n\"\n";
+	code += "\t\".incbin \\\"" + chunks_path + "\\\"\\n\"\n";
+	code += "\t\".popsection\\n\"\n";
+	code += ");\n";
+
+	return write_file(header_path, code.data(), code.size());
+}
+
+bool rom_dedup_write_chunk_size(const char *header_path, const rom_dedup_t *dedup)
+{
+	std::string text = rom_dedup_chunk_size_text(dedup);
+	return write_file(header_dir(header_path) + "rom_chunk_size.h", text.data(), text.size());
+}
@@ -0,0 +1,82 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// An uncompressed rom is always served in 1KB chunks, a compressed one in the
+// chunk size rom.h defines, see COMPRESSION_SHIFT_AMOUNT in rom_vars.h
+#define ROM_DEDUP_DEFAULT_CHUNK_POT 10
+#define ROM_DEDUP_MIN_CHUNK_POT 4
+#define ROM_DEDUP_MAX_CHUNK_POT 16
+
+// Chunk sizes rom_dedup_best tries. Chunks under the 512 byte PI page cost
+// the handler a lookup where a burst runs into the next chunk.
+#define ROM_DEDUP_AUTO_MIN_CHUNK_POT 8
+#define ROM_DEDUP_AUTO_MAX_CHUNK_POT 12
+
+// flash_rom_mapping is uint16_t
+#define ROM_DEDUP_MAX_UNIQUE_CHUNKS 65536
+
+// MAPPING_TABLE_LEN in rom_vars.h, what mcu1 copies of the mapping to RAM
+#define ROM_DEDUP_MAX_MAPPING_ENTRIES (16384 - 8)
+
+// A rom split into chunks of 1 << chunk_pot bytes. Uncompressed, every chunk
+// is kept and the mapping is empty. Compressed, each unique chunk is kept once,
+// in the order it first appears, and mapping holds the unique chunk of every
+// chunk of the rom. A last partial chunk is padded with 0xFF.
+typedef struct {
+	uint32_t chunk_pot;
+	bool compressed;
+	size_t rom_bytes;
+	std::vector<uint32_t> mapping;
+	std::vector<uint8_t> chunks;
+} rom_dedup_t;
+
+static inline uint32_t rom_dedup_chunk_bytes(const rom_dedup_t *dedup)
+{
+	return 1u << dedup->chunk_pot;
+}
+
+static inline uint32_t rom_dedup_unique_chunks(const rom_dedup_t *dedup)
+{
+	return dedup->chunks.size() >> dedup->chunk_pot;
+}
+
+// Flash used by the chunks and the mapping
+static inline size_t rom_dedup_compressed_bytes(const rom_dedup_t *dedup)
+{
+	return dedup->chunks.size() + dedup->mapping.size() * 2;
+}
+
+void rom_dedup(const uint8_t *rom, size_t len, uint32_t chunk_pot, bool compress, rom_dedup_t *out);
+
+// Whether the firmware can serve the compressed rom
+bool rom_dedup_fits(const rom_dedup_t *dedup);
+
+// Compresses the rom in each chunk size from ROM_DEDUP_AUTO_MIN_CHUNK_POT to
+// ROM_DEDUP_AUTO_MAX_CHUNK_POT and keeps the smallest that fits, the larger
+// chunk size on a tie. false if none fits.
+bool rom_dedup_best(const uint8_t *rom, size_t len, rom_dedup_t *out);
+
+// rom.h as C arrays, the same text scripts/load_rom.py used to write
+bool rom_dedup_write_c(FILE *f, const rom_dedup_t *dedup);
+
+// rom.h that pulls the chunks and mapping in with .incbin, from the two
+// binary files written next to it. Much quicker to build than the C arrays.
+bool rom_dedup_write_incbin(const char *header_path, const rom_dedup_t *dedup);
+
+// The chunk size rom.h was written with, for rom_chunk_size.h. rom_vars.h
+// includes it to size rom_chunks before anything sees rom.h.
+std::string rom_dedup_chunk_size_text(const rom_dedup_t *dedup);
+
+// Writes rom_chunk_size.h next to the rom.h at header_path
+bool rom_dedup_write_chunk_size(const char *header_path, const rom_dedup_t *dedup);
@@ -0,0 +1,146 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+// Host test of load_rom's dedup and writers. The rom rebuilt from the mapping
+// and chunks must match, and the C output must be what scripts/load_rom.py wrote.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "rom_dedup.h"
+#include "test_check.h"
+
+// Random data with runs of repeated blocks and a padded end, like a rom
+static std::vector<uint8_t> make_rom(size_t len) {
+	std::vector<uint8_t> rom(len);
+	uint32_t x = 0x12345678;
+	for (size_t i = 0; i < len; i++) {
+		x = x * 1103515245 + 12345;
+		rom[i] = x >> 24;
+	}
+	for (size_t i = len / 4; i < len / 2; i++) {
+		rom[i] = rom[i % 4096];
+	}
+	memset(rom.data() + len * 3 / 4, 0xFF, len - len * 3 / 4);
+	return rom;
+}
+
+static void check_rebuild(size_t len, uint32_t chunk_pot) {
+	std::vector<uint8_t> rom = make_rom(len);
+	rom_dedup_t dedup;
+	rom_dedup(rom.data(), rom.size(), chunk_pot, true, &dedup);
+
+	uint32_t chunk_bytes = 1u << chunk_pot;
+	size_t chunks = (len + chunk_bytes - 1) / chunk_bytes;
+	CHECK(dedup.mapping.size() == chunks, "pot %u: %zu mapping entries", chunk_pot, dedup.mapping.size());
+	CHECK(rom_dedup_unique_chunks(&dedup) < chunks, "pot %u: nothing deduplicated", chunk_pot);
+
+	for (size_t i = 0; i < chunks; i++) {
+		const uint8_t *chunk = &dedup.chunks[(size_t)dedup.mapping[i] << chunk_pot];
+		size_t n = len - i * chunk_bytes < chunk_bytes ? len - i * chunk_bytes : chunk_bytes;
+		if (memcmp(chunk, rom.data() + i * chunk_bytes, n) != 0) {
+			CHECK(false, "pot %u: chunk %zu differs", chunk_pot, i);
+			break;
+		}
+		if (n < chunk_bytes) {
+			CHECK(chunk[n] == 0xFF && chunk[chunk_bytes - 1] == 0xFF, "pot %u: tail not padded", chunk_pot);
+		}
+	}
+
+	// Unique chunks really are
+	for (uint32_t a = 0; a < rom_dedup_unique_chunks(&dedup) && a < 64; a++) {
+		for (uint32_t b = a + 1; b < rom_dedup_unique_chunks(&dedup); b++) {
+			CHECK(memcmp(&dedup.chunks[(size_t)a << chunk_pot], &dedup.chunks[(size_t)b << chunk_pot], chunk_bytes) != 0,
+				  "pot %u: chunks %u and %u are the same", chunk_pot, a, b);
+		}
+	}
+}
+
+// Smallest of the sizes tried that the firmware can map
+static void check_best(size_t len, uint32_t min_pot) {
+	std::vector<uint8_t> rom = make_rom(len);
+	rom_dedup_t best;
+	CHECK(rom_dedup_best(rom.data(), rom.size(), &best), "%zu bytes: nothing fits", len);
+	CHECK(rom_dedup_fits(&best) && best.compressed, "%zu bytes: picked pot %u doesn't fit", len, best.chunk_pot);
+	CHECK(best.chunk_pot >= min_pot, "%zu bytes: pot %u maps too little of the rom", len, best.chunk_pot);
+
+	for (uint32_t pot = ROM_DEDUP_AUTO_MIN_CHUNK_POT; pot <= ROM_DEDUP_AUTO_MAX_CHUNK_POT; pot++) {
+		rom_dedup_t dedup;
+		rom_dedup(rom.data(), rom.size(), pot, true, &dedup);
+		if (rom_dedup_fits(&dedup)) {
+			CHECK(rom_dedup_compressed_bytes(&best) <= rom_dedup_compressed_bytes(&dedup),
+				  "%zu bytes: pot %u is smaller than the picked %u", len, pot, best.chunk_pot);
+		} else {
+			CHECK(pot < min_pot, "%zu bytes: pot %u should fit", len, pot);
+		}
+	}
+}
+
+static std::string write_c(const uint8_t *rom, size_t len, uint32_t chunk_pot, bool compress) {
+	rom_dedup_t dedup;
+	rom_dedup(rom, len, chunk_pot, compress, &dedup);
+
+	char *text = NULL;
+	size_t text_len = 0;
+	FILE *f = open_memstream(&text, &text_len);
+	rom_dedup_write_c(f, &dedup);
+	fclose(f);
+	std::string out(text, text_len);
+	free(text);
+	return out;
+}
+
+static void check_c_text() {
+	uint8_t rom[48];
+	for (int i = 0; i < 16; i++) {
+		rom[i] = i;
+		rom[16 + i] = 0xF0 + i;
+		rom[32 + i] = i;
+	}
+
+	CHECK(write_c(rom, sizeof(rom), 4, true) ==
+		"const char __attribute__((section(\".n64_rom.header\"))) picocart_header[16] = \"picocartcompress\";\n"
+		"const uint16_t __attribute__((section(\".n64_rom.mapping\"))) flash_rom_mapping[] = {\n"
+		"0, 1, 0\n"
+		"};\n"
+		"const unsigned char __attribute__((section(\".n64_rom\"))) rom_chunks[][16] = {\n"
+		"{0x0,0x1,0x2,0x3,0x4,0x5,0x6,0x7,0x8,0x9,0xa,0xb,0xc,0xd,0xe,0xf},\n"
+		"{0xf0,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa,0xfb,0xfc,0xfd,0xfe,0xff},\n"
+		"};\n",
+		"compressed text differs");
+
+	// Apart from rom.h, so rom_vars.h can size rom_chunks before rom.h is seen
+	rom_dedup_t dedup;
+	rom_dedup(rom, sizeof(rom), 4, true, &dedup);
+	CHECK(rom_dedup_chunk_size_text(&dedup) ==
+		"// Generated by load_rom with rom.h, included by rom_vars.h\n"
+		"#define COMPRESSION_SHIFT_AMOUNT 4\n"
+		"#define COMPRESSION_MASK 15\n",
+		"chunk size text differs");
+
+	CHECK(write_c(rom, 32, 4, false) ==
+		"const char __attribute__((section(\".n64_rom.header\"))) picocart_header[16] = \"picocart        \";\n"
+		"const uint16_t __attribute__((section(\".n64_rom.mapping\"))) flash_rom_mapping[] = {};\n"
+		"const unsigned char __attribute__((section(\".n64_rom\"))) rom_chunks[][16] = {\n"
+		"{0x0,0x1,0x2,0x3,0x4,0x5,0x6,0x7,0x8,0x9,0xa,0xb,0xc,0xd,0xe,0xf},\n"
+		"{0xf0,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa,0xfb,0xfc,0xfd,0xfe,0xff},\n"
+		"\n};\n",
+		"uncompressed text differs");
+}
+
+int main() {
+	check_rebuild(4 * 1024 * 1024, 10);
+	check_rebuild(1024 * 1024 + 100, 8);
+	check_rebuild(1024 * 1024, 14);
+	check_best(2 * 1024 * 1024, ROM_DEDUP_AUTO_MIN_CHUNK_POT);
+	check_best(24 * 1024 * 1024, 11);
+	check_c_text();
+
+	return test_result();
+}
@@ -33,7 +33,7 @@ echo "Building rom..."
 sudo libdragon make
 
 echo "\n\nExecuting ROM Script on ROM..."
-python3 /Users/kaili/Code/PicoCart64/sw/scripts/load_rom.py --compress /Users/kaili/Code/PicoCart64/sw/n64/dream_os/build/dreamos64.z64
+/Users/kaili/Code/PicoCart64/sw/build_load_rom/load_rom --compress /Users/kaili/Code/PicoCart64/sw/n64/dream_os/build/dreamos64.z64
 
 echo "\n\nCopying Header file to duplicate location..."
 cp -v /Users/kaili/Code/PicoCart64/sw/generated/rom.h /Users/kaili/Code/PicoCart64/sw/picocart64/rom.h
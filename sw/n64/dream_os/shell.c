@@ -124,6 +124,7 @@ bool LOAD_BOX_ART = 0;
 bool thumbnail_loaded = false;
 int NUM_ENTRIES = 0;
 bool g_sendingSelectedRom = false;
+bool g_pinningSelectedRom = false;
 int g_lastSelection = -1;
 bool g_isLoading = false;
 bool g_isRenderingMenu = false;
@@ -201,11 +202,8 @@ color_t WHITE_COLOR = { .r = 0xCC, .g = 0xCC, .b = 0xCC, .a = 0x00 }; // 0xCCCCC
 
 u8 boot_cic = 2;
 int gameCic = 5; 
-void loadRomAtSelection(int selection) {
-    g_sendingSelectedRom = true;
-
-    // TODO this will only load roms from the root of the SD Card....
-    char* fileToLoad = malloc(sizeof(char*) * 256);
+// Path on the sd card of the selected rom
+static void pathAtSelection(int selection, char* fileToLoad) {
     char* temp = malloc(sizeof(char*) * 256);
     if (g_current_directory_breadcrumb_index) {
         for(int i = 0; i < g_current_directory_breadcrumb_index; i++) {
@@ -222,6 +220,21 @@ void loadRomAtSelection(int selection) {
         sprintf(fileToLoad, "%s", g_current_dir_entries[selection]->filename);
     }
     free(temp);
+}
+
+// Write the file name to the cart buffer, for the select and pin registers
+static void sendPathToCart(char* fileToLoad) {
+    uint32_t len_aligned32 = (strlen(fileToLoad) + 3) & (-4);
+    data_cache_hit_writeback_invalidate(fileToLoad, len_aligned32);
+    pi_write_raw(fileToLoad, DDR64_BASE_ADDRESS_START, 0, len_aligned32);
+}
+
+void loadRomAtSelection(int selection) {
+    g_sendingSelectedRom = true;
+
+    // TODO this will only load roms from the root of the SD Card....
+    char* fileToLoad = malloc(sizeof(char*) * 256);
+    pathAtSelection(selection, fileToLoad);
 
     char* prefixedFilename = malloc(256);
     sprintf(prefixedFilename, "sd:/%s", fileToLoad);
@@ -254,10 +267,7 @@ void loadRomAtSelection(int selection) {
     printf("%s\n", fileToLoad);
     #endif
 
-    // Write the file name to the cart buffer
-    uint32_t len_aligned32 = (strlen(fileToLoad) + 3) & (-4);
-    data_cache_hit_writeback_invalidate(fileToLoad, len_aligned32);
-    pi_write_raw(fileToLoad, DDR64_BASE_ADDRESS_START, 0, len_aligned32);
+    sendPathToCart(fileToLoad);
 
     uint32_t sdSelectRomFilenameLength = strlen(fileToLoad);
     io_write(DDR64_CIBASE_ADDRESS_START + DDR64_REGISTER_SD_SELECT_ROM, sdSelectRomFilenameLength);
@@ -267,6 +277,23 @@ void loadRomAtSelection(int selection) {
     wait_ms(100);
 }
 
+// Pin the selected rom in the cart's flash library so it boots without
+// loading, or unpin it. Waits like a load, the menu stays up after.
+void pinRomAtSelection(int selection) {
+    g_sendingSelectedRom = true;
+    g_pinningSelectedRom = true;
+
+    char* fileToPin = malloc(256);
+    pathAtSelection(selection, fileToPin);
+    sendPathToCart(fileToPin);
+    io_write(DDR64_CIBASE_ADDRESS_START + DDR64_REGISTER_SD_PIN_ROM, strlen(fileToPin));
+    free(fileToPin);
+
+    g_isLoading = true;
+
+    wait_ms(100);
+}
+
 static uint16_t pc64_sd_wait_single() {
     uint32_t isBusy = io_read(DDR64_CIBASE_ADDRESS_START + DDR64_REGISTER_SD_BUSY);
     return isBusy;
@@ -631,6 +658,10 @@ static void draw_bottom_bar(display_context_t display) {
     graphics_draw_sprite_trans(display, x, BOTTOM_BAR_Y + BOTTOM_BAR_HEIGHT/2 - 10, b_button_icon);
     x += 32 + 2;
     graphics_draw_text(display, x, BOTTOM_BAR_Y + BOTTOM_BAR_HEIGHT/2 - 4, "Back");
+    x += 32;
+
+    x += 16;
+    graphics_draw_text(display, x, BOTTOM_BAR_Y + BOTTOM_BAR_HEIGHT/2 - 4, "R Pin/Unpin");
 }
 
 animation_image_t rom_loading_animation = {
@@ -1071,7 +1102,11 @@ static void show_list(void) {
         if (g_sendingSelectedRom) {
             // check the busy register
             uint16_t sdBusy = pc64_sd_wait_single();
-            if (sdBusy == 0) {
+            if (sdBusy == 0 && g_pinningSelectedRom) {
+                g_isLoading = false;
+                g_sendingSelectedRom = false;
+                g_pinningSelectedRom = false;
+            } else if (sdBusy == 0) {
                 graphics_draw_box(display, SCREEN_WIDTH - 8, 3, 5, 5, graphics_convert_color(WHITE_COLOR));
                 g_isLoading = false;
                 g_sendingSelectedRom = false;
@@ -1129,6 +1164,11 @@ static void show_list(void) {
         } else if (keys.c[0].B) {
             go_up();
 
+        } else if (keys.c[0].R) {
+            if (g_current_dir_entries[g_current_selected_list_item]->type != TYPE_DIRECTORY) {
+                pinRomAtSelection(g_current_selected_list_item);
+            }
+
         } else if (keys.c[0].right) {
             // page forward
             //mag = max_on_screen; // TODO something more sophisticated than this, because we need to handle partial
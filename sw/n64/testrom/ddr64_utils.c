@@ -158,6 +158,19 @@ void configure_sram(void)
 #endif
 }
 
+// Domain 1 (rom) timing as PWD << 8 | LAT, the same layout as the rom header
+uint32_t pi_get_dom1_timing(void)
+{
+	return (IO_READ(PI_BSD_DOM1_PWD_REG) & 0xFF) << 8 | (IO_READ(PI_BSD_DOM1_LAT_REG) & 0xFF);
+}
+
+void pi_set_dom1_timing(uint32_t timing)
+{
+	dma_wait();
+	IO_WRITE(PI_BSD_DOM1_LAT_REG, timing & 0xFF);
+	IO_WRITE(PI_BSD_DOM1_PWD_REG, (timing >> 8) & 0xFF);
+}
+
 void pi_read_raw(void *dest, uint32_t base, uint32_t offset, uint32_t len)
 {
 	assert(dest != NULL);
@@ -24,4 +24,6 @@ void pi_write_raw(const void *src, uint32_t base, uint32_t offset, uint32_t len)
 void pi_write_u32(const uint32_t value, uint32_t base, uint32_t offset);
 void pc64_uart_write(const uint8_t * buf, uint32_t len);
 void verify_memory_range(uint32_t base, uint32_t offset, uint32_t len);
-void configure_sram(void);
\ No newline at end of file
+void configure_sram(void);
+uint32_t pi_get_dom1_timing(void);
+void pi_set_dom1_timing(uint32_t timing);
\ No newline at end of file
@@ -181,6 +181,94 @@
 // 	} while(keepTesting);
 // }
 
+// PI calibration. For every SSI sample delay the rom read strobe (PWD) is
+// stepped down from the boot timing until a block of this rom no longer
+// matches a copy read at the slowest timing. The fastest setting that passed,
+// plus a margin, is saved to the sd card and used for every rom loaded after it.
+#define CALIBRATION_OFFSET         (0x1000) // Past the header and IPL3
+#define CALIBRATION_LENGTH         (0x8000)
+#define CALIBRATION_PASSES         (4)
+#define CALIBRATION_SAMPLE_DLY_MAX (4)
+#define CALIBRATION_PWD_SLOWEST    (0xFF)
+#define CALIBRATION_PWD_MARGIN     (2)
+
+static bool calibration_read_matches(void)
+{
+	for (int pass = 0; pass < CALIBRATION_PASSES; pass++) {
+		data_cache_hit_writeback_invalidate(read_buf, CALIBRATION_LENGTH);
+		pi_read_raw(read_buf, CART_DOM1_ADDR2_START, CALIBRATION_OFFSET, CALIBRATION_LENGTH);
+		if (memcmp(facit_buf, read_buf, CALIBRATION_LENGTH) != 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void set_sample_dly(uint32_t sample_dly)
+{
+	pi_write_u32(sample_dly, DDR64_CIBASE_ADDRESS_START, DDR64_REGISTER_PSRAM_SAMPLE_DLY);
+}
+
+static void run_pi_calibration(void)
+{
+	uint32_t boot_timing = pi_get_dom1_timing();
+	uint32_t lat = boot_timing & 0xFF;
+	uint32_t best_pwd = 0; // None passed yet
+	uint32_t best_sample_dly = 0;
+
+	printf("[ -- ] PI calibration, booted with PWD 0x%02lX\n", boot_timing >> 8);
+
+	// Reference copy at the slowest strobe and the default sample delay
+	set_sample_dly(2);
+	pi_set_dom1_timing(CALIBRATION_PWD_SLOWEST << 8 | lat);
+	data_cache_hit_writeback_invalidate(facit_buf, CALIBRATION_LENGTH);
+	pi_read_raw(facit_buf, CART_DOM1_ADDR2_START, CALIBRATION_OFFSET, CALIBRATION_LENGTH);
+
+	for (uint32_t sample_dly = 0; sample_dly <= CALIBRATION_SAMPLE_DLY_MAX; sample_dly++) {
+		set_sample_dly(sample_dly);
+
+		// Start from the strobe the header booted us with. Slower ones only
+		// give the cart more time, so stop at the first failure.
+		uint32_t fastest = 0;
+		for (uint32_t pwd = boot_timing >> 8; pwd > 0; pwd--) {
+			pi_set_dom1_timing(pwd << 8 | lat);
+			if (!calibration_read_matches()) {
+				break;
+			}
+			fastest = pwd;
+		}
+
+		// Back to a safe strobe before talking to the cart again
+		pi_set_dom1_timing(boot_timing);
+
+		if (fastest == 0) {
+			printf("       sample delay %lu: no passing PWD\n", sample_dly);
+			continue;
+		}
+
+		printf("       sample delay %lu: PWD 0x%02lX\n", sample_dly, fastest);
+		if (best_pwd == 0 || fastest < best_pwd) {
+			best_pwd = fastest;
+			best_sample_dly = sample_dly;
+		}
+	}
+
+	if (best_pwd == 0) {
+		set_sample_dly(2);
+		printf("[FAIL] PI calibration, no setting read the rom back correctly.\n");
+		return;
+	}
+
+	best_pwd += CALIBRATION_PWD_MARGIN;
+	if (best_pwd > CALIBRATION_PWD_SLOWEST) {
+		best_pwd = CALIBRATION_PWD_SLOWEST;
+	}
+	set_sample_dly(best_sample_dly);
+	pi_write_u32((best_pwd << 8 | lat) << 16 | best_sample_dly, DDR64_CIBASE_ADDRESS_START, DDR64_REGISTER_PI_CALIBRATION);
+	printf("[ OK ] PI calibration saved: PWD 0x%02lX, sample delay %lu.\n", best_pwd, best_sample_dly);
+}
+
 int main(void)
 {
 	uint32_t *facit_buf32 = (uint32_t *) facit_buf;
@@ -322,4 +410,16 @@ int main(void)
 	}
 
 	printf("Finished!\n");
+
+	///////////////////////////////////////////////////////////////////////////
+
+	printf("\nPress START to calibrate the PI bus timing.\n");
+	while (true) {
+		controller_scan();
+		struct controller_data keys = get_keys_pressed();
+		if (keys.c[0].start) {
+			run_pi_calibration();
+			break;
+		}
+	}
 }
@@ -0,0 +1,73 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+// Host test of the CRC the rom loader checks PSRAM with. Known values, a
+// bit at a time reference over every alignment, and the result doesn't
+// depend on how the data is split.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+extern "C" {
+#include "crc32.h"
+}
+
+#include "test_check.h"
+
+static uint32_t crc32_bitwise(const uint8_t *data, size_t len) {
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < len; i++) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320u : 0);
+		}
+	}
+	return ~crc;
+}
+
+int main() {
+	const char *check = "123456789";
+	CHECK(crc32_update(0, (const uint8_t *)check, 9) == 0xCBF43926, "check value 0x%08X", crc32_update(0, (const uint8_t *)check, 9));
+	CHECK(crc32_update(0, NULL, 0) == 0, "empty crc not 0");
+
+	std::vector<uint8_t> data(64 * 1024 + 16);
+	uint32_t x = 0x12345678;
+	for (size_t i = 0; i < data.size(); i++) {
+		x = x * 1103515245 + 12345;
+		data[i] = x >> 24;
+	}
+
+	// Every alignment and a tail of every length the word loop leaves
+	for (uint32_t offset = 0; offset < 8; offset++) {
+		for (uint32_t len : { 0u, 1u, 7u, 8u, 9u, 15u, 16u, 17u, 1000u, 64u * 1024 }) {
+			uint32_t expected = crc32_bitwise(&data[offset], len);
+			uint32_t got = crc32_update(0, &data[offset], len);
+			CHECK(got == expected, "offset %u len %u: 0x%08X, expected 0x%08X", offset, len, got, expected);
+		}
+	}
+
+	// A 64KB block fed in the loader's 8KB buffers, and in odd pieces
+	uint32_t whole = crc32_update(0, data.data(), 64 * 1024);
+	uint32_t crc = 0;
+	for (uint32_t i = 0; i < 64 * 1024; i += 8 * 1024) {
+		crc = crc32_update(crc, &data[i], 8 * 1024);
+	}
+	CHECK(crc == whole, "8KB pieces 0x%08X, whole 0x%08X", crc, whole);
+	crc = 0;
+	for (uint32_t i = 0, step = 1; i < 64 * 1024; i += step, step = step * 3 + 1) {
+		uint32_t n = i + step > 64 * 1024 ? 64 * 1024 - i : step;
+		crc = crc32_update(crc, &data[i], n);
+	}
+	CHECK(crc == whole, "odd pieces 0x%08X, whole 0x%08X", crc, whole);
+
+	// A flipped bit anywhere in the block changes it
+	data[12345] ^= 0x10;
+	CHECK(crc32_update(0, data.data(), 64 * 1024) != whole, "flipped bit not seen");
+
+	return test_result();
+}
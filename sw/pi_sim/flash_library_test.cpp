@@ -0,0 +1,113 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+// Host test of the flash array rom library table: picking the current copy,
+// handing out the least worn blocks and evicting unpinned roms for new ones.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "flash_array.h"
+#include "test_check.h"
+
+static flash_library_t library;
+static flash_library_t other;
+
+// Puts a rom of `blocks` blocks in the library the way the loader does
+static int add_rom(const char *path, uint32_t blocks, uint16_t flags) {
+	int entry = flash_library_make_room(&library, blocks);
+	if (entry == FLASH_LIBRARY_NO_ENTRY) {
+		return entry;
+	}
+	for (uint32_t i = 0; i < blocks; i++) {
+		flash_library_alloc_block(&library, entry);
+	}
+	flash_library_entry_t *e = &library.entries[entry];
+	snprintf(e->path, sizeof(e->path), "%s", path);
+	e->size = blocks * FLASH_ARRAY_BLOCK_BYTES - FLASH_ARRAY_MAPPING_BYTES;
+	e->added = library.sequence + 1;
+	e->flags = flags;
+	flash_library_seal(&library);
+	return entry;
+}
+
+static void check_copies() {
+	flash_library_init(&library);
+	flash_library_init(&other);
+	CHECK(flash_library_newest(&library, &other) == NULL, "unsealed tables are valid");
+
+	CHECK(flash_library_seal(&library) == 1, "first table goes to the second copy");
+	memcpy(&other, &library, sizeof(library));
+	CHECK(flash_library_seal(&other) == 0, "second table goes to the first copy");
+	CHECK(flash_library_newest(&library, &other) == &other, "newer copy not picked");
+	CHECK(flash_library_newest(&other, &library) == &other, "newer copy not picked when second");
+
+	// Cut off while it was programmed
+	other.entries[3].path[7] ^= 0x20;
+	CHECK(flash_library_newest(&library, &other) == &library, "damaged copy picked");
+}
+
+static void check_wear() {
+	flash_library_init(&library);
+	for (int i = 0; i < FLASH_ARRAY_BLOCKS; i++) {
+		library.erase_count[i] = 10;
+	}
+	library.erase_count[300] = 2;
+	library.erase_count[7] = 3;
+
+	CHECK(flash_library_alloc_block(&library, 0) == 300, "least worn block not handed out first");
+	CHECK(flash_library_alloc_block(&library, 0) == 7, "next least worn block not handed out");
+	CHECK(library.erase_count[300] == 3, "erase not counted");
+	CHECK(library.owner[0] == FLASH_LIBRARY_BLOCK_TABLE, "table block handed out");
+	CHECK(flash_library_free_blocks(&library) == FLASH_ARRAY_BLOCKS - 3, "free blocks %u", flash_library_free_blocks(&library));
+
+	flash_library_remove(&library, 0);
+	CHECK(flash_library_free_blocks(&library) == FLASH_ARRAY_BLOCKS - 1, "removed rom kept its blocks");
+	CHECK(library.erase_count[300] == 3, "removing a rom changed the wear");
+}
+
+static void check_eviction() {
+	const uint32_t rom = 128; // 8MB roms, 3 fill most of the 32MB array
+	flash_library_init(&library);
+
+	int old = add_rom("old.z64", rom, 0);
+	int pinned = add_rom("pinned.z64", rom, FLASH_LIBRARY_PINNED);
+	int recent = add_rom("recent.z64", rom, 0);
+	CHECK(old >= 0 && pinned >= 0 && recent >= 0, "roms didn't fit");
+	CHECK(flash_library_find(&library, "pinned.z64", library.entries[pinned].size, 0, 0) == pinned, "pinned rom not found");
+	CHECK(flash_library_find(&library, "pinned.z64", library.entries[pinned].size + 1, 0, 0) == FLASH_LIBRARY_NO_ENTRY, "changed rom found");
+
+	// Needs the oldest unpinned rom's blocks
+	int next = add_rom("next.z64", rom, 0);
+	CHECK(next >= 0, "no room made");
+	CHECK(flash_library_find(&library, "old.z64", library.entries[next].size, 0, 0) == FLASH_LIBRARY_NO_ENTRY, "oldest rom kept");
+	CHECK(flash_library_find(&library, "recent.z64", library.entries[recent].size, 0, 0) == recent, "newer rom evicted first");
+	CHECK(flash_library_find(&library, "pinned.z64", library.entries[pinned].size, 0, 0) == pinned, "pinned rom evicted");
+
+	// More than the pinned rom leaves, nothing is evicted
+	flash_library_entry_t before[FLASH_LIBRARY_ENTRIES];
+	memcpy(before, library.entries, sizeof(before));
+	CHECK(flash_library_make_room(&library, FLASH_ARRAY_BLOCKS - rom) == FLASH_LIBRARY_NO_ENTRY, "room past the pinned rom");
+	CHECK(memcmp(before, library.entries, sizeof(before)) == 0, "roms evicted for a rom that doesn't fit");
+
+	// Small roms run out of entries before blocks
+	flash_library_init(&library);
+	for (int i = 0; i < FLASH_LIBRARY_ENTRIES; i++) {
+		char path[16];
+		snprintf(path, sizeof(path), "%d.z64", i);
+		CHECK(add_rom(path, 1, FLASH_LIBRARY_PINNED) == i, "small rom %d", i);
+	}
+	CHECK(flash_library_make_room(&library, 1) == FLASH_LIBRARY_NO_ENTRY, "entry found past pinned roms");
+}
+
+int main() {
+	check_copies();
+	check_wear();
+	check_eviction();
+
+	return test_result();
+}
@@ -0,0 +1,3 @@
+// PI sim stand-in, see sim_sdk.h
+#pragma once
+#include "sim_sdk.h"
@@ -0,0 +1,13 @@
+// PI sim stand-in, see sim_sdk.h
+#pragma once
+#include "sim_sdk.h"
+
+// The PIO program itself is modelled by the bus model in sim_hw.cpp
+extern const pio_program_t n64_pi_program;
+
+static inline void n64_pi_program_init(PIO pio, uint sm, uint offset)
+{
+	(void)pio;
+	(void)sm;
+	(void)offset;
+}
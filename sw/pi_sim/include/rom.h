@@ -0,0 +1,3 @@
+// PI sim stand-in for the generated rom.h.
+// rom_chunks and friends are provided by sim_stubs.cpp and filled at runtime.
+#pragma once
@@ -0,0 +1,357 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+// Minimal stand-in for the parts of the pico-sdk used by n64_pi_task.c.
+//
+// The firmware talks to the PIO and DMA blocks through plain register
+// accesses (pio->fstat, pio->rxf[0], dma_hw->ch[n].al1_ctrl...). The sim
+// compiles n64_pi_task.c as C++ so those registers can be proxy objects: every
+// read or write is routed into the bus/DMA model in sim_hw.cpp, which advances
+// the simulated clock and charges cycles for the access. The firmware source
+// itself carries no sim specific code.
+
+#pragma once
+
+#ifndef __cplusplus
+#error "The PI sim headers must be compiled as C++"
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <assert.h>
+
+typedef unsigned int uint;
+
+#define __not_in_flash_func(func_name) func_name
+#define __no_inline_not_in_flash_func(func_name) __attribute__((noinline)) func_name
+#define __noinline __attribute__((noinline))
+#define __unused __attribute__((unused))
+#define __time_critical_func(func_name) func_name
+
+static inline void tight_loop_contents(void) {}
+
+////////////////////////////////////////////////////////////
+// Register proxies
+
+typedef enum {
+	SIM_REG_PIO_FSTAT,
+	SIM_REG_PIO_TXF,
+	SIM_REG_PIO_RXF,
+	SIM_REG_DMA_READ_ADDR,
+	SIM_REG_DMA_WRITE_ADDR,
+	SIM_REG_DMA_TRANS_COUNT,
+	SIM_REG_DMA_CTRL,
+	SIM_REG_DMA_READ_ADDR_TRIG,
+	SIM_REG_DMA_WRITE_ADDR_TRIG,
+	SIM_REG_DMA_TRANS_COUNT_TRIG,
+	SIM_REG_DMA_CTRL_TRIG,
+	SIM_REG_DMA_MULTI_CHAN_TRIGGER,
+	SIM_REG_DMA_ABORT,
+	SIM_REG_SSI_SSIENR,
+	SIM_REG_SSI_CTRLR1,
+	SIM_REG_SSI_DR0,
+	SIM_REG_SSI_BAUDR,
+	SIM_REG_SSI_DMACR,
+	SIM_REG_XIP_CTRL,
+	SIM_REG_XIP_FLUSH,
+	SIM_REG_NONE,
+} sim_reg_id_t;
+
+uintptr_t sim_reg_read(sim_reg_id_t id, int index);
+void sim_reg_write(sim_reg_id_t id, int index, uintptr_t value);
+
+// 32-bit register
+struct sim_reg {
+	sim_reg_id_t id = SIM_REG_NONE;
+	int index = 0;
+
+	void bind(sim_reg_id_t new_id, int new_index) { id = new_id; index = new_index; }
+	operator uint32_t() const { return (uint32_t)sim_reg_read(id, index); }
+	sim_reg &operator=(uint32_t value) { sim_reg_write(id, index, value); return *this; }
+	sim_reg &operator=(const sim_reg &other) { sim_reg_write(id, index, (uint32_t)other); return *this; }
+};
+
+// Address register. Host pointers are 64-bit, so these keep the full width.
+struct sim_addr_reg {
+	sim_reg_id_t id = SIM_REG_NONE;
+	int index = 0;
+
+	void bind(sim_reg_id_t new_id, int new_index) { id = new_id; index = new_index; }
+	operator uintptr_t() const { return sim_reg_read(id, index); }
+	sim_addr_reg &operator=(uintptr_t value) { sim_reg_write(id, index, value); return *this; }
+	sim_addr_reg &operator=(const sim_addr_reg &other) { sim_reg_write(id, index, (uintptr_t)other); return *this; }
+};
+
+typedef volatile uint32_t io_rw_32;
+typedef const volatile uint32_t io_ro_32;
+typedef volatile uint32_t io_wo_32;
+typedef volatile uint16_t io_rw_16;
+typedef volatile uint8_t io_rw_8;
+
+////////////////////////////////////////////////////////////
+// PIO
+
+#define NUM_PIO_STATE_MACHINES 4
+#define PIO_FSTAT_RXFULL_LSB  0
+#define PIO_FSTAT_RXEMPTY_LSB 8
+#define PIO_FSTAT_TXFULL_LSB  16
+#define PIO_FSTAT_TXEMPTY_LSB 24
+
+typedef struct {
+	sim_reg fstat;
+	sim_reg txf[NUM_PIO_STATE_MACHINES];
+	sim_reg rxf[NUM_PIO_STATE_MACHINES];
+} pio_hw_t;
+
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t sim_pio_hw[2];
+#define pio0 (&sim_pio_hw[0])
+#define pio1 (&sim_pio_hw[1])
+
+typedef struct {
+	const uint16_t *instructions;
+	uint8_t length;
+	int8_t origin;
+} pio_program_t;
+
+typedef struct {
+	uint32_t clkdiv;
+	uint32_t execctrl;
+	uint32_t shiftctrl;
+	uint32_t pinctrl;
+} pio_sm_config;
+
+enum pio_interrupt_source {
+	pis_sm0_rx_fifo_not_empty = 0,
+};
+
+uint pio_add_program(PIO pio, const pio_program_t *program);
+void pio_remove_program(PIO pio, const pio_program_t *program, uint loaded_offset);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+void pio_sm_put(PIO pio, uint sm, uint32_t data);
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data);
+uint32_t pio_sm_get(PIO pio, uint sm);
+uint32_t pio_sm_get_blocking(PIO pio, uint sm);
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm);
+void pio_set_irq0_source_enabled(PIO pio, enum pio_interrupt_source source, bool enabled);
+
+static inline uint pio_encode_jmp(uint addr)
+{
+	return addr & 0x1f;
+}
+
+////////////////////////////////////////////////////////////
+// DMA
+
+#define NUM_DMA_CHANNELS 12
+
+#define DMA_CH0_CTRL_TRIG_EN_BITS            0x00000001
+#define DMA_CH0_CTRL_TRIG_HIGH_PRIORITY_BITS 0x00000002
+#define DMA_CH0_CTRL_TRIG_DATA_SIZE_LSB      2
+#define DMA_CH0_CTRL_TRIG_DATA_SIZE_BITS     0x0000000c
+#define DMA_CH0_CTRL_TRIG_INCR_READ_BITS     0x00000010
+#define DMA_CH0_CTRL_TRIG_INCR_WRITE_BITS    0x00000020
+#define DMA_CH0_CTRL_TRIG_RING_SIZE_LSB      6
+#define DMA_CH0_CTRL_TRIG_RING_SIZE_BITS     0x000003c0
+#define DMA_CH0_CTRL_TRIG_RING_SEL_BITS      0x00000400
+#define DMA_CH0_CTRL_TRIG_CHAIN_TO_LSB       11
+#define DMA_CH0_CTRL_TRIG_CHAIN_TO_BITS      0x00007800
+#define DMA_CH0_CTRL_TRIG_TREQ_SEL_LSB       15
+#define DMA_CH0_CTRL_TRIG_TREQ_SEL_BITS      0x001f8000
+#define DMA_CH0_CTRL_TRIG_BSWAP_BITS         0x00400000
+#define DMA_CH0_CTRL_TRIG_BUSY_BITS          0x01000000
+
+typedef struct {
+	sim_addr_reg read_addr;
+	sim_addr_reg write_addr;
+	sim_reg transfer_count;
+	sim_reg ctrl_trig;
+
+	sim_reg al1_ctrl;
+	sim_addr_reg al1_read_addr;
+	sim_addr_reg al1_write_addr;
+	sim_reg al1_transfer_count_trig;
+
+	sim_reg al2_ctrl;
+	sim_reg al2_transfer_count;
+	sim_addr_reg al2_read_addr;
+	sim_addr_reg al2_write_addr_trig;
+
+	sim_reg al3_ctrl;
+	sim_addr_reg al3_write_addr;
+	sim_reg al3_transfer_count;
+	sim_addr_reg al3_read_addr_trig;
+} dma_channel_hw_t;
+
+typedef struct {
+	dma_channel_hw_t ch[NUM_DMA_CHANNELS];
+	sim_reg multi_channel_trigger;
+	sim_reg abort;
+} dma_hw_t;
+
+extern dma_hw_t sim_dma_hw;
+#define dma_hw (&sim_dma_hw)
+
+enum dma_channel_transfer_size {
+	DMA_SIZE_8 = 0,
+	DMA_SIZE_16 = 1,
+	DMA_SIZE_32 = 2
+};
+
+typedef struct {
+	uint32_t ctrl;
+} dma_channel_config;
+
+int dma_claim_unused_channel(bool required);
+void dma_channel_unclaim(uint channel);
+dma_channel_config dma_channel_get_default_config(uint channel);
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr, const volatile void *read_addr, uint transfer_count, bool trigger);
+void dma_channel_start(uint channel);
+void dma_channel_abort(uint channel);
+bool dma_channel_is_busy(uint channel);
+void dma_channel_wait_for_finish_blocking(uint channel);
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger);
+void dma_channel_set_write_addr(uint channel, volatile void *write_addr, bool trigger);
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger);
+
+static inline void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size)
+{
+	c->ctrl = (c->ctrl & ~DMA_CH0_CTRL_TRIG_DATA_SIZE_BITS) | (((uint)size) << DMA_CH0_CTRL_TRIG_DATA_SIZE_LSB);
+}
+
+static inline void channel_config_set_read_increment(dma_channel_config *c, bool incr)
+{
+	c->ctrl = incr ? (c->ctrl | DMA_CH0_CTRL_TRIG_INCR_READ_BITS) : (c->ctrl & ~DMA_CH0_CTRL_TRIG_INCR_READ_BITS);
+}
+
+static inline void channel_config_set_write_increment(dma_channel_config *c, bool incr)
+{
+	c->ctrl = incr ? (c->ctrl | DMA_CH0_CTRL_TRIG_INCR_WRITE_BITS) : (c->ctrl & ~DMA_CH0_CTRL_TRIG_INCR_WRITE_BITS);
+}
+
+static inline void channel_config_set_bswap(dma_channel_config *c, bool bswap)
+{
+	c->ctrl = bswap ? (c->ctrl | DMA_CH0_CTRL_TRIG_BSWAP_BITS) : (c->ctrl & ~DMA_CH0_CTRL_TRIG_BSWAP_BITS);
+}
+
+static inline void channel_config_set_high_priority(dma_channel_config *c, bool high_priority)
+{
+	c->ctrl = high_priority ? (c->ctrl | DMA_CH0_CTRL_TRIG_HIGH_PRIORITY_BITS) : (c->ctrl & ~DMA_CH0_CTRL_TRIG_HIGH_PRIORITY_BITS);
+}
+
+static inline void channel_config_set_ring(dma_channel_config *c, bool write, uint size_bits)
+{
+	c->ctrl = (c->ctrl & ~(DMA_CH0_CTRL_TRIG_RING_SIZE_BITS | DMA_CH0_CTRL_TRIG_RING_SEL_BITS)) |
+		(size_bits << DMA_CH0_CTRL_TRIG_RING_SIZE_LSB) |
+		(write ? DMA_CH0_CTRL_TRIG_RING_SEL_BITS : 0);
+}
+
+static inline void channel_config_set_chain_to(dma_channel_config *c, uint chain_to)
+{
+	c->ctrl = (c->ctrl & ~DMA_CH0_CTRL_TRIG_CHAIN_TO_BITS) | (chain_to << DMA_CH0_CTRL_TRIG_CHAIN_TO_LSB);
+}
+
+static inline void channel_config_set_dreq(dma_channel_config *c, uint dreq)
+{
+	c->ctrl = (c->ctrl & ~DMA_CH0_CTRL_TRIG_TREQ_SEL_BITS) | (dreq << DMA_CH0_CTRL_TRIG_TREQ_SEL_LSB);
+}
+
+////////////////////////////////////////////////////////////
+// SSI
+//
+// Only what the rom stream uses is modelled, the other registers read as 0
+// and ignore writes.
+
+#define DREQ_XIP_SSIRX 39
+#define SSI_DMACR_RDMAE_BITS 0x00000001
+#define SSI_DMACR_TDMAE_BITS 0x00000002
+
+typedef struct {
+	sim_reg ctrlr0;
+	sim_reg ctrlr1;
+	sim_reg ssienr;
+	sim_reg ser;
+	sim_reg baudr;
+	sim_reg txflr;
+	sim_reg rxflr;
+	sim_reg sr;
+	sim_reg icr;
+	sim_reg dmacr;
+	sim_reg dmardlr;
+	sim_reg dr0;
+	sim_reg rx_sample_dly;
+	sim_reg spi_ctrlr0;
+} ssi_hw_t;
+
+extern ssi_hw_t sim_ssi_hw;
+#define ssi_hw (&sim_ssi_hw)
+
+////////////////////////////////////////////////////////////
+// XIP
+//
+// The cached alias at XIP_BASE goes through a model of the 16KB cache, the
+// uncached ones straight to the selected PSRAM chip.
+
+#define XIP_BASE 0x10000000
+#define XIP_NOCACHE_NOALLOC_BASE 0x13000000
+#define XIP_CTRL_EN_BITS 0x00000001
+
+typedef struct {
+	sim_reg ctrl;
+	sim_reg flush;
+	sim_reg stat;
+} xip_ctrl_hw_t;
+
+extern xip_ctrl_hw_t sim_xip_ctrl_hw;
+#define xip_ctrl_hw (&sim_xip_ctrl_hw)
+
+////////////////////////////////////////////////////////////
+// GPIO, multicore, misc
+
+enum gpio_function {
+	GPIO_FUNC_SIO = 5,
+	GPIO_FUNC_PIO0 = 6,
+	GPIO_FUNC_PIO1 = 7,
+};
+
+#define GPIO_OUT 1
+#define GPIO_IN 0
+
+enum gpio_drive_strength {
+	GPIO_DRIVE_STRENGTH_2MA = 0,
+	GPIO_DRIVE_STRENGTH_4MA = 1,
+	GPIO_DRIVE_STRENGTH_8MA = 2,
+	GPIO_DRIVE_STRENGTH_12MA = 3
+};
+
+// Drive strength and function take plain integers, gpio_helper.h passes them
+// around as uint8_t which C++ won't convert back to the enums
+bool gpio_get(uint gpio);
+void gpio_put(uint gpio, bool value);
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_set_pulls(uint gpio, bool up, bool down);
+void gpio_set_drive_strength(uint gpio, uint drive);
+void gpio_set_function(uint gpio, uint fn);
+
+void multicore_fifo_push_blocking(uint32_t data);
+bool multicore_fifo_rvalid(void);
+uint32_t multicore_fifo_pop_blocking(void);
+
+uint32_t time_us_32(void);
+
+enum clock_index {
+	clk_sys = 5,
+};
+
+// Reports the simulated --sys-mhz
+uint32_t clock_get_hz(enum clock_index clk_index);
+
+typedef struct uart_inst uart_inst_t;
@@ -0,0 +1,4 @@
+// PI sim stand-in, see sim_sdk.h. The async uart isn't used by the PI
+// handler, and its inline helpers don't build as C++.
+#pragma once
+#include "sim_sdk.h"
@@ -0,0 +1,218 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+// Host test of the packet codec mcu1 and mcu2 talk over. Packets round trip,
+// sent a byte at a time or framed in one buffer. Every flipped bit and every
+// dropped byte is caught, the receiver finds the next packet afterwards, and
+// random noise never delivers a packet that wasn't sent.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+extern "C" {
+#include "mcu_packet.h"
+}
+
+#include "test_check.h"
+
+#define CMD_DATA 0x44
+#define CMD_UNKNOWN 0x55
+
+static std::vector<uint8_t> wire;
+static uint8_t rx_buf[MCU_PACKET_MAX_PAYLOAD];
+
+static void wire_putc(uint8_t byte) {
+	wire.push_back(byte);
+}
+
+static uint8_t *buffer_for(uint8_t cmd, uint16_t len) {
+	return cmd == CMD_UNKNOWN ? NULL : rx_buf;
+}
+
+struct packet {
+	uint8_t cmd;
+	uint8_t seq;
+	std::vector<uint8_t> payload;
+};
+
+static uint32_t rng = 0x2468ACE1;
+static uint32_t next_random() {
+	rng = rng * 1103515245 + 12345;
+	return rng >> 8;
+}
+
+// Payload without a start byte, so a receiver hunting through it can't
+// lock onto a start that isn't there
+static std::vector<uint8_t> make_payload(uint32_t len, uint8_t salt) {
+	std::vector<uint8_t> payload(len);
+	for (uint32_t i = 0; i < len; i++) {
+		payload[i] = (i * 7 + salt) % MCU_PACKET_START;
+	}
+	return payload;
+}
+
+static std::vector<packet> decode(mcu_packet_rx_t *rx, const std::vector<uint8_t> &bytes) {
+	std::vector<packet> packets;
+	for (uint8_t byte : bytes) {
+		if (mcu_packet_rx_feed(rx, byte) == MCU_PACKET_READY) {
+			packets.push_back({ rx->cmd, rx->seq, std::vector<uint8_t>(rx->payload, rx->payload + rx->len) });
+		}
+	}
+	return packets;
+}
+
+// Three 64 byte packets, seq 0, 1 and 2
+static std::vector<uint8_t> three_packets(mcu_packet_tx_t *tx) {
+	wire.clear();
+	mcu_packet_tx_init(tx, wire_putc);
+	for (uint8_t i = 0; i < 3; i++) {
+		std::vector<uint8_t> payload = make_payload(64, i);
+		mcu_packet_send(tx, CMD_DATA, payload.data(), payload.size());
+	}
+	return wire;
+}
+
+static bool has_packet(const std::vector<packet> &packets, uint8_t seq) {
+	std::vector<uint8_t> payload = make_payload(64, seq);
+	for (const packet &p : packets) {
+		if (p.seq == seq && p.cmd == CMD_DATA && p.payload == payload) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int main() {
+	mcu_packet_tx_t tx;
+	mcu_packet_rx_t rx;
+
+	// Round trip, and the byte at a time writer sends the same bytes
+	for (uint32_t len : { 0u, 1u, 12u, 512u, 2048u, (uint32_t)MCU_PACKET_MAX_PAYLOAD }) {
+		std::vector<uint8_t> payload = make_payload(len, len);
+		wire.clear();
+		mcu_packet_tx_init(&tx, wire_putc);
+		mcu_packet_send(&tx, CMD_DATA, payload.data(), len);
+		std::vector<uint8_t> sent = wire;
+		CHECK(sent.size() == MCU_PACKET_HEADER_BYTES + len + MCU_PACKET_CRC_BYTES, "len %u: %zu bytes on the wire", len, sent.size());
+
+		wire.clear();
+		mcu_packet_tx_init(&tx, wire_putc);
+		mcu_packet_tx_begin(&tx, CMD_DATA, len);
+		for (uint8_t byte : payload) {
+			mcu_packet_tx_put(&tx, byte);
+		}
+		mcu_packet_tx_end(&tx);
+		CHECK(wire == sent, "len %u: put and write differ", len);
+
+		// Framed in place for DMA
+		std::vector<uint8_t> frame(MCU_PACKET_FRAME_BYTES(len));
+		memcpy(MCU_PACKET_FRAME_PAYLOAD(frame.data()), payload.data(), len);
+		mcu_packet_tx_init(&tx, wire_putc);
+		uint32_t frame_bytes = mcu_packet_frame(&tx, CMD_DATA, frame.data(), len);
+		CHECK(frame_bytes == frame.size() && frame == sent, "len %u: frame differs", len);
+
+		mcu_packet_rx_init(&rx, buffer_for);
+		std::vector<packet> got = decode(&rx, sent);
+		CHECK(got.size() == 1 && got[0].cmd == CMD_DATA && got[0].payload == payload, "len %u: not received", len);
+		CHECK(rx.bad == 0, "len %u: %u bad", len, rx.bad);
+	}
+
+	// Debug bytes between packets are skipped
+	std::vector<uint8_t> clean = three_packets(&tx);
+	std::vector<uint8_t> noisy;
+	const uint8_t debug[] = { 0xAA, 0x81, 0x00, 0x10, 0x00, 0xBB, 0xAB, MCU_PACKET_START, 0x00, MCU_PACKET_START };
+	size_t packet_bytes = clean.size() / 3;
+	for (int i = 0; i < 3; i++) {
+		noisy.insert(noisy.end(), debug, debug + sizeof(debug));
+		noisy.insert(noisy.end(), clean.begin() + i * packet_bytes, clean.begin() + (i + 1) * packet_bytes);
+	}
+	mcu_packet_rx_init(&rx, buffer_for);
+	std::vector<packet> got = decode(&rx, noisy);
+	CHECK(got.size() == 3 && has_packet(got, 0) && has_packet(got, 1) && has_packet(got, 2), "noisy link: %zu packets", got.size());
+	CHECK(rx.bad == 0 && rx.missed == 0, "noisy link: %u bad, %u missed", rx.bad, rx.missed);
+
+	// Every flipped bit of the first packet loses it and only it
+	for (size_t bit = 0; bit < packet_bytes * 8; bit++) {
+		std::vector<uint8_t> bytes = clean;
+		bytes[bit / 8] ^= 1 << (bit % 8);
+		mcu_packet_rx_init(&rx, buffer_for);
+		got = decode(&rx, bytes);
+		CHECK(!has_packet(got, 0) && has_packet(got, 1) && has_packet(got, 2) && got.size() == 2, "bit %zu: %zu packets", bit, got.size());
+		CHECK(rx.bad + rx.missed >= 1 || bit < 16, "bit %zu: not counted", bit);
+	}
+
+	// A dropped byte loses its packet, and at most the next one with it
+	for (size_t i = 0; i < packet_bytes; i++) {
+		std::vector<uint8_t> bytes = clean;
+		bytes.erase(bytes.begin() + i);
+		mcu_packet_rx_init(&rx, buffer_for);
+		got = decode(&rx, bytes);
+		CHECK(!has_packet(got, 0) && has_packet(got, 2), "dropped byte %zu: %zu packets", i, got.size());
+		for (const packet &p : got) {
+			CHECK(has_packet(got, p.seq), "dropped byte %zu: bad packet delivered", i);
+		}
+	}
+
+	// Lost packets are counted by seq
+	mcu_packet_rx_init(&rx, buffer_for);
+	got = decode(&rx, std::vector<uint8_t>(clean.begin(), clean.begin() + packet_bytes));
+	got = decode(&rx, std::vector<uint8_t>(clean.begin() + 2 * packet_bytes, clean.end()));
+	CHECK(got.size() == 1 && rx.missed == 1, "seq gap: %u missed", rx.missed);
+
+	// A packet with nowhere to go is dropped, the one after it isn't
+	wire.clear();
+	mcu_packet_tx_init(&tx, wire_putc);
+	std::vector<uint8_t> payload = make_payload(64, 0);
+	mcu_packet_send(&tx, CMD_UNKNOWN, payload.data(), payload.size());
+	payload = make_payload(64, 1);
+	mcu_packet_send(&tx, CMD_DATA, payload.data(), payload.size());
+	mcu_packet_rx_init(&rx, buffer_for);
+	got = decode(&rx, wire);
+	CHECK(got.size() == 1 && has_packet(got, 1) && rx.bad == 1, "dropped packet: %zu packets, %u bad", got.size(), rx.bad);
+
+	// Fuzz: packets with random damage, each followed by random bytes with
+	// plenty of start bytes in them. Anything delivered was sent, and every
+	// undamaged packet gets through.
+	mcu_packet_rx_init(&rx, buffer_for);
+	mcu_packet_tx_init(&tx, wire_putc);
+	uint32_t damaged = 0, delivered = 0;
+	for (int round = 0; round < 20000; round++) {
+		wire.clear();
+		uint8_t seq = tx.seq;
+		payload = make_payload(next_random() % 600, seq);
+		mcu_packet_send(&tx, CMD_DATA, payload.data(), payload.size());
+		bool damage = next_random() % 4 == 0;
+		if (damage) {
+			wire[next_random() % wire.size()] ^= 1 << (next_random() % 8);
+			damaged++;
+		}
+		uint32_t noise = next_random() % 32;
+		for (uint32_t i = 0; i < noise; i++) {
+			uint32_t r = next_random();
+			wire.push_back(r & 0x300 ? r : (r & 1 ? MCU_PACKET_START : MCU_PACKET_START2));
+		}
+
+		bool received = false;
+		for (uint8_t byte : wire) {
+			if (mcu_packet_rx_feed(&rx, byte) == MCU_PACKET_READY) {
+				bool match = rx.cmd == CMD_DATA && rx.seq == seq && rx.len == payload.size() &&
+					memcmp(rx.payload, payload.data(), payload.size()) == 0;
+				CHECK(match && !damage, "fuzz round %d: delivered a packet that wasn't sent", round);
+				received = true;
+				delivered++;
+			}
+		}
+		CHECK(damage || received, "fuzz round %d: clean packet lost", round);
+
+		// The noise may have left a false start part way in
+		mcu_packet_rx_reset(&rx);
+	}
+	printf("fuzz: %u damaged, %u delivered, %u bad\n", damaged, delivered, rx.bad);
+
+	return test_result();
+}
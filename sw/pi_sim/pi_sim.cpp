@@ -0,0 +1,500 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+// Host-side PI bus simulator. Replays an N64 bus trace against the real
+// n64_pi_run() and reports, per address region, how long the handler took to
+// answer every read strobe compared to the strobe length the N64 allows.
+//
+// Usage: pi_sim [options] [trace file]
+//   --rom <file.z64>     serve this rom image (default: address pattern)
+//   --rom-mb <n>         size of the address pattern rom (default 32)
+//   --flash              serve the rom from mcu1's flash instead of PSRAM
+//   --flash-array        serve the rom deduplicated from the flash array chips
+//   --pad-mb <n>         the last n MB of the address pattern rom are 0xFF
+//   --xip-cache          serve the PSRAM rom through the XIP cache
+//   --ready-mb <n>       only the first n MB of the rom are loaded yet
+//   --sys-mhz <mhz>      rp2040 system clock (default 266)
+//   --qspi-div <div>     QSPI clock divider (default QSPI_QUAD_MODE_CLK_DIVIDER)
+//   --pwd <n>            run the bus with this PWD instead of the served one
+//   --synthetic <n>      generate a boot + n random transactions trace
+//   --seed <n>           seed for the synthetic trace
+//   --write-trace <file> save the trace that was replayed
+//   --bench-dispatch     compare address dispatch schemes for the trace
+//   --bench-chunks       compare flash rom chunk sizes for the rom and trace
+//   --expect-header <hex> fail unless the last rom header served matches
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "sim_hw.h"
+#include "sim_bench.h"
+
+#include "n64_defs.h"
+#include "ddr64_regs.h"
+#include "n64_pi_task.h"
+#include "sram.h"
+
+#define SIM_PI_PAGE_SIZE (512)
+
+static uint32_t xorshift_state = 0x2545F491;
+
+static uint32_t xorshift32(void)
+{
+	uint32_t x = xorshift_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	xorshift_state = x;
+	return x;
+}
+
+static uint32_t random_range(uint32_t min, uint32_t max)
+{
+	return min + xorshift32() % (max - min + 1);
+}
+
+static void add_read_txn(std::vector<sim_txn_t> &trace, uint32_t address, uint32_t halfwords, uint32_t idle_rcp)
+{
+	sim_txn_t txn = { address, idle_rcp, {} };
+	txn.ops.push_back({ false, halfwords, 0 });
+	trace.push_back(txn);
+}
+
+static void add_write_txn(std::vector<sim_txn_t> &trace, uint32_t address, uint32_t halfwords, uint32_t idle_rcp)
+{
+	sim_txn_t txn = { address, idle_rcp, {} };
+	for (uint32_t i = 0; i < halfwords; i++) {
+		txn.ops.push_back({ true, 1, (uint16_t)xorshift32() });
+	}
+	trace.push_back(txn);
+}
+
+// Roughly what a game does: the IPL reads the header and IPL3, IPL3 loads the
+// boot segment, then the game streams pages with the odd save access and
+// register poke in between.
+static void generate_synthetic_trace(std::vector<sim_txn_t> &trace, uint32_t count, uint32_t rom_size)
+{
+	uint32_t idle = sim_config.default_idle_rcp;
+
+	// Header, IPL3 and the boot segment
+	add_read_txn(trace, CART_DOM1_ADDR2_START, 2, idle);
+	for (uint32_t offset = 0x40; offset < 0x1000; offset += 4) {
+		add_read_txn(trace, CART_DOM1_ADDR2_START + offset, 2, idle);
+	}
+	for (uint32_t offset = 0x1000; offset < 0x101000 && offset < rom_size; offset += SIM_PI_PAGE_SIZE) {
+		add_read_txn(trace, CART_DOM1_ADDR2_START + offset, SIM_PI_PAGE_SIZE / 2, idle);
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t kind = random_range(0, 99);
+		uint32_t gap = random_range(8, 64);
+
+		if (kind < 80) {
+			// ROM page, mostly full and aligned
+			uint32_t offset = random_range(0x1000, rom_size - 2) & ~1;
+			uint32_t len;
+			if (random_range(0, 99) < 70) {
+				offset &= ~(SIM_PI_PAGE_SIZE - 1);
+				len = SIM_PI_PAGE_SIZE;
+			} else {
+				len = random_range(2, SIM_PI_PAGE_SIZE) & ~1;
+				len = std::min(len, SIM_PI_PAGE_SIZE - (offset & (SIM_PI_PAGE_SIZE - 1)));
+			}
+			add_read_txn(trace, CART_DOM1_ADDR2_START + offset, len / 2, gap);
+		} else if (kind < 90) {
+			// Single 32-bit read through PI_RD
+			uint32_t offset = random_range(0x1000, rom_size - 4) & ~3;
+			add_read_txn(trace, CART_DOM1_ADDR2_START + offset, 2, gap);
+		} else if (kind < 95) {
+			// Save data, inside the 256kbit of SRAM the handler allocates
+			uint32_t offset = random_range(0, SRAM_256KBIT_SIZE - 0x100) & ~1;
+			uint32_t halfwords = random_range(2, 64);
+			if (xorshift32() & 1) {
+				add_write_txn(trace, CART_SRAM_START + offset, halfwords, gap);
+			} else {
+				add_read_txn(trace, CART_SRAM_START + offset, halfwords, gap);
+			}
+		} else if (kind < 98) {
+			// Menu polling a register
+			uint32_t reg = (xorshift32() & 1) ? DDR64_REGISTER_MAGIC : DDR64_REGISTER_SD_BUSY;
+			add_read_txn(trace, DDR64_CIBASE_ADDRESS_START + reg, 2, gap);
+		} else {
+			uint32_t offset = random_range(0, DDR64_BASE_ADDRESS_LENGTH - 8) & ~3;
+			add_write_txn(trace, DDR64_BASE_ADDRESS_START + offset, 2, gap);
+			add_read_txn(trace, DDR64_BASE_ADDRESS_START + offset, 2, idle);
+		}
+	}
+}
+
+static bool parse_trace(const char *path, std::vector<sim_txn_t> &trace)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		printf("Unable to open trace %s\n", path);
+		return false;
+	}
+
+	char line[256];
+	int line_number = 0;
+	uint32_t idle = sim_config.default_idle_rcp;
+	bool ok = true;
+
+	while (fgets(line, sizeof(line), f)) {
+		line_number++;
+		char op;
+		char arg[64];
+		int fields = sscanf(line, " %c %63s", &op, arg);
+		if (fields < 1 || op == '#') {
+			continue;
+		}
+
+		uint32_t value = fields == 2 ? strtoul(arg, NULL, op == 'R' || op == 'I' ? 0 : 16) : 0;
+		if (fields != 2 || (op != 'A' && trace.empty() && op != 'I')) {
+			printf("%s:%d: malformed line\n", path, line_number);
+			ok = false;
+			break;
+		}
+
+		switch (op) {
+		case 'A':
+			trace.push_back({ value, idle, {} });
+			idle = sim_config.default_idle_rcp;
+			break;
+		case 'R':
+			trace.back().ops.push_back({ false, value, 0 });
+			break;
+		case 'W':
+			trace.back().ops.push_back({ true, 1, (uint16_t)value });
+			break;
+		case 'I':
+			idle = value;
+			break;
+		default:
+			printf("%s:%d: unknown op '%c'\n", path, line_number, op);
+			ok = false;
+			break;
+		}
+	}
+
+	fclose(f);
+	return ok;
+}
+
+static void write_trace(const char *path, const std::vector<sim_txn_t> &trace)
+{
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		printf("Unable to write trace %s\n", path);
+		return;
+	}
+
+	fprintf(f, "# PI sim trace: A <hex address>, R <half-words>, W <hex value>, I <idle rcp cycles before next A>\n");
+	for (const sim_txn_t &txn : trace) {
+		if (txn.idle_rcp != sim_config.default_idle_rcp) {
+			fprintf(f, "I %u\n", txn.idle_rcp);
+		}
+		fprintf(f, "A %08X\n", txn.address);
+		for (const sim_op_t &op : txn.ops) {
+			if (op.is_write) {
+				fprintf(f, "W %04X\n", op.value);
+			} else {
+				fprintf(f, "R %u\n", op.count);
+			}
+		}
+	}
+
+	fclose(f);
+}
+
+static std::vector<uint8_t> load_file(const char *path)
+{
+	std::vector<uint8_t> data;
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		printf("Unable to open rom %s\n", path);
+		exit(1);
+	}
+
+	uint8_t buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		data.insert(data.end(), buf, buf + n);
+	}
+	fclose(f);
+
+	return data;
+}
+
+// Checked against the last header the handler served, 0 to skip
+static uint32_t expect_header = 0;
+
+// The handler's own counters (pi_stats) have to agree with what the sim saw
+static bool check_pi_stats(void)
+{
+	static const struct {
+		const char *name;
+		uint8_t fw_regions[2];
+		int fw_region_count;
+		sim_region_t sim_regions[2];
+		int sim_region_count;
+	} groups[] = {
+		{ "rom", { PI_REGION_ROM, PI_REGION_ROM_HEADER }, 2, { SIM_REGION_ROM }, 1 },
+		{ "sram", { PI_REGION_SRAM }, 1, { SIM_REGION_SRAM }, 1 },
+		{ "ddr64", { PI_REGION_DDR64 }, 1, { SIM_REGION_BASE, SIM_REGION_CIBASE }, 2 },
+	};
+	bool ok = true;
+
+	for (const auto &g : groups) {
+		uint64_t fw[5] = { 0 };
+		uint64_t sim[5] = { 0 };
+		for (int i = 0; i < g.fw_region_count; i++) {
+			const volatile pi_region_stats_t *p = &pi_stats[g.fw_regions[i]];
+			fw[0] += p->addresses;
+			fw[1] += p->halfwords;
+			fw[2] += p->writes_ignored;
+			fw[3] += p->chip_switches;
+			fw[4] += p->not_ready;
+		}
+		for (int i = 0; i < g.sim_region_count; i++) {
+			const sim_region_stats_t *s = &sim_stats[g.sim_regions[i]];
+			sim[0] += s->addresses;
+			sim[1] += s->reads + s->writes;
+			sim[2] += g.sim_regions[i] == SIM_REGION_ROM ? s->writes : 0;
+			sim[3] += s->chip_switches;
+			sim[4] += s->not_ready;
+		}
+
+		static const char *fields[] = { "addresses", "strobes", "rom writes", "chip switches", "not ready" };
+		for (int f = 0; f < 5; f++) {
+			if (fw[f] != sim[f]) {
+				printf("Handler counted %llu %s %s, the sim saw %llu\n", (unsigned long long)fw[f], g.name, fields[f], (unsigned long long)sim[f]);
+				ok = false;
+			}
+		}
+	}
+
+	return ok;
+}
+
+static bool print_report(bool completed)
+{
+	double sys_per_rcp = (double)sim_config.sys_khz * 1000 / SIM_RCP_CLOCK_HZ;
+	uint64_t budget = sim_rcp_to_sys(sim_dom1_pwd + 1);
+	bool ok = completed;
+
+	printf("\n%u.%03u MHz, QSPI divider %u, serving rom from %s\n", sim_config.sys_khz / 1000, sim_config.sys_khz % 1000, sim_config.qspi_div,
+		   sim_config.serve_from_flash ? "flash" : sim_config.rom_in_flash_array ? "the flash array" : sim_config.psram_xip_cached ? "PSRAM through the XIP cache" : "PSRAM");
+	if (sim_config.serve_from_flash) {
+		printf("Flash holds %u unique %u byte chunks for %u KB of rom\n", sim_flash_unique_chunks, 1u << sim_flash_chunk_shift,
+			   (sim_config.rom_bytes + 1023) / 1024);
+	}
+	if (sim_config.rom_in_flash_array) {
+		printf("Flash array holds %u unique chunks for %u KB of rom, in %u 64KB blocks\n", sim_flash_array_unique_chunks,
+			   (sim_config.rom_bytes + 1023) / 1024, sim_flash_array_blocks);
+	}
+	printf("Header served: 0x%04X%04X, LAT 0x%02X PWD 0x%02X RLS %u, read strobe budget %llu cycles\n\n", sim_header_words[0], sim_header_words[1],
+		   sim_dom1_lat, sim_dom1_pwd, sim_dom1_rls, (unsigned long long)budget);
+
+	printf("%-7s %9s %10s %8s %9s %21s %8s %7s %5s %10s %8s %8s\n", "region", "addresses", "reads", "writes", "unhandled", "latency min/avg/max", "margin",
+		   "misses", "bad", "dma polls", "chip sw", "cyc/hw");
+
+	for (int r = 0; r < SIM_REGION_COUNT; r++) {
+		const sim_region_stats_t *s = &sim_stats[r];
+		if (s->addresses == 0) {
+			continue;
+		}
+
+		uint64_t halfwords = s->reads + s->writes;
+		char latency[32] = "-";
+		char margin[16] = "-";
+		if (s->reads) {
+			snprintf(latency, sizeof(latency), "%llu/%llu/%llu", (unsigned long long)s->latency_min, (unsigned long long)(s->latency_total / s->reads),
+					 (unsigned long long)s->latency_max);
+			snprintf(margin, sizeof(margin), "%lld", (long long)s->margin_min);
+		}
+
+		printf("%-7s %9llu %10llu %8llu %9llu %21s %8s %7llu %5llu %10llu %8llu %8.1f\n", sim_region_name((sim_region_t)r), (unsigned long long)s->addresses,
+			   (unsigned long long)s->reads, (unsigned long long)s->writes, (unsigned long long)s->unhandled, latency, margin, (unsigned long long)s->misses,
+			   (unsigned long long)s->bad_data, (unsigned long long)s->dma_busy_polls, (unsigned long long)s->chip_switches,
+			   halfwords ? (double)s->cycles / halfwords : 0.0);
+
+		if (s->misses || s->bad_data) {
+			ok = false;
+		}
+	}
+
+	const sim_region_stats_t *rom = &sim_stats[SIM_REGION_ROM];
+	if (rom->reads) {
+		// Smallest PWD whose strobe still covers the worst latency seen. A
+		// shorter strobe also shortens the time the DMA has to prefetch the
+		// next half-word, so confirm with --pwd.
+		uint32_t pwd = (uint32_t)((rom->latency_max + sys_per_rcp - 1) / sys_per_rcp);
+		pwd = pwd > 0 ? pwd - 1 : 0;
+		if (pwd <= 0xFF) {
+			printf("\nWorst rom read latency fits in PWD 0x%02X (bus ran with 0x%02X), confirm with --pwd\n", pwd, sim_dom1_pwd);
+		} else {
+			printf("\nWorst rom read latency doesn't fit in any PWD\n");
+		}
+	}
+
+	uint64_t chip_switches = 0;
+	for (int r = 0; r < SIM_REGION_COUNT; r++) {
+		chip_switches += sim_stats[r].chip_switches;
+	}
+	if (chip_switches) {
+		printf("PSRAM chip switches: %llu, %.2f per rom address\n", (unsigned long long)chip_switches,
+			   rom->addresses ? (double)chip_switches / rom->addresses : 0.0);
+	}
+	if (rom->not_ready) {
+		printf("Rom addresses in blocks not loaded yet: %llu of %llu\n", (unsigned long long)rom->not_ready,
+			   (unsigned long long)rom->addresses);
+	}
+	if (!check_pi_stats()) {
+		ok = false;
+	}
+	if (sim_cs_toggle_mismatch) {
+		printf("Chip select toggled from a chip that wasn't selected %llu times\n", (unsigned long long)sim_cs_toggle_mismatch);
+		ok = false;
+	}
+
+	uint64_t xip_accesses = sim_xip_cache_hits + sim_xip_cache_misses;
+	if (xip_accesses) {
+		printf("XIP cache: %llu hits, %llu misses (%.1f%% hit rate), %llu flushes\n", (unsigned long long)sim_xip_cache_hits,
+			   (unsigned long long)sim_xip_cache_misses, 100.0 * sim_xip_cache_hits / xip_accesses, (unsigned long long)sim_xip_cache_flushes);
+	}
+
+	if (sim_dma_retrigger_while_busy) {
+		printf("DMA triggered while busy %llu times, those fetches were dropped\n", (unsigned long long)sim_dma_retrigger_while_busy);
+	}
+
+	if (sim_psram_tcem_violations) {
+		printf("PSRAM CS held low past tCEM in %llu of %llu direct reads\n", (unsigned long long)sim_psram_tcem_violations,
+			   (unsigned long long)sim_ssi_streams);
+		ok = false;
+	}
+
+	if (sim_xip_with_rdmae) {
+		printf("XIP read with SSI RX DMA enabled %llu times\n", (unsigned long long)sim_xip_with_rdmae);
+		ok = false;
+	}
+
+	uint32_t header = (uint32_t)sim_header_words[0] << 16 | sim_header_words[1];
+	if (expect_header && header != expect_header) {
+		printf("Served header 0x%08X, expected 0x%08X\n", header, expect_header);
+		ok = false;
+	}
+
+	if (!completed) {
+		printf("Handler stalled at cycle %llu, stopped answering the bus\n", (unsigned long long)sim_now);
+	}
+
+	printf("%s\n", ok ? "PASS" : "FAIL");
+
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	const char *trace_path = NULL;
+	const char *rom_path = NULL;
+	const char *write_trace_path = NULL;
+	uint32_t synthetic = 0;
+	uint32_t rom_size = 32 * 1024 * 1024;
+	uint32_t pad_size = 0;
+	bool bench_dispatch = false;
+	bool bench_chunks = false;
+	std::vector<uint8_t> rom;
+	std::vector<sim_txn_t> trace;
+
+	for (int i = 1; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+		if (strcmp(argv[i], "--rom") == 0 && has_value) {
+			rom_path = argv[++i];
+		} else if (strcmp(argv[i], "--rom-mb") == 0 && has_value) {
+			rom_size = strtoul(argv[++i], NULL, 0) * 1024 * 1024;
+		} else if (strcmp(argv[i], "--flash") == 0) {
+			sim_config.serve_from_flash = true;
+		} else if (strcmp(argv[i], "--flash-array") == 0) {
+			sim_config.rom_in_flash_array = true;
+		} else if (strcmp(argv[i], "--pad-mb") == 0 && has_value) {
+			pad_size = strtoul(argv[++i], NULL, 0) * 1024 * 1024;
+		} else if (strcmp(argv[i], "--xip-cache") == 0) {
+			sim_config.psram_xip_cached = true;
+		} else if (strcmp(argv[i], "--ready-mb") == 0 && has_value) {
+			sim_config.rom_ready_mb = strtoul(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "--sys-mhz") == 0 && has_value) {
+			sim_config.sys_khz = (uint32_t)(atof(argv[++i]) * 1000);
+		} else if (strcmp(argv[i], "--qspi-div") == 0 && has_value) {
+			sim_config.qspi_div = strtoul(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "--pwd") == 0 && has_value) {
+			sim_config.dom1_pwd_override = strtol(argv[++i], NULL, 0) & 0xFF;
+		} else if (strcmp(argv[i], "--synthetic") == 0 && has_value) {
+			synthetic = strtoul(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+			xorshift_state = strtoul(argv[++i], NULL, 0) | 1;
+		} else if (strcmp(argv[i], "--write-trace") == 0 && has_value) {
+			write_trace_path = argv[++i];
+		} else if (strcmp(argv[i], "--bench-dispatch") == 0) {
+			bench_dispatch = true;
+		} else if (strcmp(argv[i], "--bench-chunks") == 0) {
+			bench_chunks = true;
+		} else if (strcmp(argv[i], "--expect-header") == 0 && has_value) {
+			expect_header = strtoul(argv[++i], NULL, 16);
+		} else if (argv[i][0] != '-' && trace_path == NULL) {
+			trace_path = argv[i];
+		} else {
+			printf("Usage: %s [--rom file.z64] [--rom-mb n] [--flash] [--flash-array] [--pad-mb n] [--xip-cache] [--ready-mb n] [--sys-mhz mhz] [--qspi-div div] [--pwd n] [--synthetic n] [--seed n] [--write-trace file] [--bench-dispatch] [--bench-chunks] [--expect-header hex] [trace]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (trace_path == NULL && synthetic == 0) {
+		synthetic = 2000;
+	}
+
+	if (rom_path) {
+		rom = load_file(rom_path);
+		sim_rom_set_image(rom.data(), rom.size());
+		rom_size = rom.size();
+	}
+	if (sim_config.serve_from_flash || sim_config.rom_in_flash_array) {
+		// Everything past what the mapping covers reads back as chunk 0
+		uint32_t chunk_shift = sim_config.serve_from_flash ? sim_flash_chunk_shift : 10;
+		rom_size = std::min<uint32_t>(rom_size, (16384 - 8) << chunk_shift);
+	}
+	if (pad_size && pad_size < rom_size) {
+		sim_config.rom_pad_from = rom_size - pad_size;
+	}
+	sim_config.rom_bytes = rom_size;
+
+	if (trace_path && !parse_trace(trace_path, trace)) {
+		return 2;
+	}
+	if (synthetic) {
+		generate_synthetic_trace(trace, synthetic, rom_size);
+	}
+	if (write_trace_path) {
+		write_trace(write_trace_path, trace);
+	}
+
+	sim_hw_init();
+	sim_bus_set_trace(&trace);
+	printf("Replaying %zu transactions\n", trace.size());
+
+	bool completed = sim_run();
+	bool ok = print_report(completed);
+
+	if (bench_dispatch) {
+		sim_bench_dispatch(trace);
+	}
+	if (bench_chunks) {
+		sim_bench_chunks(trace);
+	}
+
+	return ok ? 0 : 1;
+}
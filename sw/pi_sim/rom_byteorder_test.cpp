@@ -0,0 +1,83 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+// Host test of the loader's byte order conversion. Builds a rom in .z64 order,
+// reorders it into each dump format and checks it converts back, whole and in
+// the loader's chunk sizes.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+extern "C" {
+#include "rom_byteorder.h"
+}
+
+#include "test_check.h"
+
+static std::vector<uint8_t> make_z64(size_t len) {
+	std::vector<uint8_t> rom(len);
+	uint32_t x = 0x12345678;
+	for (size_t i = 0; i < len; i++) {
+		x = x * 1103515245 + 12345;
+		rom[i] = x >> 24;
+	}
+	const uint8_t header[4] = { 0x80, 0x37, 0x12, 0x40 };
+	memcpy(rom.data(), header, sizeof(header));
+	return rom;
+}
+
+// Byte i of the dump holds byte map[i & 3] of the same word in the rom
+static std::vector<uint8_t> reorder(const std::vector<uint8_t> &z64, const int map[4]) {
+	std::vector<uint8_t> out(z64.size());
+	for (size_t i = 0; i < z64.size(); i++) {
+		out[i] = z64[(i & ~3) + map[i & 3]];
+	}
+	return out;
+}
+
+static void check_format(const char *name, rom_byte_order_t order, const int map[4], size_t len, size_t chunk) {
+	std::vector<uint8_t> z64 = make_z64(len);
+	std::vector<uint8_t> dump = reorder(z64, map);
+
+	CHECK(rom_detect_byte_order(dump.data()) == order, "%s detected as %s", name, rom_byte_order_name(rom_detect_byte_order(dump.data())));
+
+	// Convert through a word aligned buffer, the way the loader does
+	std::vector<uint32_t> buf((chunk + 3) / 4);
+	for (size_t off = 0; off < len; off += chunk) {
+		size_t n = len - off < chunk ? len - off : chunk;
+		memcpy(buf.data(), dump.data() + off, n);
+		rom_convert_to_z64(order, (uint8_t *)buf.data(), n);
+		CHECK(memcmp(buf.data(), z64.data() + off, n) == 0, "%s len %zu chunk %zu differs at offset %zu", name, len, chunk, off);
+	}
+}
+
+int main() {
+	static const int z64_map[4] = { 0, 1, 2, 3 };
+	static const int v64_map[4] = { 1, 0, 3, 2 };
+	static const int n64_map[4] = { 3, 2, 1, 0 };
+	static const size_t chunks[] = { 4, 512, 8 * 1024 };
+
+	for (size_t chunk : chunks) {
+		check_format("z64", ROM_BYTE_ORDER_Z64, z64_map, 64 * 1024, chunk);
+		check_format("v64", ROM_BYTE_ORDER_V64, v64_map, 64 * 1024, chunk);
+		check_format("n64", ROM_BYTE_ORDER_N64, n64_map, 64 * 1024, chunk);
+	}
+
+	// .v64 can end on a half word
+	check_format("v64 tail", ROM_BYTE_ORDER_V64, v64_map, 64 * 1024 + 2, 8 * 1024);
+
+	// Anything else is written as it is
+	uint8_t junk[8] = { 0xDE, 0xAD, 0xBE, 0xEF, 1, 2, 3, 4 };
+	uint8_t copy[8];
+	memcpy(copy, junk, sizeof(junk));
+	CHECK(rom_detect_byte_order(junk) == ROM_BYTE_ORDER_UNKNOWN, "junk header detected");
+	rom_convert_to_z64(ROM_BYTE_ORDER_UNKNOWN, junk, sizeof(junk));
+	CHECK(memcmp(junk, copy, sizeof(junk)) == 0, "unknown order was changed");
+
+	return test_result();
+}
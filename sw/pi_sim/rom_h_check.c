@@ -0,0 +1,16 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+// A rom.h from load_rom, included after rom_vars.h like n64_pi_task.c does
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "rom_vars.h"
+#include "rom.h"
+
+_Static_assert(sizeof(rom_chunks[0]) == 1 << COMPRESSION_SHIFT_AMOUNT, "rom_chunks isn't in the chunk size the handler indexes it with");
+_Static_assert(COMPRESSION_MASK == (1 << COMPRESSION_SHIFT_AMOUNT) - 1, "COMPRESSION_MASK doesn't match");
@@ -0,0 +1,268 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+#include <stdio.h>
+
+#include "sim_bench.h"
+
+#include "n64_defs.h"
+#include "ddr64_regs.h"
+#include "n64_pi_task.h"
+
+#include "rom_dedup.h"
+
+////////////////////////////////////////////////////////////
+// Address dispatch
+
+typedef enum {
+	DISPATCH_HEADER,
+	DISPATCH_ROM,
+	DISPATCH_SRAM,
+	DISPATCH_BASE,
+	DISPATCH_CIBASE,
+	DISPATCH_DEBUG,
+	DISPATCH_UNHANDLED,
+	DISPATCH_COUNT
+} dispatch_handler_t;
+
+static const char *dispatch_names[DISPATCH_COUNT] = {
+	"header", "ROM", "SRAM", "BASE", "CIBASE", "debug", "unhandled"
+};
+
+// `ldr` of the constant, `cmp`, conditional branch
+static bool eq_check(uint32_t address, uint32_t value, uint32_t *cycles)
+{
+	bool match = address == value;
+	*cycles += M0_LDR_LITERAL + M0_ALU + (match ? M0_BRANCH_NOT_TAKEN : M0_BRANCH_TAKEN);
+	return match;
+}
+
+static bool range_check(uint32_t address, uint32_t start, uint32_t end, uint32_t *cycles)
+{
+	*cycles += M0_LDR_LITERAL + M0_ALU;
+	if (address < start) {
+		*cycles += M0_BRANCH_TAKEN;
+		return false;
+	}
+	*cycles += M0_BRANCH_NOT_TAKEN + M0_LDR_LITERAL + M0_ALU;
+	if (address > end) {
+		*cycles += M0_BRANCH_TAKEN;
+		return false;
+	}
+	*cycles += M0_BRANCH_NOT_TAKEN;
+	return true;
+}
+
+// `cmp` against a small immediate, conditional branch
+static bool region_check(uint8_t region, uint8_t value, uint32_t *cycles)
+{
+	bool match = region == value;
+	*cycles += M0_ALU + (match ? M0_BRANCH_NOT_TAKEN : M0_BRANCH_TAKEN);
+	return match;
+}
+
+// The if/else chain n64_pi_run used before the region table
+static dispatch_handler_t dispatch_chain(uint32_t address, uint32_t *cycles)
+{
+	if (eq_check(address, 0x10000000, cycles)) {
+		return DISPATCH_HEADER;
+	} else if (range_check(address, CART_SRAM_START, CART_SRAM_END, cycles)) {
+		return DISPATCH_SRAM;
+	} else if (range_check(address, 0x10000000, 0x1FBFFFFF, cycles)) {
+		return DISPATCH_ROM;
+	} else if (range_check(address, DDR64_BASE_ADDRESS_START, DDR64_BASE_ADDRESS_END, cycles)) {
+		return DISPATCH_BASE;
+	} else if (range_check(address, DDR64_CIBASE_ADDRESS_START, DDR64_CIBASE_ADDRESS_END, cycles)) {
+		return DISPATCH_CIBASE;
+	} else if (range_check(address, 0x81000000, 0x81001000, cycles)) {
+		return DISPATCH_DEBUG;
+	}
+
+	return DISPATCH_UNHANDLED;
+}
+
+// Mirrors the dispatch at the top of the n64_pi_run loop
+static dispatch_handler_t dispatch_table(uint32_t address, uint32_t *cycles)
+{
+	// `lsrs`, `ldr` of the table address, `ldrb`
+	*cycles += M0_ALU + M0_LDR_LITERAL + M0_LDR;
+	uint8_t region = pi_region_table[address >> PI_REGION_TABLE_SHIFT];
+
+	if (region_check(region, PI_REGION_ROM, cycles)) {
+		return DISPATCH_ROM;
+	} else if (region_check(region, PI_REGION_ROM_HEADER, cycles)) {
+		if (!eq_check(address, 0x10000000, cycles)) {
+			*cycles += M0_BRANCH_TAKEN;
+			return DISPATCH_ROM;
+		}
+		return DISPATCH_HEADER;
+	} else if (region_check(region, PI_REGION_SRAM, cycles)) {
+		return DISPATCH_SRAM;
+	} else if (region_check(region, PI_REGION_DDR64, cycles) &&
+			   range_check(address, DDR64_BASE_ADDRESS_START, DDR64_BASE_ADDRESS_END, cycles)) {
+		return DISPATCH_BASE;
+	} else if (region_check(region, PI_REGION_DDR64, cycles) &&
+			   range_check(address, DDR64_CIBASE_ADDRESS_START, DDR64_CIBASE_ADDRESS_END, cycles)) {
+		return DISPATCH_CIBASE;
+	} else if (region_check(region, PI_REGION_DEBUG, cycles)) {
+		*cycles += M0_LDR_LITERAL + M0_ALU;
+		if (address <= 0x81001000) {
+			*cycles += M0_BRANCH_NOT_TAKEN;
+			return DISPATCH_DEBUG;
+		}
+		*cycles += M0_BRANCH_TAKEN;
+	}
+
+	return DISPATCH_UNHANDLED;
+}
+
+void sim_bench_dispatch(const std::vector<sim_txn_t> &trace)
+{
+	uint64_t count[DISPATCH_COUNT] = { 0 };
+	uint64_t chain_cycles[DISPATCH_COUNT] = { 0 };
+	uint64_t table_cycles[DISPATCH_COUNT] = { 0 };
+	uint64_t chain_total = 0;
+	uint64_t table_total = 0;
+	uint32_t mismatches = 0;
+	uint32_t unused;
+
+	pi_region_table_init();
+
+	// Both schemes have to send every address to the same handler
+	for (uint64_t address = 0; address <= 0xFFFFFFFF; address += 0x800) {
+		for (uint32_t offset : { 0u, 2u, 0x7FEu }) {
+			uint32_t a = (uint32_t)address + offset;
+			if (dispatch_chain(a, &unused) != dispatch_table(a, &unused)) {
+				if (mismatches++ < 8) {
+					printf("Dispatch mismatch at %08X: chain %s, table %s\n", a, dispatch_names[dispatch_chain(a, &unused)],
+						   dispatch_names[dispatch_table(a, &unused)]);
+				}
+			}
+		}
+	}
+
+	for (const sim_txn_t &txn : trace) {
+		uint32_t chain = 0;
+		uint32_t table = 0;
+		dispatch_handler_t handler = dispatch_chain(txn.address, &chain);
+		dispatch_table(txn.address, &table);
+
+		count[handler]++;
+		chain_cycles[handler] += chain;
+		table_cycles[handler] += table;
+		chain_total += chain;
+		table_total += table;
+	}
+
+	printf("\nAddress dispatch, Cortex-M0+ cycle model, %zu addresses\n", trace.size());
+	printf("%-10s %9s %12s %12s\n", "handler", "addresses", "chain cyc", "table cyc");
+	for (int h = 0; h < DISPATCH_COUNT; h++) {
+		if (count[h] == 0) {
+			continue;
+		}
+		printf("%-10s %9llu %12.1f %12.1f\n", dispatch_names[h], (unsigned long long)count[h], (double)chain_cycles[h] / count[h],
+			   (double)table_cycles[h] / count[h]);
+	}
+	if (!trace.empty()) {
+		printf("%-10s %9zu %12.1f %12.1f\n", "average", trace.size(), (double)chain_total / trace.size(), (double)table_total / trace.size());
+	}
+	printf("Total: chain %llu cycles, table %llu cycles\n", (unsigned long long)chain_total, (unsigned long long)table_total);
+	if (mismatches) {
+		printf("%u addresses dispatched differently!\n", mismatches);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Chunk size
+
+// `rom_mapping[(last_addr & 0xFFFFFF) >> shift]`: `lsls`, `lsrs`, `lsls` for
+// the half-word index, `ldr` of the table address, `ldrh`. Then the chunk
+// pointer: `ldr` of rom_chunks, `lsls`, `adds`, and the word in the chunk:
+// `lsls`, `lsrs`, `adds`. Then the two DMA register writes that start the fetch.
+static uint32_t chunk_lookup_cycles(void)
+{
+	return 6 * M0_ALU + M0_LDR_LITERAL + M0_LDR + M0_LDR_LITERAL + 3 * M0_ALU + 2 * sim_cost.dma_reg;
+}
+
+// Under the PI page a burst runs into the next chunk. Every word checks for
+// the chunk boundary, `lsls` and a taken branch. At a boundary the handler
+// reads g_loadRomFromMemoryArray, waits for the prefetch it has to throw away
+// and looks the chunk up again, then waits for the new word.
+static uint32_t chunk_boundary_check_cycles(void)
+{
+	return M0_ALU + M0_BRANCH_TAKEN;
+}
+
+static uint32_t chunk_relookup_cycles(void)
+{
+	return M0_ALU + M0_BRANCH_NOT_TAKEN + M0_LDR_LITERAL + M0_LDR + M0_ALU + M0_BRANCH_NOT_TAKEN + sim_cost.dma_reg +
+		chunk_lookup_cycles() + sim_cost.mem_read;
+}
+
+void sim_bench_chunks(const std::vector<sim_txn_t> &trace)
+{
+	std::vector<uint8_t> rom(sim_config.rom_bytes);
+	for (uint32_t i = 0; i < rom.size(); i++) {
+		rom[i] = sim_rom_read8(i);
+	}
+
+	uint64_t bursts = 0;
+	uint64_t halfwords = 0;
+	for (const sim_txn_t &txn : trace) {
+		if (sim_region_for_address(txn.address) != SIM_REGION_ROM) {
+			continue;
+		}
+		bursts++;
+		for (const sim_op_t &op : txn.ops) {
+			halfwords += op.count;
+		}
+	}
+
+	printf("\nFlash rom chunk size, %zu KB rom, Cortex-M0+ cycle model over %llu rom bursts\n", rom.size() / 1024,
+		   (unsigned long long)bursts);
+	printf("%-6s %8s %11s %11s %11s %9s %10s %9s\n", "chunk", "unique", "chunks KB", "mapping KB", "total KB", "lookups", "cyc/burst",
+		   "cyc/hw");
+
+	rom_dedup_t best;
+	bool found = rom_dedup_best(rom.data(), rom.size(), &best);
+
+	for (uint32_t pot = ROM_DEDUP_AUTO_MIN_CHUNK_POT; pot <= ROM_DEDUP_AUTO_MAX_CHUNK_POT; pot++) {
+		rom_dedup_t dedup;
+		rom_dedup(rom.data(), rom.size(), pot, true, &dedup);
+		uint32_t chunk_bytes = 1u << pot;
+
+		uint64_t lookups = 0;
+		uint64_t cycles = 0;
+		for (const sim_txn_t &txn : trace) {
+			if (sim_region_for_address(txn.address) != SIM_REGION_ROM) {
+				continue;
+			}
+			lookups++;
+			cycles += chunk_lookup_cycles();
+
+			uint32_t addr = txn.address;
+			for (const sim_op_t &op : txn.ops) {
+				for (uint32_t i = 0; i < op.count; i++) {
+					addr += 2;
+					if (pot >= 9 || (addr & 2)) {
+						continue;
+					}
+					if (addr & (chunk_bytes - 1)) {
+						cycles += chunk_boundary_check_cycles();
+					} else {
+						lookups++;
+						cycles += chunk_relookup_cycles();
+					}
+				}
+			}
+		}
+
+		printf("%-6u %8u %11.1f %11.1f %11.1f %9llu %10.1f %9.2f%s%s\n", chunk_bytes, rom_dedup_unique_chunks(&dedup),
+			   dedup.chunks.size() / 1024.0, dedup.mapping.size() * 2 / 1024.0, rom_dedup_compressed_bytes(&dedup) / 1024.0,
+			   (unsigned long long)lookups, bursts ? (double)cycles / bursts : 0.0, halfwords ? (double)cycles / halfwords : 0.0,
+			   rom_dedup_fits(&dedup) ? "" : "  doesn't fit", found && best.chunk_pot == pot ? "  <- load_rom" : "");
+	}
+}
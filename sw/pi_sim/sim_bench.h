@@ -0,0 +1,27 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "sim_hw.h"
+
+// Cortex-M0+ cycle costs used by the benchmarks that model CPU work the
+// register-level sim can't see
+#define M0_LDR_LITERAL (2)
+#define M0_LDR (2)
+#define M0_ALU (1)
+#define M0_BRANCH_TAKEN (2)
+#define M0_BRANCH_NOT_TAKEN (1)
+
+// Compare the old if/else address dispatch against the region table for the
+// address mix of the trace
+void sim_bench_dispatch(const std::vector<sim_txn_t> &trace);
+
+// Compressed size of the rom in each chunk size load_rom picks from, against
+// what the chunk lookups of the flash rom path cost for the rom reads of the trace
+void sim_bench_chunks(const std::vector<sim_txn_t> &trace);
@@ -0,0 +1,1573 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+// Bus, PIO and DMA model behind the register proxies in sim_sdk.h.
+//
+// The N64 side replays a trace on a nominal timeline (it never waits for the
+// cart). The n64_pi PIO program is modelled at the FIFO level: it pushes the
+// address word after ALEL, pushes a 0 word for every READ strobe and then
+// blocks in `pull` until the firmware provides data, and pushes
+// (data << 16) | 0xFFFF for every WRITE strobe. A read is late if its data
+// wasn't pulled before the end of the strobe (PWD + 1 RCP cycles).
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+
+#include "sim_hw.h"
+
+#include "n64_defs.h"
+#include "ddr64_regs.h"
+#include "n64_pi.pio.h"
+#include "n64_pi_task.h"
+#include "psram.h"
+#include "qspi_helper.h"
+#include "rom_vars.h"
+#include "flash_array.h"
+
+// Base of the uncached, non-allocating XIP alias the PSRAM is read through
+#define SIM_XIP_NOCACHE_NOALLOC_BASE (0x13000000)
+#define SIM_XIP_NOCACHE_NOALLOC_END  (0x14000000)
+// Cached alias. The noalloc and nocache aliases above it are only reached by a
+// prefetch running off the end of the rom, they're treated as the cached one.
+#define SIM_XIP_CACHED_BASE (0x10000000)
+#define SIM_XIP_CACHED_END  (0x13000000)
+#define SIM_XIP_ALIAS_MASK  (0x00FFFFFF)
+
+// RP2040 XIP cache: 16KB, two-way set associative, 8 byte lines
+#define SIM_XIP_CACHE_LINE (8)
+#define SIM_XIP_CACHE_WAYS (2)
+#define SIM_XIP_CACHE_SETS (16 * 1024 / SIM_XIP_CACHE_LINE / SIM_XIP_CACHE_WAYS)
+
+// ALEH + ALEL phase of a transaction
+#define SIM_ALE_RCP_CYCLES (4)
+
+#define SIM_PIO_FIFO_DEPTH (4)
+
+// Max time a PSRAM read may hold CS low (APS6404L tCEM)
+#define SIM_PSRAM_TCEM_US (8)
+
+// The handler is considered stuck if the bus has been waiting on it this long
+#define SIM_STALL_CYCLES (10 * 1000 * 1000)
+
+pio_hw_t sim_pio_hw[2];
+dma_hw_t sim_dma_hw;
+ssi_hw_t sim_ssi_hw;
+xip_ctrl_hw_t sim_xip_ctrl_hw;
+const pio_program_t n64_pi_program = { NULL, 32, -1 };
+
+sim_config_t sim_config = {
+	.sys_khz = 266000,
+	.qspi_div = QSPI_QUAD_MODE_CLK_DIVIDER,
+	.serve_from_flash = false,
+	.rom_in_flash_array = false,
+	.rom_bytes = 32 * 1024 * 1024,
+	.rom_pad_from = 0,
+	.psram_xip_cached = false,
+	.rom_ready_mb = 0,
+	.dom2_lat = 0x05,
+	.dom2_pwd = 0x0C,
+	.dom2_rls = 0x02,
+	.default_idle_rcp = 16,
+	.dom1_pwd_override = -1,
+};
+
+sim_cost_t sim_cost = {
+	.pio_fstat = 3,
+	.pio_rxf = 3,
+	.pio_txf = 4,
+	.dma_reg = 3,
+	.gpio = 3,
+	.xip_overhead = 6,
+	.xip_read_clocks = 22,
+	.mem_read = 4,
+	.ssi_reg = 3,
+	.ssi_setup_clocks = 14,
+	.ssi_frame_clocks = 8,
+	.flash_setup_clocks = 20,
+	.xip_flush = 1024,
+};
+
+sim_region_stats_t sim_stats[SIM_REGION_COUNT];
+uint64_t sim_now = 0;
+
+uint32_t sim_dom1_lat = SIM_BOOT_PI_LAT;
+uint32_t sim_dom1_pwd = SIM_BOOT_PI_PWD;
+uint32_t sim_dom1_rls = SIM_BOOT_PI_RLS;
+uint16_t sim_header_words[2];
+uint64_t sim_dma_retrigger_while_busy = 0;
+uint64_t sim_psram_tcem_violations = 0;
+uint64_t sim_xip_with_rdmae = 0;
+uint64_t sim_ssi_streams = 0;
+uint64_t sim_cs_toggle_mismatch = 0;
+uint64_t sim_xip_cache_hits = 0;
+uint64_t sim_xip_cache_misses = 0;
+uint64_t sim_xip_cache_flushes = 0;
+uint32_t sim_flash_array_unique_chunks = 0;
+uint32_t sim_flash_array_blocks = 0;
+bool sim_stalled = false;
+
+// Defined in sim_stubs.cpp, which can see rom_chunks as writable
+void sim_flash_fill(uint16_t *mapping, uint32_t entries);
+
+struct sim_trace_end {};
+struct sim_stall {};
+
+////////////////////////////////////////////////////////////
+// ROM image
+
+static const uint8_t *rom_image = NULL;
+static size_t rom_image_len = 0;
+
+void sim_rom_set_image(const uint8_t *data, size_t len)
+{
+	rom_image = data;
+	rom_image_len = len;
+}
+
+uint8_t sim_rom_read8(uint32_t offset)
+{
+	if (rom_image) {
+		return offset < rom_image_len ? rom_image[offset] : 0;
+	}
+
+	if (sim_config.rom_pad_from && offset >= sim_config.rom_pad_from) {
+		return 0xFF;
+	}
+
+	// Deterministic pattern, different for every half-word so a wrong
+	// chip or offset shows up as bad data
+	uint16_t value = (uint16_t)(((offset >> 1) * 2654435761u) >> 16);
+	return (offset & 1) ? (value & 0xFF) : (value >> 8);
+}
+
+uint16_t sim_rom_read16_be(uint32_t offset)
+{
+	return (sim_rom_read8(offset) << 8) | sim_rom_read8(offset + 1);
+}
+
+////////////////////////////////////////////////////////////
+// Regions and timing
+
+sim_region_t sim_region_for_address(uint32_t address)
+{
+	if (address >= CART_SRAM_START && address <= CART_SRAM_END) {
+		return SIM_REGION_SRAM;
+	} else if (address >= CART_DOM1_ADDR2_START && address <= CART_DOM1_ADDR2_END) {
+		return SIM_REGION_ROM;
+	} else if (address >= DDR64_BASE_ADDRESS_START && address <= DDR64_BASE_ADDRESS_END) {
+		return SIM_REGION_BASE;
+	} else if (address >= DDR64_CIBASE_ADDRESS_START && address <= DDR64_CIBASE_ADDRESS_END) {
+		return SIM_REGION_CIBASE;
+	}
+
+	return SIM_REGION_OTHER;
+}
+
+const char *sim_region_name(sim_region_t region)
+{
+	switch (region) {
+	case SIM_REGION_ROM:
+		return "ROM";
+	case SIM_REGION_SRAM:
+		return "SRAM";
+	case SIM_REGION_BASE:
+		return "BASE";
+	case SIM_REGION_CIBASE:
+		return "CIBASE";
+	default:
+		return "OTHER";
+	}
+}
+
+uint64_t sim_rcp_to_sys(uint64_t rcp_cycles)
+{
+	return (rcp_cycles * (uint64_t)sim_config.sys_khz * 1000 + SIM_RCP_CLOCK_HZ - 1) / SIM_RCP_CLOCK_HZ;
+}
+
+static void bus_timing_for(uint32_t address, uint32_t *lat, uint32_t *pwd, uint32_t *rls)
+{
+	// Domain 2 covers 0x05000000 and 0x08000000-0x0FFFFFFF, everything
+	// else the cart answers is domain 1
+	if ((address >= CART_DOM2_ADDR1_START && address <= CART_DOM2_ADDR1_END) ||
+		(address >= CART_DOM2_ADDR2_START && address <= CART_DOM2_ADDR2_END)) {
+		*lat = sim_config.dom2_lat;
+		*pwd = sim_config.dom2_pwd;
+		*rls = sim_config.dom2_rls;
+	} else {
+		*lat = sim_dom1_lat;
+		*pwd = sim_dom1_pwd;
+		*rls = sim_dom1_rls;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Bus + PIO model
+
+typedef enum {
+	SIM_EVENT_ADDRESS,
+	SIM_EVENT_READ,
+	SIM_EVENT_WRITE,
+	SIM_EVENT_END,
+} sim_event_type_t;
+
+// Address word that wakes the handler up at the end of the trace
+#define SIM_END_OF_TRACE_WORD (0xFFFFFFFC)
+
+typedef struct {
+	sim_event_type_t type;
+	uint64_t time;
+	uint64_t deadline;
+	uint32_t word;
+	uint32_t address;
+	sim_region_t region;
+	size_t txn;
+} sim_event_t;
+
+typedef struct {
+	uint64_t time;
+	uint32_t value;
+} sim_tx_word_t;
+
+static const std::vector<sim_txn_t> *trace = NULL;
+static size_t trace_next_txn = 0;
+static uint64_t bus_time = 0;
+
+static std::deque<sim_event_t> bus_events;
+static std::deque<sim_event_t> rx_fifo;
+static std::deque<sim_tx_word_t> tx_fifo;
+
+static bool pio_blocked = false;
+static sim_event_t pio_blocked_event;
+static uint64_t pio_ready_at = 0;
+static size_t pio_txn = 0;
+
+static sim_region_t fw_region = SIM_REGION_OTHER;
+static uint64_t last_progress = 0;
+
+static std::unordered_map<uint32_t, uint16_t> sram_shadow;
+
+static uint8_t psram_chip = 0;
+
+static void dma_update(void);
+static void ssi_update(void);
+
+void sim_bus_set_trace(const std::vector<sim_txn_t> *txns)
+{
+	trace = txns;
+	trace_next_txn = 0;
+}
+
+static bool bus_generate_next_txn(void)
+{
+	if (trace == NULL || trace_next_txn >= trace->size()) {
+		return false;
+	}
+
+	size_t txn_index = trace_next_txn++;
+	const sim_txn_t &txn = (*trace)[txn_index];
+	sim_region_t region = sim_region_for_address(txn.address);
+	uint32_t lat, pwd, rls;
+	bus_timing_for(txn.address, &lat, &pwd, &rls);
+
+	bus_time = std::max(bus_time, sim_now) + sim_rcp_to_sys(txn.idle_rcp + SIM_ALE_RCP_CYCLES);
+
+	sim_event_t e = {};
+	e.type = SIM_EVENT_ADDRESS;
+	e.time = bus_time;
+	e.word = txn.address;
+	e.address = txn.address;
+	e.region = region;
+	e.txn = txn_index;
+	bus_events.push_back(e);
+
+	uint64_t strobe = bus_time + sim_rcp_to_sys(lat + 1);
+	uint64_t strobe_len = sim_rcp_to_sys(pwd + 1);
+	uint64_t strobe_period = sim_rcp_to_sys(pwd + 1 + rls + 1);
+	uint32_t address = txn.address;
+
+	for (const sim_op_t &op : txn.ops) {
+		uint32_t count = op.is_write ? 1 : op.count;
+		for (uint32_t i = 0; i < count; i++) {
+			e.address = address;
+			if (op.is_write) {
+				// The PIO samples the data when WRITE is released
+				e.type = SIM_EVENT_WRITE;
+				e.time = strobe + strobe_len;
+				e.deadline = e.time;
+				e.word = ((uint32_t)op.value << 16) | 0xFFFF;
+			} else {
+				e.type = SIM_EVENT_READ;
+				e.time = strobe;
+				e.deadline = strobe + strobe_len;
+				e.word = 0;
+			}
+			bus_events.push_back(e);
+			address += 2;
+			strobe += strobe_period;
+		}
+	}
+
+	bus_time = strobe;
+
+	return true;
+}
+
+static bool bus_has_more(void)
+{
+	return !bus_events.empty() || (trace != NULL && trace_next_txn < trace->size());
+}
+
+static bool rom_offset_loaded(uint32_t offset)
+{
+	return sim_config.rom_ready_mb == 0 || sim_config.serve_from_flash || (offset >> 20) < sim_config.rom_ready_mb;
+}
+
+static void bus_check_data(const sim_event_t &e, uint16_t value)
+{
+	sim_region_stats_t *s = &sim_stats[e.region];
+	bool checked = false;
+	uint16_t expected = 0;
+
+	if (e.region == SIM_REGION_ROM) {
+		uint32_t offset = e.address - CART_DOM1_ADDR2_START;
+		if (offset < 4) {
+			// Header word carrying the PI bus timing, the N64 picks it up
+			// from here for every following domain 1 access
+			sim_header_words[offset >> 1] = value;
+			if (offset == 0) {
+				sim_dom1_rls = (value >> 4) & 0x3;
+			} else {
+				sim_dom1_pwd = sim_config.dom1_pwd_override >= 0 ? sim_config.dom1_pwd_override : value >> 8;
+				sim_dom1_lat = value & 0xFF;
+			}
+		} else {
+			checked = true;
+			expected = rom_offset_loaded(offset) ? sim_rom_read16_be(offset) : 0;
+		}
+	} else if (e.region == SIM_REGION_SRAM) {
+		auto it = sram_shadow.find(e.address);
+		if (it != sram_shadow.end()) {
+			checked = true;
+			expected = it->second;
+		}
+	} else if (e.region == SIM_REGION_CIBASE) {
+		uint32_t reg = e.address - DDR64_CIBASE_ADDRESS_START;
+		if (reg == DDR64_REGISTER_MAGIC || reg == DDR64_REGISTER_MAGIC + 2) {
+			checked = true;
+			expected = reg == DDR64_REGISTER_MAGIC ? (DDR64_MAGIC >> 16) : (DDR64_MAGIC & 0xFFFF);
+		}
+	}
+
+	if (checked && expected != value) {
+		s->bad_data++;
+	}
+}
+
+static void bus_serve_read(const sim_event_t &e, uint64_t served_at, uint32_t value)
+{
+	sim_region_stats_t *s = &sim_stats[e.region];
+	uint64_t latency = served_at - e.time;
+	int64_t margin = (int64_t)e.deadline - (int64_t)served_at;
+
+	if (s->reads == 0 || latency < s->latency_min) {
+		s->latency_min = latency;
+	}
+	if (s->reads == 0 || margin < s->margin_min) {
+		s->margin_min = margin;
+	}
+	s->latency_max = std::max(s->latency_max, latency);
+	s->latency_total += latency;
+	s->reads++;
+	if (served_at > e.deadline) {
+		s->misses++;
+	}
+
+	bus_check_data(e, value & 0xFFFF);
+
+	pio_ready_at = std::max(served_at, e.deadline);
+	last_progress = sim_now;
+}
+
+// Let the PIO run up to sim_now
+static void bus_update(void)
+{
+	while (!pio_blocked && rx_fifo.size() < SIM_PIO_FIFO_DEPTH) {
+		if (bus_events.empty() && !bus_generate_next_txn()) {
+			return;
+		}
+
+		sim_event_t e = bus_events.front();
+		uint64_t t = std::max(e.time, pio_ready_at);
+		if (t > sim_now) {
+			return;
+		}
+
+		bus_events.pop_front();
+		pio_txn = e.txn;
+		pio_ready_at = t;
+		rx_fifo.push_back(e);
+
+		if (e.type == SIM_EVENT_READ) {
+			if (!tx_fifo.empty()) {
+				sim_tx_word_t w = tx_fifo.front();
+				tx_fifo.pop_front();
+				bus_serve_read(e, std::max(t, w.time), w.value);
+			} else {
+				pio_blocked = true;
+				pio_blocked_event = e;
+			}
+		}
+	}
+}
+
+static void sim_advance(uint64_t cycles)
+{
+	sim_now += cycles;
+	sim_stats[fw_region].cycles += cycles;
+
+	ssi_update();
+	dma_update();
+	bus_update();
+
+	if ((pio_blocked || !rx_fifo.empty()) && sim_now - last_progress > SIM_STALL_CYCLES) {
+		sim_stalled = true;
+		throw sim_stall();
+	}
+}
+
+// Earliest time the bus can push something new, for blocking reads
+static uint64_t bus_next_event_time(void)
+{
+	if (bus_events.empty() && !bus_generate_next_txn()) {
+		return UINT64_MAX;
+	}
+
+	return std::max(bus_events.front().time, pio_ready_at);
+}
+
+// At the end of the trace the handler is asked to return, like mcu1 does
+// before loading a new rom, so it settles its counters. The address that
+// wakes it up is never dispatched.
+static void bus_end_trace(void)
+{
+	static bool end_sent = false;
+
+	if (end_sent) {
+		throw sim_trace_end();
+	}
+
+	end_sent = true;
+	g_restart_pi_handler = true;
+
+	sim_event_t e = {};
+	e.type = SIM_EVENT_END;
+	e.time = sim_now;
+	e.word = SIM_END_OF_TRACE_WORD;
+	rx_fifo.push_back(e);
+}
+
+static void pio_wait_for_rx(void)
+{
+	while (rx_fifo.empty()) {
+		if (pio_blocked || !bus_has_more()) {
+			// Either the handler is waiting on itself, or the trace is done
+			if (!bus_has_more() && !pio_blocked) {
+				bus_end_trace();
+				continue;
+			}
+			sim_stalled = true;
+			throw sim_stall();
+		}
+
+		uint64_t next = bus_next_event_time();
+		sim_advance(next > sim_now ? next - sim_now : 1);
+	}
+}
+
+static uint32_t pio_pop_rx(void)
+{
+	sim_event_t e = rx_fifo.front();
+	rx_fifo.pop_front();
+
+	if (e.type == SIM_EVENT_END) {
+		return e.word;
+	}
+
+	sim_region_stats_t *s = &sim_stats[e.region];
+	if (e.type == SIM_EVENT_ADDRESS) {
+		fw_region = e.region;
+		s->addresses++;
+		if (e.region == SIM_REGION_ROM && !rom_offset_loaded(e.address - CART_DOM1_ADDR2_START)) {
+			s->not_ready++;
+		}
+	} else if (e.type == SIM_EVENT_WRITE) {
+		s->writes++;
+		if (e.region == SIM_REGION_SRAM) {
+			sram_shadow[e.address] = e.word >> 16;
+		}
+	}
+
+	last_progress = sim_now;
+	bus_update();
+
+	return e.word;
+}
+
+static void pio_push_tx(uint32_t value)
+{
+	if (pio_blocked) {
+		pio_blocked = false;
+		bus_serve_read(pio_blocked_event, sim_now, value);
+	} else {
+		tx_fifo.push_back({ sim_now, value });
+	}
+
+	bus_update();
+}
+
+static uint32_t pio_fstat(void)
+{
+	if (rx_fifo.empty() && !pio_blocked && !bus_has_more()) {
+		bus_end_trace();
+	}
+
+	uint32_t fstat = 0;
+	if (rx_fifo.empty()) {
+		fstat |= 1u << PIO_FSTAT_RXEMPTY_LSB;
+	}
+	if (tx_fifo.size() >= SIM_PIO_FIFO_DEPTH) {
+		fstat |= 1u << PIO_FSTAT_TXFULL_LSB;
+	}
+	if (tx_fifo.empty()) {
+		fstat |= 1u << PIO_FSTAT_TXEMPTY_LSB;
+	}
+
+	// Only sm0 is modelled, the other state machines look idle
+	return fstat | 0x0E000E00;
+}
+
+// The handler jumped the PIO back to its start, dropping the rest of the
+// transaction it was serving
+static void pio_restart(void)
+{
+	if (pio_blocked) {
+		pio_blocked = false;
+		sim_stats[pio_blocked_event.region].unhandled++;
+	}
+
+	while (!bus_events.empty() && bus_events.front().txn == pio_txn) {
+		sim_stats[bus_events.front().region].unhandled++;
+		bus_events.pop_front();
+	}
+
+	pio_ready_at = sim_now;
+	last_progress = sim_now;
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program)
+{
+	(void)pio;
+	(void)program;
+	return 0;
+}
+
+void pio_remove_program(PIO pio, const pio_program_t *program, uint loaded_offset)
+{
+	(void)pio;
+	(void)program;
+	(void)loaded_offset;
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled)
+{
+	(void)pio;
+	(void)sm;
+	(void)enabled;
+}
+
+static bool is_modelled_sm(PIO pio, uint sm)
+{
+	return pio == pio0 && sm == 0;
+}
+
+void pio_sm_exec(PIO pio, uint sm, uint instr)
+{
+	sim_advance(sim_cost.pio_txf);
+	if (is_modelled_sm(pio, sm) && instr == pio_encode_jmp(0)) {
+		pio_restart();
+	}
+}
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data)
+{
+	sim_advance(sim_cost.pio_txf);
+	if (is_modelled_sm(pio, sm)) {
+		pio_push_tx(data);
+	}
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data)
+{
+	pio_sm_put(pio, sm, data);
+}
+
+uint32_t pio_sm_get(PIO pio, uint sm)
+{
+	sim_advance(sim_cost.pio_rxf);
+	if (!is_modelled_sm(pio, sm) || rx_fifo.empty()) {
+		return 0;
+	}
+
+	return pio_pop_rx();
+}
+
+uint32_t pio_sm_get_blocking(PIO pio, uint sm)
+{
+	if (!is_modelled_sm(pio, sm)) {
+		return 0;
+	}
+
+	sim_advance(sim_cost.pio_fstat);
+	pio_wait_for_rx();
+	sim_advance(sim_cost.pio_rxf);
+
+	return pio_pop_rx();
+}
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm)
+{
+	sim_advance(sim_cost.pio_fstat);
+	return !is_modelled_sm(pio, sm) || rx_fifo.empty();
+}
+
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm)
+{
+	sim_advance(sim_cost.pio_fstat);
+	return is_modelled_sm(pio, sm) && tx_fifo.size() >= SIM_PIO_FIFO_DEPTH;
+}
+
+void pio_set_irq0_source_enabled(PIO pio, enum pio_interrupt_source source, bool enabled)
+{
+	(void)pio;
+	(void)source;
+	(void)enabled;
+}
+
+////////////////////////////////////////////////////////////
+// Flash array
+//
+// What MCU2 programs for the rom: chunks found through flash_array_dedup and
+// confirmed by comparing the data, in blocks handed out by the library, and the
+// mapping mcu1 reads into rom_mapping.
+
+static std::vector<uint8_t> flash_array;
+
+static bool is_flash_array_chip(uint8_t chip)
+{
+	return sim_config.rom_in_flash_array && chip >= FLASH_CHIP_INDEX;
+}
+
+static void flash_array_build(void)
+{
+	static flash_array_dedup_t dedup;
+	static flash_library_t library;
+	alignas(4) uint8_t chunk[FLASH_ARRAY_CHUNK_BYTES];
+	uint32_t chunks = (std::min<uint32_t>(sim_config.rom_bytes, FLASH_ARRAY_MAX_ROM_BYTES) + FLASH_ARRAY_CHUNK_BYTES - 1) / FLASH_ARRAY_CHUNK_BYTES;
+
+	flash_array.assign(FLASH_ARRAY_BYTES, 0xFF);
+	flash_array_dedup_reset(&dedup);
+	sim_flash_array_unique_chunks = 0;
+
+	// Blocks worn unevenly by roms that came and went, so this one is spread
+	// over both chips
+	flash_library_init(&library);
+	uint32_t x = 1;
+	for (int i = 1; i < FLASH_ARRAY_BLOCKS; i++) {
+		x = x * 1103515245 + 12345;
+		library.erase_count[i] = (x >> 16) & 3;
+	}
+	int entry = flash_library_make_room(&library, FLASH_ARRAY_ROM_BLOCKS(chunks * FLASH_ARRAY_CHUNK_BYTES));
+	uint32_t first = flash_library_alloc_block(&library, entry) * FLASH_ARRAY_CHUNKS_PER_BLOCK;
+	uint32_t next = first + FLASH_ARRAY_MAPPING_CHUNKS;
+
+	for (uint32_t i = 0; i < chunks; i++) {
+		for (uint32_t b = 0; b < FLASH_ARRAY_CHUNK_BYTES; b++) {
+			chunk[b] = sim_rom_read8(i * FLASH_ARRAY_CHUNK_BYTES + b);
+		}
+
+		uint32_t hash = flash_array_chunk_hash(chunk);
+		uint16_t index = flash_array_dedup_lookup(&dedup, hash);
+		if (index == FLASH_ARRAY_NO_CHUNK || memcmp(&flash_array[FLASH_ARRAY_CHUNK_ADDRESS(index)], chunk, FLASH_ARRAY_CHUNK_BYTES) != 0) {
+			if (next % FLASH_ARRAY_CHUNKS_PER_BLOCK == 0) {
+				next = flash_library_alloc_block(&library, entry) * FLASH_ARRAY_CHUNKS_PER_BLOCK;
+			}
+			index = next++;
+			sim_flash_array_unique_chunks++;
+			memcpy(&flash_array[FLASH_ARRAY_CHUNK_ADDRESS(index)], chunk, FLASH_ARRAY_CHUNK_BYTES);
+			flash_array_dedup_insert(&dedup, hash, index);
+		}
+		rom_mapping[i] = index;
+	}
+	for (uint32_t i = chunks; i < MAPPING_TABLE_LEN; i++) {
+		rom_mapping[i] = first + FLASH_ARRAY_MAPPING_CHUNKS;
+	}
+
+	g_flashArrayMappingAddress = FLASH_ARRAY_CHUNK_ADDRESS(first);
+	memcpy(&flash_array[g_flashArrayMappingAddress], rom_mapping, sizeof(rom_mapping));
+	sim_flash_array_blocks = FLASH_ARRAY_BLOCKS - 1 - flash_library_free_blocks(&library);
+}
+
+////////////////////////////////////////////////////////////
+// PSRAM array
+
+void psram_set_cs(uint8_t chip)
+{
+	sim_advance(sim_cost.gpio);
+	if (chip != psram_chip) {
+		sim_stats[fw_region].chip_switches++;
+	}
+	psram_chip = chip;
+}
+
+void psram_switch_cs(uint8_t from, uint8_t to)
+{
+	// Toggles the demux pins, only right if `from` is what's selected
+	sim_advance(sim_cost.gpio);
+	if (from != psram_chip) {
+		sim_cs_toggle_mismatch++;
+	}
+	if (to != from) {
+		sim_stats[fw_region].chip_switches++;
+	}
+	psram_chip = psram_chip ^ (from ^ to);
+}
+
+uint8_t psram_addr_to_chip(uint32_t address)
+{
+	return PSRAM_ROM_CHIP(address);
+}
+
+static uint8_t psram_read8(uint8_t chip, uint32_t offset)
+{
+	if (chip < START_ROM_LOAD_CHIP_INDEX || chip > MAX_MEMORY_ARRAY_CHIP_INDEX) {
+		// Nothing selected, the bus floats high
+		return 0xFF;
+	}
+
+	if (is_flash_array_chip(chip)) {
+		uint32_t address = (chip - FLASH_CHIP_INDEX) * FLASH_CHIP_CAPACITY_BYTES + (offset & (FLASH_CHIP_CAPACITY_BYTES - 1));
+		return address < flash_array.size() ? flash_array[address] : 0xFF;
+	}
+
+	// The loader fills the array linearly, one chip after the other
+	return sim_rom_read8((chip - START_ROM_LOAD_CHIP_INDEX) * PSRAM_CHIP_CAPACITY_BYTES + (offset & (PSRAM_CHIP_CAPACITY_BYTES - 1)));
+}
+
+static bool is_psram_alias(uintptr_t addr)
+{
+	return addr >= SIM_XIP_NOCACHE_NOALLOC_BASE && addr < SIM_XIP_NOCACHE_NOALLOC_END;
+}
+
+static bool is_xip_cached_alias(uintptr_t addr)
+{
+	return addr >= SIM_XIP_CACHED_BASE && addr < SIM_XIP_CACHED_END;
+}
+
+////////////////////////////////////////////////////////////
+// XIP cache
+//
+// Lines hold the data of the chip that was selected when they were filled,
+// like the real cache, so a chip switch without a flush reads back stale data.
+
+typedef struct {
+	bool valid;
+	uint32_t tag;
+	uint8_t data[SIM_XIP_CACHE_LINE];
+} sim_xip_line_t;
+
+typedef struct {
+	bool enabled;
+	sim_xip_line_t lines[SIM_XIP_CACHE_SETS][SIM_XIP_CACHE_WAYS];
+	uint8_t replace_way[SIM_XIP_CACHE_SETS]; // Least recently used way
+	uint64_t flush_done_at;
+} sim_xip_cache_t;
+
+static sim_xip_cache_t xip_cache;
+
+static sim_xip_line_t *xip_cache_find(uint32_t offset)
+{
+	uint32_t set = (offset / SIM_XIP_CACHE_LINE) % SIM_XIP_CACHE_SETS;
+	uint32_t tag = offset / SIM_XIP_CACHE_LINE / SIM_XIP_CACHE_SETS;
+
+	for (int way = 0; way < SIM_XIP_CACHE_WAYS; way++) {
+		sim_xip_line_t *line = &xip_cache.lines[set][way];
+		if (line->valid && line->tag == tag) {
+			xip_cache.replace_way[set] = way ^ 1;
+			return line;
+		}
+	}
+
+	return NULL;
+}
+
+// Returns true on a hit, fills the line from the selected chip on a miss
+static bool xip_cache_access(uint32_t offset)
+{
+	if (xip_cache_find(offset)) {
+		sim_xip_cache_hits++;
+		return true;
+	}
+
+	sim_xip_cache_misses++;
+
+	uint32_t set = (offset / SIM_XIP_CACHE_LINE) % SIM_XIP_CACHE_SETS;
+	uint8_t way = xip_cache.replace_way[set];
+	sim_xip_line_t *line = &xip_cache.lines[set][way];
+	uint32_t line_offset = offset & ~(SIM_XIP_CACHE_LINE - 1);
+
+	line->valid = true;
+	line->tag = offset / SIM_XIP_CACHE_LINE / SIM_XIP_CACHE_SETS;
+	for (int i = 0; i < SIM_XIP_CACHE_LINE; i++) {
+		line->data[i] = psram_read8(psram_chip, line_offset + i);
+	}
+	xip_cache.replace_way[set] = way ^ 1;
+
+	return false;
+}
+
+static uint8_t xip_cache_read8(uint32_t offset)
+{
+	uint32_t set = (offset / SIM_XIP_CACHE_LINE) % SIM_XIP_CACHE_SETS;
+	uint32_t tag = offset / SIM_XIP_CACHE_LINE / SIM_XIP_CACHE_SETS;
+
+	for (int way = 0; way < SIM_XIP_CACHE_WAYS; way++) {
+		const sim_xip_line_t *line = &xip_cache.lines[set][way];
+		if (line->valid && line->tag == tag) {
+			return line->data[offset % SIM_XIP_CACHE_LINE];
+		}
+	}
+
+	// Flushed since the fetch was issued
+	return psram_read8(psram_chip, offset);
+}
+
+static void xip_cache_flush(void)
+{
+	memset(xip_cache.lines, 0, sizeof(xip_cache.lines));
+	memset(xip_cache.replace_way, 0, sizeof(xip_cache.replace_way));
+	xip_cache.flush_done_at = sim_now + sim_cost.xip_flush;
+	sim_xip_cache_flushes++;
+}
+
+////////////////////////////////////////////////////////////
+// DMA
+
+typedef struct {
+	bool claimed;
+	uintptr_t read_addr;
+	uintptr_t write_addr;
+	uint32_t trans_count;
+	uint32_t ctrl;
+
+	bool busy;
+	uint64_t done_at;
+	uintptr_t active_read_addr;
+	uintptr_t active_write_addr;
+	bool read_addr_written;
+	bool write_addr_written;
+} sim_dma_channel_t;
+
+static sim_dma_channel_t dma_channels[NUM_DMA_CHANNELS];
+static uint64_t qspi_free_at = 0;
+
+static uintptr_t dma_next_addr(uintptr_t addr, uint32_t size, bool incr, bool ring, uint32_t ring_bits)
+{
+	if (!incr) {
+		return addr;
+	}
+
+	if (ring && ring_bits) {
+		uintptr_t mask = ((uintptr_t)1 << ring_bits) - 1;
+		return (addr & ~mask) | ((addr + size) & mask);
+	}
+
+	return addr + size;
+}
+
+static uint32_t dma_read_value(uintptr_t addr, uint32_t size)
+{
+	uint8_t bytes[4] = { 0 };
+
+	if (is_psram_alias(addr)) {
+		for (uint32_t i = 0; i < size; i++) {
+			bytes[i] = psram_read8(psram_chip, (uint32_t)(addr - SIM_XIP_NOCACHE_NOALLOC_BASE) + i);
+		}
+	} else if (is_xip_cached_alias(addr)) {
+		for (uint32_t i = 0; i < size; i++) {
+			uint32_t offset = (uint32_t)(addr + i) & SIM_XIP_ALIAS_MASK;
+			bytes[i] = xip_cache.enabled ? xip_cache_read8(offset) : psram_read8(psram_chip, offset);
+		}
+	} else {
+		memcpy(bytes, (const void *)addr, size);
+	}
+
+	// Little-endian, like the AHB bus
+	return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static uint32_t dma_bswap(uint32_t value, uint32_t size)
+{
+	if (size == 2) {
+		return ((value & 0xFF) << 8) | ((value >> 8) & 0xFF);
+	} else if (size == 4) {
+		return __builtin_bswap32(value);
+	}
+
+	return value;
+}
+
+static bool ssi_rx_dma_enabled(void);
+
+static bool dma_is_ssi_rx(const sim_dma_channel_t *ch)
+{
+	return ((ch->ctrl & DMA_CH0_CTRL_TRIG_TREQ_SEL_BITS) >> DMA_CH0_CTRL_TRIG_TREQ_SEL_LSB) == DREQ_XIP_SSIRX;
+}
+
+static void dma_trigger(uint channel, uint64_t at)
+{
+	sim_dma_channel_t *ch = &dma_channels[channel];
+
+	if (!(ch->ctrl & DMA_CH0_CTRL_TRIG_EN_BITS)) {
+		return;
+	}
+
+	if (ch->busy) {
+		// Triggering a busy channel has no effect on the RP2040
+		sim_dma_retrigger_while_busy++;
+		return;
+	}
+
+	if (dma_is_ssi_rx(ch)) {
+		// Paced by the SSI, ssi_update moves the data as it arrives
+		ch->busy = true;
+		ch->done_at = UINT64_MAX;
+		ch->active_write_addr = ch->write_addr;
+		ch->write_addr_written = false;
+		return;
+	}
+
+	uint32_t size = 1u << ((ch->ctrl & DMA_CH0_CTRL_TRIG_DATA_SIZE_BITS) >> DMA_CH0_CTRL_TRIG_DATA_SIZE_LSB);
+	uint64_t duration;
+	uint64_t start = at;
+
+	if ((is_psram_alias(ch->read_addr) || is_xip_cached_alias(ch->read_addr)) && ssi_rx_dma_enabled()) {
+		// A channel paced by DREQ_XIP_SSIRX would take the data
+		sim_xip_with_rdmae++;
+	}
+
+	if (is_psram_alias(ch->read_addr) || (is_xip_cached_alias(ch->read_addr) && !xip_cache.enabled)) {
+		// Every access through the uncached alias is its own SSI transfer
+		// of one 32-bit frame, and there is only one SSI
+		uint64_t per_access = (uint64_t)sim_config.qspi_div * sim_cost.xip_read_clocks + sim_cost.xip_overhead;
+		start = std::max(at, qspi_free_at);
+		duration = per_access * ch->trans_count;
+		qspi_free_at = start + duration;
+	} else if (is_xip_cached_alias(ch->read_addr)) {
+		// Hits come straight out of the cache, a miss fills one line over the SSI
+		uint64_t fill = (uint64_t)sim_config.qspi_div * (sim_cost.ssi_setup_clocks + sim_cost.ssi_frame_clocks * SIM_XIP_CACHE_LINE / 4) +
+						sim_cost.xip_overhead;
+		bool incr_read = ch->ctrl & DMA_CH0_CTRL_TRIG_INCR_READ_BITS;
+		uintptr_t addr = ch->read_addr;
+		uint64_t t = std::max(at, xip_cache.flush_done_at);
+
+		for (uint32_t i = 0; i < ch->trans_count; i++) {
+			if (xip_cache_access((uint32_t)addr & SIM_XIP_ALIAS_MASK)) {
+				t += sim_cost.mem_read;
+			} else {
+				t = std::max(t, qspi_free_at) + fill;
+				qspi_free_at = t;
+			}
+			addr = dma_next_addr(addr, size, incr_read, false, 0);
+		}
+
+		duration = t - start;
+	} else {
+		duration = (uint64_t)sim_cost.mem_read * ch->trans_count;
+	}
+
+	(void)size;
+	ch->busy = true;
+	ch->done_at = start + duration;
+	ch->active_read_addr = ch->read_addr;
+	ch->active_write_addr = ch->write_addr;
+	ch->read_addr_written = false;
+	ch->write_addr_written = false;
+}
+
+static void dma_complete(uint channel)
+{
+	sim_dma_channel_t *ch = &dma_channels[channel];
+	uint32_t size = 1u << ((ch->ctrl & DMA_CH0_CTRL_TRIG_DATA_SIZE_BITS) >> DMA_CH0_CTRL_TRIG_DATA_SIZE_LSB);
+	bool incr_read = ch->ctrl & DMA_CH0_CTRL_TRIG_INCR_READ_BITS;
+	bool incr_write = ch->ctrl & DMA_CH0_CTRL_TRIG_INCR_WRITE_BITS;
+	uint32_t ring_bits = (ch->ctrl & DMA_CH0_CTRL_TRIG_RING_SIZE_BITS) >> DMA_CH0_CTRL_TRIG_RING_SIZE_LSB;
+	bool ring_write = ch->ctrl & DMA_CH0_CTRL_TRIG_RING_SEL_BITS;
+	uintptr_t read_addr = ch->active_read_addr;
+	uintptr_t write_addr = ch->active_write_addr;
+
+	for (uint32_t i = 0; i < ch->trans_count; i++) {
+		uint32_t value = dma_read_value(read_addr, size);
+		if (ch->ctrl & DMA_CH0_CTRL_TRIG_BSWAP_BITS) {
+			value = dma_bswap(value, size);
+		}
+		memcpy((void *)write_addr, &value, size);
+
+		read_addr = dma_next_addr(read_addr, size, incr_read, !ring_write, ring_bits);
+		write_addr = dma_next_addr(write_addr, size, incr_write, ring_write, ring_bits);
+	}
+
+	if (!ch->read_addr_written) {
+		ch->read_addr = read_addr;
+	}
+	if (!ch->write_addr_written) {
+		ch->write_addr = write_addr;
+	}
+	ch->busy = false;
+
+	uint chain_to = (ch->ctrl & DMA_CH0_CTRL_TRIG_CHAIN_TO_BITS) >> DMA_CH0_CTRL_TRIG_CHAIN_TO_LSB;
+	if (chain_to != channel) {
+		dma_trigger(chain_to, ch->done_at);
+	}
+}
+
+static void dma_update(void)
+{
+	while (true) {
+		int next = -1;
+		for (int i = 0; i < NUM_DMA_CHANNELS; i++) {
+			if (dma_channels[i].busy && dma_channels[i].done_at <= sim_now &&
+				(next < 0 || dma_channels[i].done_at < dma_channels[next].done_at)) {
+				next = i;
+			}
+		}
+
+		if (next < 0) {
+			return;
+		}
+
+		dma_complete(next);
+	}
+}
+
+int dma_claim_unused_channel(bool required)
+{
+	for (int i = 0; i < NUM_DMA_CHANNELS; i++) {
+		if (!dma_channels[i].claimed) {
+			dma_channels[i].claimed = true;
+			return i;
+		}
+	}
+
+	if (required) {
+		fprintf(stderr, "No free DMA channels\n");
+		abort();
+	}
+
+	return -1;
+}
+
+void dma_channel_unclaim(uint channel)
+{
+	dma_channels[channel].claimed = false;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel)
+{
+	dma_channel_config c = { 0 };
+	c.ctrl = DMA_CH0_CTRL_TRIG_EN_BITS;
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+	channel_config_set_read_increment(&c, true);
+	channel_config_set_write_increment(&c, false);
+	channel_config_set_chain_to(&c, channel);
+	channel_config_set_dreq(&c, 0x3f);
+
+	return c;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr, const volatile void *read_addr, uint transfer_count, bool trigger)
+{
+	sim_advance(sim_cost.dma_reg * 4);
+	sim_dma_channel_t *ch = &dma_channels[channel];
+	ch->read_addr = (uintptr_t)read_addr;
+	ch->write_addr = (uintptr_t)write_addr;
+	ch->trans_count = transfer_count;
+	ch->ctrl = config->ctrl;
+	if (trigger) {
+		dma_trigger(channel, sim_now);
+	}
+}
+
+void dma_channel_start(uint channel)
+{
+	sim_advance(sim_cost.dma_reg);
+	dma_trigger(channel, sim_now);
+}
+
+void dma_channel_abort(uint channel)
+{
+	sim_advance(sim_cost.dma_reg);
+	dma_channels[channel].busy = false;
+}
+
+bool dma_channel_is_busy(uint channel)
+{
+	sim_advance(sim_cost.dma_reg);
+	if (dma_channels[channel].busy) {
+		sim_stats[fw_region].dma_busy_polls++;
+	}
+
+	return dma_channels[channel].busy;
+}
+
+void dma_channel_wait_for_finish_blocking(uint channel)
+{
+	while (dma_channel_is_busy(channel)) {
+		tight_loop_contents();
+	}
+}
+
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger)
+{
+	sim_reg_write(trigger ? SIM_REG_DMA_READ_ADDR_TRIG : SIM_REG_DMA_READ_ADDR, channel, (uintptr_t)read_addr);
+}
+
+void dma_channel_set_write_addr(uint channel, volatile void *write_addr, bool trigger)
+{
+	sim_reg_write(trigger ? SIM_REG_DMA_WRITE_ADDR_TRIG : SIM_REG_DMA_WRITE_ADDR, channel, (uintptr_t)write_addr);
+}
+
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger)
+{
+	sim_reg_write(trigger ? SIM_REG_DMA_TRANS_COUNT_TRIG : SIM_REG_DMA_TRANS_COUNT, channel, trans_count);
+}
+
+////////////////////////////////////////////////////////////
+// SSI
+//
+// Direct quad reads, as the rom stream issues them: after the SSI is enabled
+// the first word written to DR0 is the command and the second the address.
+// Frames then arrive every ssi_frame_clocks until ctrlr1 + 1 of them are
+// received or the SSI is disabled. With RDMAE set in dmacr, a channel paced
+// by DREQ_XIP_SSIRX takes each frame as it arrives, first byte on the wire in
+// the top 8 bits. Without it nothing raises the DREQ.
+
+typedef struct {
+	bool enabled;
+	uint32_t dmacr;
+	uint32_t ndf;
+	uint32_t tx_words;
+
+	bool active;
+	uint8_t chip;
+	uint32_t address;
+	uint32_t setup_clocks;
+	uint64_t start;
+	uint32_t frames;
+	uint32_t delivered;
+} sim_ssi_t;
+
+static sim_ssi_t ssi;
+
+static bool ssi_rx_dma_enabled(void)
+{
+	return ssi.dmacr & SSI_DMACR_RDMAE_BITS;
+}
+
+static uint64_t ssi_frame_ready_at(uint32_t frame)
+{
+	return ssi.start + (uint64_t)sim_config.qspi_div * (ssi.setup_clocks + sim_cost.ssi_frame_clocks * (frame + 1));
+}
+
+static void ssi_deliver(uint32_t frame)
+{
+	uint32_t offset = ssi.address + frame * 4;
+	uint32_t value = ((uint32_t)psram_read8(ssi.chip, offset) << 24) | (psram_read8(ssi.chip, offset + 1) << 16) |
+		(psram_read8(ssi.chip, offset + 2) << 8) | psram_read8(ssi.chip, offset + 3);
+
+	for (int i = 0; ssi_rx_dma_enabled() && i < NUM_DMA_CHANNELS; i++) {
+		sim_dma_channel_t *ch = &dma_channels[i];
+		if (!ch->busy || !dma_is_ssi_rx(ch)) {
+			continue;
+		}
+
+		uint32_t size = 1u << ((ch->ctrl & DMA_CH0_CTRL_TRIG_DATA_SIZE_BITS) >> DMA_CH0_CTRL_TRIG_DATA_SIZE_LSB);
+		uint32_t ring_bits = (ch->ctrl & DMA_CH0_CTRL_TRIG_RING_SIZE_BITS) >> DMA_CH0_CTRL_TRIG_RING_SIZE_LSB;
+		if (ch->ctrl & DMA_CH0_CTRL_TRIG_BSWAP_BITS) {
+			value = dma_bswap(value, size);
+		}
+		memcpy((void *)ch->write_addr, &value, size);
+		ch->write_addr = dma_next_addr(ch->write_addr, size, ch->ctrl & DMA_CH0_CTRL_TRIG_INCR_WRITE_BITS,
+			ch->ctrl & DMA_CH0_CTRL_TRIG_RING_SEL_BITS, ring_bits);
+
+		if (--ch->trans_count == 0) {
+			ch->busy = false;
+		}
+		return;
+	}
+
+	// Nobody drains the fifo, the frame is lost
+}
+
+// CS went high at `at`, check the read didn't run past tCEM
+static void ssi_end(uint64_t at)
+{
+	if (!is_flash_array_chip(ssi.chip) && (at - ssi.start) * 1000 > (uint64_t)SIM_PSRAM_TCEM_US * sim_config.sys_khz) {
+		sim_psram_tcem_violations++;
+	}
+	ssi.active = false;
+}
+
+static void ssi_update(void)
+{
+	if (!ssi.active) {
+		return;
+	}
+
+	while (ssi.delivered < ssi.frames && ssi_frame_ready_at(ssi.delivered) <= sim_now) {
+		ssi_deliver(ssi.delivered++);
+	}
+
+	if (ssi.delivered == ssi.frames) {
+		ssi_end(ssi_frame_ready_at(ssi.frames - 1));
+	}
+}
+
+static void ssi_set_enabled(bool enabled)
+{
+	ssi_update();
+	if (!enabled && ssi.active) {
+		// Aborted, the rest of the read is dropped and the bus is free again
+		ssi_end(sim_now);
+		qspi_free_at = sim_now;
+	}
+
+	ssi.enabled = enabled;
+	ssi.tx_words = 0;
+}
+
+static void ssi_push(uint32_t value)
+{
+	if (!ssi.enabled) {
+		return;
+	}
+
+	if (++ssi.tx_words < 2) {
+		// Command, always the 0xEB quad read qspi_init_qspi set up
+		return;
+	}
+
+	if (ssi.tx_words > 2 || ssi.active) {
+		fprintf(stderr, "SSI: unexpected DR0 write 0x%08x\n", value);
+		return;
+	}
+
+	ssi.active = true;
+	ssi.chip = psram_chip;
+	// Flash array chips take the address with a mode byte after it
+	ssi.address = is_flash_array_chip(psram_chip) ? value >> 8 : value;
+	ssi.setup_clocks = is_flash_array_chip(psram_chip) ? sim_cost.flash_setup_clocks : sim_cost.ssi_setup_clocks;
+	ssi.start = std::max(sim_now, qspi_free_at) + sim_cost.xip_overhead;
+	ssi.frames = ssi.ndf + 1;
+	ssi.delivered = 0;
+	qspi_free_at = ssi_frame_ready_at(ssi.frames - 1);
+	sim_ssi_streams++;
+}
+
+////////////////////////////////////////////////////////////
+// Register access
+
+uintptr_t sim_reg_read(sim_reg_id_t id, int index)
+{
+	switch (id) {
+	case SIM_REG_PIO_FSTAT:
+		sim_advance(sim_cost.pio_fstat);
+		return index == 0 ? pio_fstat() : 0x0F000F00;
+
+	case SIM_REG_PIO_RXF:
+		if (index != 0) {
+			sim_advance(sim_cost.pio_rxf);
+			return 0;
+		}
+		// Reading an empty FIFO is a handler bug, treat it as a blocking read
+		pio_wait_for_rx();
+		sim_advance(sim_cost.pio_rxf);
+		return pio_pop_rx();
+
+	case SIM_REG_DMA_CTRL:
+	case SIM_REG_DMA_CTRL_TRIG:
+		sim_advance(sim_cost.dma_reg);
+		if (dma_channels[index].busy) {
+			sim_stats[fw_region].dma_busy_polls++;
+			return dma_channels[index].ctrl | DMA_CH0_CTRL_TRIG_BUSY_BITS;
+		}
+		return dma_channels[index].ctrl;
+
+	case SIM_REG_DMA_READ_ADDR:
+	case SIM_REG_DMA_READ_ADDR_TRIG:
+		sim_advance(sim_cost.dma_reg);
+		return dma_channels[index].read_addr;
+
+	case SIM_REG_DMA_WRITE_ADDR:
+	case SIM_REG_DMA_WRITE_ADDR_TRIG:
+		sim_advance(sim_cost.dma_reg);
+		return dma_channels[index].write_addr;
+
+	case SIM_REG_DMA_TRANS_COUNT:
+	case SIM_REG_DMA_TRANS_COUNT_TRIG:
+		sim_advance(sim_cost.dma_reg);
+		return dma_channels[index].busy ? dma_channels[index].trans_count : 0;
+
+	case SIM_REG_SSI_SSIENR:
+		sim_advance(sim_cost.ssi_reg);
+		return ssi.enabled;
+
+	case SIM_REG_SSI_CTRLR1:
+		sim_advance(sim_cost.ssi_reg);
+		return ssi.ndf;
+
+	case SIM_REG_SSI_DR0:
+		sim_advance(sim_cost.ssi_reg);
+		return 0;
+
+	case SIM_REG_SSI_BAUDR:
+		sim_advance(sim_cost.ssi_reg);
+		return sim_config.qspi_div;
+
+	case SIM_REG_SSI_DMACR:
+		sim_advance(sim_cost.ssi_reg);
+		return ssi.dmacr;
+
+	case SIM_REG_XIP_CTRL:
+		sim_advance(sim_cost.ssi_reg);
+		return xip_cache.enabled ? XIP_CTRL_EN_BITS : 0;
+
+	case SIM_REG_XIP_FLUSH:
+		// Blocks until the flush is done
+		sim_advance(sim_cost.ssi_reg + (xip_cache.flush_done_at > sim_now ? xip_cache.flush_done_at - sim_now : 0));
+		return 0;
+
+	default:
+		sim_advance(sim_cost.dma_reg);
+		return 0;
+	}
+}
+
+void sim_reg_write(sim_reg_id_t id, int index, uintptr_t value)
+{
+	sim_dma_channel_t *ch = index < NUM_DMA_CHANNELS ? &dma_channels[index] : NULL;
+
+	switch (id) {
+	case SIM_REG_PIO_TXF:
+		sim_advance(sim_cost.pio_txf);
+		if (index == 0) {
+			pio_push_tx((uint32_t)value);
+		}
+		break;
+
+	case SIM_REG_DMA_READ_ADDR:
+	case SIM_REG_DMA_READ_ADDR_TRIG:
+		sim_advance(sim_cost.dma_reg);
+		ch->read_addr = value;
+		ch->read_addr_written = ch->busy;
+		if (id == SIM_REG_DMA_READ_ADDR_TRIG) {
+			dma_trigger(index, sim_now);
+		}
+		break;
+
+	case SIM_REG_DMA_WRITE_ADDR:
+	case SIM_REG_DMA_WRITE_ADDR_TRIG:
+		sim_advance(sim_cost.dma_reg);
+		ch->write_addr = value;
+		ch->write_addr_written = ch->busy;
+		if (id == SIM_REG_DMA_WRITE_ADDR_TRIG) {
+			dma_trigger(index, sim_now);
+		}
+		break;
+
+	case SIM_REG_DMA_TRANS_COUNT:
+	case SIM_REG_DMA_TRANS_COUNT_TRIG:
+		sim_advance(sim_cost.dma_reg);
+		ch->trans_count = (uint32_t)value;
+		if (id == SIM_REG_DMA_TRANS_COUNT_TRIG) {
+			dma_trigger(index, sim_now);
+		}
+		break;
+
+	case SIM_REG_DMA_CTRL:
+	case SIM_REG_DMA_CTRL_TRIG:
+		sim_advance(sim_cost.dma_reg);
+		ch->ctrl = (uint32_t)value & ~DMA_CH0_CTRL_TRIG_BUSY_BITS;
+		if (id == SIM_REG_DMA_CTRL_TRIG) {
+			dma_trigger(index, sim_now);
+		}
+		break;
+
+	case SIM_REG_DMA_MULTI_CHAN_TRIGGER:
+		sim_advance(sim_cost.dma_reg);
+		for (int i = 0; i < NUM_DMA_CHANNELS; i++) {
+			if (value & (1u << i)) {
+				dma_trigger(i, sim_now);
+			}
+		}
+		break;
+
+	case SIM_REG_DMA_ABORT:
+		sim_advance(sim_cost.dma_reg);
+		for (int i = 0; i < NUM_DMA_CHANNELS; i++) {
+			if (value & (1u << i)) {
+				dma_channels[i].busy = false;
+			}
+		}
+		break;
+
+	case SIM_REG_SSI_SSIENR:
+		sim_advance(sim_cost.ssi_reg);
+		ssi_set_enabled(value & 1);
+		break;
+
+	case SIM_REG_SSI_CTRLR1:
+		sim_advance(sim_cost.ssi_reg);
+		// Only writable while the SSI is disabled
+		if (!ssi.enabled) {
+			ssi.ndf = (uint32_t)value & 0xFFFF;
+		}
+		break;
+
+	case SIM_REG_SSI_DR0:
+		sim_advance(sim_cost.ssi_reg);
+		ssi_push((uint32_t)value);
+		break;
+
+	case SIM_REG_SSI_DMACR:
+		sim_advance(sim_cost.ssi_reg);
+		ssi_update();
+		ssi.dmacr = (uint32_t)value;
+		break;
+
+	case SIM_REG_XIP_CTRL:
+		sim_advance(sim_cost.ssi_reg);
+		xip_cache.enabled = value & XIP_CTRL_EN_BITS;
+		break;
+
+	case SIM_REG_XIP_FLUSH:
+		sim_advance(sim_cost.ssi_reg);
+		if (value & 1) {
+			xip_cache_flush();
+		}
+		break;
+
+	default:
+		sim_advance(sim_cost.dma_reg);
+		break;
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+void sim_hw_init(void)
+{
+	for (int p = 0; p < 2; p++) {
+		sim_pio_hw[p].fstat.bind(p == 0 ? SIM_REG_PIO_FSTAT : SIM_REG_NONE, 0);
+		for (int sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) {
+			int index = p * NUM_PIO_STATE_MACHINES + sm;
+			sim_pio_hw[p].txf[sm].bind(SIM_REG_PIO_TXF, index);
+			sim_pio_hw[p].rxf[sm].bind(SIM_REG_PIO_RXF, index);
+		}
+	}
+
+	for (int i = 0; i < NUM_DMA_CHANNELS; i++) {
+		dma_channel_hw_t *ch = &sim_dma_hw.ch[i];
+		ch->read_addr.bind(SIM_REG_DMA_READ_ADDR, i);
+		ch->write_addr.bind(SIM_REG_DMA_WRITE_ADDR, i);
+		ch->transfer_count.bind(SIM_REG_DMA_TRANS_COUNT, i);
+		ch->ctrl_trig.bind(SIM_REG_DMA_CTRL_TRIG, i);
+
+		ch->al1_ctrl.bind(SIM_REG_DMA_CTRL, i);
+		ch->al1_read_addr.bind(SIM_REG_DMA_READ_ADDR, i);
+		ch->al1_write_addr.bind(SIM_REG_DMA_WRITE_ADDR, i);
+		ch->al1_transfer_count_trig.bind(SIM_REG_DMA_TRANS_COUNT_TRIG, i);
+
+		ch->al2_ctrl.bind(SIM_REG_DMA_CTRL, i);
+		ch->al2_transfer_count.bind(SIM_REG_DMA_TRANS_COUNT, i);
+		ch->al2_read_addr.bind(SIM_REG_DMA_READ_ADDR, i);
+		ch->al2_write_addr_trig.bind(SIM_REG_DMA_WRITE_ADDR_TRIG, i);
+
+		ch->al3_ctrl.bind(SIM_REG_DMA_CTRL, i);
+		ch->al3_write_addr.bind(SIM_REG_DMA_WRITE_ADDR, i);
+		ch->al3_transfer_count.bind(SIM_REG_DMA_TRANS_COUNT, i);
+		ch->al3_read_addr_trig.bind(SIM_REG_DMA_READ_ADDR_TRIG, i);
+	}
+	sim_dma_hw.multi_channel_trigger.bind(SIM_REG_DMA_MULTI_CHAN_TRIGGER, 0);
+	sim_dma_hw.abort.bind(SIM_REG_DMA_ABORT, 0);
+
+	sim_ssi_hw.ssienr.bind(SIM_REG_SSI_SSIENR, 0);
+	sim_ssi_hw.ctrlr1.bind(SIM_REG_SSI_CTRLR1, 0);
+	sim_ssi_hw.dr0.bind(SIM_REG_SSI_DR0, 0);
+	sim_ssi_hw.baudr.bind(SIM_REG_SSI_BAUDR, 0);
+	sim_ssi_hw.dmacr.bind(SIM_REG_SSI_DMACR, 0);
+	sim_xip_ctrl_hw.ctrl.bind(SIM_REG_XIP_CTRL, 0);
+	sim_xip_ctrl_hw.flush.bind(SIM_REG_XIP_FLUSH, 0);
+	// qspi_enable_qspi flushes and enables the cache after a rom load
+	xip_cache.enabled = true;
+	// qspi_init_qspi leaves it enabled, with no DMA
+	ssi.enabled = true;
+	ssi.dmacr = 0;
+
+	// Same as mcu1_main for an uncompressed flash image, or what mcu1 reads
+	// from the flash array
+	if (sim_config.rom_in_flash_array) {
+		flash_array_build();
+	} else if (sim_config.serve_from_flash) {
+		sim_flash_fill(rom_mapping, MAPPING_TABLE_LEN);
+	} else {
+		for (int i = 0; i < MAPPING_TABLE_LEN; i++) {
+			rom_mapping[i] = i;
+		}
+	}
+	g_loadRomFromMemoryArray = !sim_config.serve_from_flash;
+	g_romFromFlashArray = sim_config.rom_in_flash_array;
+	g_psramRomXipCached = sim_config.psram_xip_cached;
+
+	// What MCU2's COMMAND_ROM_READY would leave behind part way through a load
+	g_romReadyCheck = sim_config.rom_ready_mb != 0;
+	for (uint32_t block = 0; block < PI_ROM_READY_WORDS * 32; block++) {
+		if (block < sim_config.rom_ready_mb) {
+			pi_rom_ready[block >> 5] |= 1u << (block & 31);
+		} else {
+			pi_rom_ready[block >> 5] &= ~(1u << (block & 31));
+		}
+	}
+
+	// mcu1 leaves the first chip selected once the rom is loaded
+	psram_chip = g_romFromFlashArray ? FLASH_CHIP_INDEX : START_ROM_LOAD_CHIP_INDEX;
+}
+
+bool sim_run(void)
+{
+	try {
+		n64_pi_run();
+	} catch (const sim_trace_end &) {
+		return true;
+	} catch (const sim_stall &) {
+		return false;
+	}
+
+	// n64_pi_run only returns when asked to restart
+	return true;
+}
@@ -0,0 +1,164 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "sim_sdk.h"
+
+// RCP clock driving the PI bus
+#define SIM_RCP_CLOCK_HZ (62500000)
+
+// Header timing the IPL uses before it has read the ROM header
+#define SIM_BOOT_PI_PWD (0xFF)
+#define SIM_BOOT_PI_LAT (0xFF)
+#define SIM_BOOT_PI_RLS (0x03)
+
+typedef enum {
+	SIM_REGION_ROM,
+	SIM_REGION_SRAM,
+	SIM_REGION_BASE,
+	SIM_REGION_CIBASE,
+	SIM_REGION_OTHER,
+	SIM_REGION_COUNT
+} sim_region_t;
+
+typedef struct {
+	uint32_t sys_khz;
+	uint32_t qspi_div;
+	bool serve_from_flash;
+	// Serve the rom deduplicated from the flash array chips (g_romFromFlashArray)
+	bool rom_in_flash_array;
+	// Rom size, the flash array is built from this much of it
+	uint32_t rom_bytes;
+	// The address pattern rom reads 0xFF from here on, 0 for never
+	uint32_t rom_pad_from;
+	// Serve the PSRAM rom through the XIP cache (g_psramRomXipCached)
+	bool psram_xip_cached;
+	// Only this many MB of the rom are loaded (g_romReadyCheck), 0 for all of it
+	uint32_t rom_ready_mb;
+
+	// Domain 2 (SRAM) timing, set by the game through PI_BSD_DOM2_*
+	uint32_t dom2_lat;
+	uint32_t dom2_pwd;
+	uint32_t dom2_rls;
+
+	// Idle RCP cycles between transactions when the trace doesn't say
+	uint32_t default_idle_rcp;
+
+	// Use this PWD instead of the one served in the header, -1 to not override
+	int dom1_pwd_override;
+} sim_config_t;
+
+// Cycles charged per register access. The sim only sees register accesses,
+// CPU work between them is not counted, so every figure is a lower bound.
+// Defaults are the per-access estimates annotated in n64_pi_task.c.
+typedef struct {
+	uint32_t pio_fstat;
+	uint32_t pio_rxf;
+	uint32_t pio_txf;
+	uint32_t dma_reg;
+	uint32_t gpio;
+
+	// Fixed AHB/XIP overhead on top of the SSI clocks of a PSRAM read
+	uint32_t xip_overhead;
+	// SSI clocks for one uncached 0xEB quad read of one 32-bit frame:
+	// 2 cmd + 6 addr + 6 wait + 8 data
+	uint32_t xip_read_clocks;
+	// DMA read of a RAM or cached flash address
+	uint32_t mem_read;
+
+	// SSI register access
+	uint32_t ssi_reg;
+	// SSI clocks before the first frame of a direct quad read: 2 cmd + 6 addr + 6 wait
+	uint32_t ssi_setup_clocks;
+	// SSI clocks per 32-bit frame after that
+	uint32_t ssi_frame_clocks;
+	// Same for a flash array chip: 8 cmd + 8 addr and mode + 4 wait
+	uint32_t flash_setup_clocks;
+
+	// XIP cache flush, roughly a cycle per set
+	uint32_t xip_flush;
+} sim_cost_t;
+
+typedef struct {
+	uint64_t addresses;
+	uint64_t reads;
+	uint64_t writes;
+	uint64_t unhandled;
+	uint64_t latency_total;
+	uint64_t latency_min;
+	uint64_t latency_max;
+	int64_t margin_min;
+	uint64_t misses;
+	uint64_t bad_data;
+	uint64_t dma_busy_polls;
+	uint64_t chip_switches;
+	uint64_t not_ready;
+	uint64_t cycles;
+} sim_region_stats_t;
+
+typedef struct {
+	// Op is either `count` read strobes, or one write strobe of `value`
+	bool is_write;
+	uint32_t count;
+	uint16_t value;
+} sim_op_t;
+
+typedef struct {
+	uint32_t address;
+	uint32_t idle_rcp;
+	std::vector<sim_op_t> ops;
+} sim_txn_t;
+
+extern sim_config_t sim_config;
+extern sim_cost_t sim_cost;
+extern sim_region_stats_t sim_stats[SIM_REGION_COUNT];
+extern uint64_t sim_now;
+
+// PI timing as last configured through the ROM header
+extern uint32_t sim_dom1_lat;
+extern uint32_t sim_dom1_pwd;
+extern uint32_t sim_dom1_rls;
+extern uint16_t sim_header_words[2];
+extern uint64_t sim_dma_retrigger_while_busy;
+// Direct SSI reads that held the PSRAM CS low longer than its tCEM
+extern uint64_t sim_psram_tcem_violations;
+// XIP reads made while RDMAE was set, on hardware the stream channel takes their data
+extern uint64_t sim_xip_with_rdmae;
+extern uint64_t sim_ssi_streams;
+extern uint64_t sim_cs_toggle_mismatch;
+extern uint64_t sim_xip_cache_hits;
+extern uint64_t sim_xip_cache_misses;
+extern uint64_t sim_xip_cache_flushes;
+extern uint32_t sim_flash_array_unique_chunks;
+extern uint32_t sim_flash_array_blocks;
+// Compressed rom in mcu1's flash, in chunks of 1 << sim_flash_chunk_shift bytes
+extern const uint32_t sim_flash_chunk_shift;
+extern uint32_t sim_flash_unique_chunks;
+extern bool sim_stalled;
+
+void sim_hw_init(void);
+sim_region_t sim_region_for_address(uint32_t address);
+const char *sim_region_name(sim_region_t region);
+
+// ROM image served by the simulated memory array. Without an image a
+// deterministic address pattern is served instead.
+void sim_rom_set_image(const uint8_t *data, size_t len);
+uint8_t sim_rom_read8(uint32_t offset);
+uint16_t sim_rom_read16_be(uint32_t offset);
+
+// Trace to replay
+void sim_bus_set_trace(const std::vector<sim_txn_t> *txns);
+
+// Run n64_pi_run until the trace has been replayed. Returns false if the
+// handler stalled (stopped answering the bus).
+bool sim_run(void);
+
+uint64_t sim_rcp_to_sys(uint64_t rcp_cycles);
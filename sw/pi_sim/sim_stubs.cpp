@@ -0,0 +1,173 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+// Stand-ins for the firmware globals and functions n64_pi_task.c links
+// against. Nothing here is timing critical for the PI handler, so none of it
+// is charged any cycles.
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "sim_hw.h"
+
+#include "sdcard/internal_sd_card.h"
+#include "n64_pi_task.h"
+#include "qspi_helper.h"
+#include "sram.h"
+
+#include "rom_dedup.h"
+
+#define SIM_FLASH_CHUNKS (16384 - 8)
+
+// Same as rom_vars.h, the pi_sim_chunk256 build finds the rom_chunk_size.h
+// load_rom wrote for it
+#if __has_include("rom_chunk_size.h")
+#include "rom_chunk_size.h"
+#else
+#define COMPRESSION_SHIFT_AMOUNT 10
+#endif
+
+// Written at startup by sim_flash_fill. Deliberately not declared through
+// rom_vars.h, which makes the array const like the real flash image.
+unsigned char rom_chunks[SIM_FLASH_CHUNKS][1 << COMPRESSION_SHIFT_AMOUNT];
+const uint32_t sim_flash_chunk_shift = COMPRESSION_SHIFT_AMOUNT;
+uint32_t sim_flash_unique_chunks = 0;
+
+uint16_t *sram;
+volatile bool g_restart_pi_handler = false;
+volatile uint16_t ddr64_uart_tx_buf[DDR64_BASE_ADDRESS_LENGTH];
+volatile bool sd_is_busy = false;
+volatile bool did_write_SRAM = false;
+volatile uint32_t qspi_rx_sample_dly = QSPI_DEFAULT_RX_SAMPLE_DLY;
+
+uint32_t sim_sd_read_sector_parts[2];
+uint32_t sim_sd_read_sector_counts[2];
+uint32_t sim_uart_bytes_sent = 0;
+uint32_t sim_core1_commands = 0;
+
+// The rom compressed the way load_rom --compress writes it into mcu1's flash
+void sim_flash_fill(uint16_t *mapping, uint32_t entries)
+{
+	std::vector<uint8_t> rom(std::min<uint32_t>(sim_config.rom_bytes, entries << COMPRESSION_SHIFT_AMOUNT));
+	for (uint32_t i = 0; i < rom.size(); i++) {
+		rom[i] = sim_rom_read8(i);
+	}
+
+	rom_dedup_t dedup;
+	rom_dedup(rom.data(), rom.size(), COMPRESSION_SHIFT_AMOUNT, true, &dedup);
+	memcpy(rom_chunks, dedup.chunks.data(), dedup.chunks.size());
+	sim_flash_unique_chunks = rom_dedup_unique_chunks(&dedup);
+
+	// Everything past the rom reads back as chunk 0
+	for (uint32_t i = 0; i < entries; i++) {
+		mapping[i] = i < dedup.mapping.size() ? dedup.mapping[i] : 0;
+	}
+}
+
+void ddr64_set_sd_read_sector_part(int index, uint32_t value)
+{
+	sim_sd_read_sector_parts[index & 1] = value;
+}
+
+void ddr64_set_sd_read_sector_count(int index, uint32_t count)
+{
+	sim_sd_read_sector_counts[index & 1] = count;
+}
+
+void ddr64_set_sd_rom_selection_length_register(uint32_t value, int index)
+{
+	(void)value;
+	(void)index;
+}
+
+void ddr64_set_sd_rom_selection(char *titleBuffer, uint32_t len)
+{
+	(void)titleBuffer;
+	(void)len;
+}
+
+void ddr64_set_rom_meta_data(uint32_t value, int index)
+{
+	(void)value;
+	(void)index;
+}
+
+void uart_tx_program_putc(char c)
+{
+	(void)c;
+	sim_uart_bytes_sent++;
+}
+
+void multicore_fifo_push_blocking(uint32_t data)
+{
+	(void)data;
+	sim_core1_commands++;
+}
+
+bool multicore_fifo_rvalid(void)
+{
+	return false;
+}
+
+uint32_t multicore_fifo_pop_blocking(void)
+{
+	return 0;
+}
+
+uint32_t time_us_32(void)
+{
+	return (uint32_t)(sim_now / (sim_config.sys_khz / 1000));
+}
+
+uint32_t clock_get_hz(enum clock_index clk_index)
+{
+	return sim_config.sys_khz * 1000;
+}
+
+bool gpio_get(uint gpio)
+{
+	// N64 cold reset is released for the whole run
+	(void)gpio;
+	return true;
+}
+
+void gpio_put(uint gpio, bool value)
+{
+	(void)gpio;
+	(void)value;
+}
+
+void gpio_init(uint gpio)
+{
+	(void)gpio;
+}
+
+void gpio_set_dir(uint gpio, bool out)
+{
+	(void)gpio;
+	(void)out;
+}
+
+void gpio_set_pulls(uint gpio, bool up, bool down)
+{
+	(void)gpio;
+	(void)up;
+	(void)down;
+}
+
+void gpio_set_drive_strength(uint gpio, uint drive)
+{
+	(void)gpio;
+	(void)drive;
+}
+
+void gpio_set_function(uint gpio, uint fn)
+{
+	(void)gpio;
+	(void)fn;
+}
@@ -0,0 +1,28 @@
+/**
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2023 Kaili Hill
+ */
+
+// Checks for the host tests. A failed CHECK prints where and why and the test
+// carries on, main ends with return test_result().
+
+#pragma once
+
+#include <stdio.h>
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+static inline int test_result() {
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures ? 1 : 0;
+}